@@ -0,0 +1,130 @@
+//
+// Wireless Command Station
+//
+// Copyright 2020 Robert Nagowski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// See gpl-3.0.md file for details.
+//
+// Opóźnienie NetQueue::push przy wielu producentach i jednym konsumencie.
+// Użycie: netqueue_bench [liczba_datagramów_na_producenta]
+//
+
+#include <QtGlobal>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "netqueue.h"
+#include "datagrams.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static quint64 percentile(std::vector<quint64>& v, double p)
+{
+    if (v.empty()) {
+        return 0;
+    }
+    size_t idx = static_cast<size_t>(p * (v.size() - 1));
+    std::nth_element(v.begin(), v.begin() + static_cast<long>(idx), v.end());
+    return v[idx];
+}
+
+// jeden przebieg: producers wątków wstawia po count datagramów
+static void runBench(int producers, int count, int dgsize)
+{
+    NetQueue *queue = new NetQueue;
+    std::atomic<bool> done(false);
+    std::atomic<int>  ready(0);
+    std::vector<std::vector<quint64> > lat(static_cast<size_t>(producers));
+    std::vector<int> dropped(static_cast<size_t>(producers), 0);
+    quint64 consumed = 0;
+
+    // konsument: wątek sieciowy opróżniający kolejkę
+    std::thread consumer([&]() {
+        for (;;) {
+            const NetQueue::Slot *slot = queue->front();
+            if (slot != nullptr) {
+                consumed++;
+                queue->pop();
+            }
+            else if (done.load()) {
+                if (queue->front() == nullptr) {
+                    break;
+                }
+            }
+        }
+    });
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++) {
+        threads.push_back(std::thread([&, p]() {
+            char data[NETQ_SLOT_SIZE] = { 0 };
+            std::vector<quint64>& samples = lat[static_cast<size_t>(p)];
+            samples.reserve(static_cast<size_t>(count));
+            ready++;
+            while (ready.load() < producers) {
+            }
+            for (int i = 0; i < count; i++) {
+                Clock::time_point t0 = Clock::now();
+                bool ok = queue->push(static_cast<quint32>(p), data, dgsize);
+                Clock::time_point t1 = Clock::now();
+                if (!ok) {
+                    dropped[static_cast<size_t>(p)]++;
+                    continue;
+                }
+                samples.push_back(static_cast<quint64>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>
+                        (t1 - t0).count()));
+            }
+        }));
+    }
+
+    for (size_t t = 0; t < threads.size(); t++) {
+        threads[t].join();
+    }
+    done.store(true);
+    consumer.join();
+
+    std::vector<quint64> all;
+    int drops = 0;
+    for (int p = 0; p < producers; p++) {
+        all.insert(all.end(), lat[static_cast<size_t>(p)].begin(),
+                   lat[static_cast<size_t>(p)].end());
+        drops += dropped[static_cast<size_t>(p)];
+    }
+
+    printf("%9d %6dB %9llu %6d %8llu %8llu %8llu %8llu\n",
+           producers, dgsize, static_cast<unsigned long long>(consumed), drops,
+           static_cast<unsigned long long>(percentile(all, 0.50)),
+           static_cast<unsigned long long>(percentile(all, 0.90)),
+           static_cast<unsigned long long>(percentile(all, 0.99)),
+           static_cast<unsigned long long>(percentile(all, 0.999)));
+    delete queue;
+
+} // runBench
+
+int main(int argc, char *argv[])
+{
+    int count = (argc > 1) ? atoi(argv[1]) : 200000;
+    int maxProducers = static_cast<int>(std::thread::hardware_concurrency());
+    maxProducers = qBound(2, maxProducers, 16);
+
+    printf("producers   size  consumed  drops  p50[ns]  p90[ns]  p99[ns] p999[ns]\n");
+    for (int producers = 1; producers <= maxProducers; producers *= 2) {
+        runBench(producers, count, sizeof(NetDatagram_dg));
+        runBench(producers, count, sizeof(WiFiStation_dg));
+    }
+
+    return 0;
+
+} // main
+
+// EOF netqueue_bench.cpp
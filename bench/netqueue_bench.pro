@@ -0,0 +1,21 @@
+#-------------------------------------------------
+#
+# Mikrobenchmark kolejki datagramów wychodzących
+#
+#-------------------------------------------------
+
+QT       -= gui
+
+TARGET = netqueue_bench
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+INCLUDEPATH += ..
+
+SOURCES += \
+        netqueue_bench.cpp \
+        ../netqueue.cpp
+
+HEADERS += \
+        ../netqueue.h
@@ -0,0 +1,431 @@
+//
+// Wireless Command Station
+//
+// Copyright 2020 Robert Nagowski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// See gpl-3.0.md file for details.
+//
+// Benchmark NetEngine z centralkami symulowanymi w tym samym procesie.
+// Wyniki w formacie JSON, do porównania kolejnych wersji.
+// Użycie: wics_bench [--quick] [--label nazwa] [--out plik.json]
+//
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QHostAddress>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QTimer>
+
+#include <algorithm>
+#include <random>
+
+#ifdef Q_OS_LINUX
+#include <pthread.h>
+#include <time.h>
+#endif
+
+#include "datagrams.h"
+#include "netengine.h"
+#include "simstation.h"
+
+#define BENCH_LOCAL_PORT    21200   // port NetEngine
+#define BENCH_SIM_PORT      21201   // port symulowanych centralek
+#define BENCH_SIM_ADDR      0x7F000002  // 127.0.0.2
+#define BENCH_HUB_ADDR      0x7F000001  // 127.0.0.1: wszystkie centralki
+#define BENCH_MAX_TIME      600000  // limit jednej aktualizacji [ms]
+
+static NetEngine *thNet;
+#ifdef Q_OS_LINUX
+static clockid_t  engineClock;      // zegar CPU wątku sieciowego
+static bool       fEngineClock = false;
+#endif
+
+// czas CPU wątku sieciowego [us], -1: niedostępny
+static qint64 engineCpu()
+{
+#ifdef Q_OS_LINUX
+    struct timespec ts;
+    if (fEngineClock && (clock_gettime(engineClock, &ts) == 0)) {
+        return static_cast<qint64>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+    }
+#endif
+    return -1;
+}
+
+// pętla zdarzeń do wywołania done() lub upływu tout [ms]
+static bool waitFor(QEventLoop& loop, int tout)
+{
+    QTimer timer;
+    timer.setSingleShot(true);
+    QObject::connect(&timer, &QTimer::timeout, &loop, [&loop]() { loop.exit(1); });
+    timer.start(tout);
+    return loop.exec() == 0;
+}
+
+static SimConfig simConfig(int rtt, int loss, const QString& outDir)
+{
+    SimConfig cfg;
+    cfg.loss = loss;
+    cfg.rtt = rtt;
+    cfg.jitter = rtt / 4;
+    cfg.reorder = 0;
+    cfg.flash = 0;
+    cfg.maxBlock = SIM_MAX_BLOCK;
+    cfg.outDir = outDir;
+    return cfg;
+}
+
+// jedna aktualizacja: obraz size bajtów, moduł, RTT, utrata i maks.
+// rozmiar bloku (1: strona); changed >= 0: centralka ma poprzedni obraz,
+// zmieniony w changed promilach stron, wysyłane tylko różniące się strony
+static QJsonObject benchUpgrade(const QString& dir, qint64 size, int module,
+                                int rtt, int loss, int window, int block,
+                                int changed = -1)
+{
+    int page = (module == UPGRADE_WLAN) ? UPG_WLAN_PAGE : UPG_DCCG_PAGE;
+    QJsonObject res;
+    res.insert("size", size);
+    res.insert("page", page);
+    res.insert("rtt_ms", rtt);
+    res.insert("loss_pct", loss);
+    res.insert("window", window);
+    res.insert("block_max", block);
+    if (changed >= 0) {
+        res.insert("changed_permille", changed);
+    }
+
+    // obraz o powtarzalnej treści
+    QByteArray image(static_cast<int>(size), 0);
+    std::mt19937 rnd(static_cast<unsigned>(size));
+    for (int cnt = 0; cnt < image.size(); cnt++) {
+        image[cnt] = static_cast<char>(rnd());
+    }
+    QString simName = dir + QString("/%1-%2.bin")
+                            .arg(QHostAddress(BENCH_SIM_ADDR).toString())
+                            .arg(module == UPGRADE_WLAN ? "wlan" : "dcc");
+    QFile::remove(simName);
+    if (changed >= 0) {
+        // pamięć flash centralki: poprzednia wersja obrazu
+        QFile flash(simName);
+        flash.open(QIODevice::WriteOnly);
+        flash.write(image);
+        flash.close();
+        int pages = image.size() / page;
+        for (int cnt = 0; cnt < pages; cnt++) {
+            if (static_cast<int>(rnd() % 1000) < changed) {
+                image[cnt * page + static_cast<int>(rnd() % page)] ^= 0x5A;
+            }
+        }
+    }
+    QString imageName = dir + "/image.bin";
+    QFile file(imageName);
+    file.open(QIODevice::WriteOnly);
+    file.write(image);
+    file.close();
+
+    SimStation station(BENCH_SIM_ADDR, BENCH_SIM_PORT, 0x51000001,
+                       simConfig(rtt, loss, dir));
+    station.open();
+    thNet->setUpgradeWindow(window);
+    thNet->setUpgradeSparse(changed >= 0);
+    thNet->setUpgradeBlock(block);
+    thNet->openImageFile(imageName);
+
+    QEventLoop loop;
+    QObject    ctx;
+    int blocks = 0;
+    int nextBlock = 0;
+
+    QObject::connect(thNet, &NetEngine::upgradeinit, &ctx,
+                     [&](quint32, int steps) { blocks = steps; });
+    QObject::connect(thNet, &NetEngine::upgradestep, &ctx,
+                     [&](quint32, quint16 block, quint16 result) {
+        if (static_cast<int>(block) < nextBlock) {
+            return;
+        }
+        if (result != RESULT_OK) {
+            loop.exit(2);
+            return;
+        }
+        nextBlock = block + 1;
+        if (nextBlock > blocks) {
+            loop.exit(0);
+        }
+    });
+    // ponowienia w NetEngine; noanswer: limit wyczerpany
+    QObject::connect(thNet, &NetEngine::noanswer, &ctx,
+                     [&](quint32) { loop.exit(3); });
+
+    QElapsedTimer elapsed;
+    qint64 cpu0 = engineCpu();
+    elapsed.start();
+    thNet->sendUpgradeInit(BENCH_SIM_ADDR, module);
+    bool fDone = waitFor(loop, BENCH_MAX_TIME);
+    qint64 time = elapsed.nsecsElapsed() / 1000;
+    qint64 cpu1 = engineCpu();
+    thNet->closeSession(BENCH_SIM_ADDR);
+    thNet->setUpgradeSparse(false);
+
+    QFile simFile(simName);
+    bool fVerified = fDone && simFile.open(QIODevice::ReadOnly)
+                     && (simFile.readAll() == image);
+
+    res.insert("completed", fDone);
+    res.insert("verified", fVerified);
+    res.insert("time_ms", time / 1000.0);
+    res.insert("bytes_per_s", (time > 0) ? size * 1000000.0 / time : 0.0);
+    res.insert("blocks", blocks);
+    res.insert("engine_cpu_ms", (cpu0 < 0) ? -1.0 : (cpu1 - cpu0) / 1000.0);
+    return res;
+
+} // benchUpgrade
+
+// czas od wysłania żądania do wypełnienia tablicy count centralkami
+static QJsonObject benchDiscovery(const QString& dir, int count, int rtt,
+                                  int repeat)
+{
+    QList<SimStation*> stations;
+    for (int cnt = 0; cnt < count; cnt++) {
+        SimStation *s = new SimStation(BENCH_SIM_ADDR + static_cast<quint32>(cnt),
+                                       BENCH_SIM_PORT, 0x51000001 + static_cast<quint32>(cnt),
+                                       simConfig(rtt, 0, dir));
+        s->open();
+        stations.append(s);
+    }
+
+    // żądanie na 127.0.0.1 trafia do każdej centralki, jak rozgłoszenie
+    QUdpSocket hub;
+    hub.bind(QHostAddress(BENCH_HUB_ADDR), BENCH_SIM_PORT,
+             QUdpSocket::ShareAddress | QUdpSocket::ReuseAddressHint);
+    QObject::connect(&hub, &QUdpSocket::readyRead, [&hub, &stations]() {
+        QByteArray datagram;
+        while (hub.hasPendingDatagrams()) {
+            quint16      senderPort;
+            QHostAddress senderAddr;
+            datagram.resize(static_cast<int>(hub.pendingDatagramSize()));
+            if (-1 == hub.readDatagram(datagram.data(), datagram.size(),
+                                       &senderAddr, &senderPort)) {
+                continue;
+            }
+            for (int cnt = 0; cnt < stations.count(); cnt++) {
+                stations.at(cnt)->processDatagram(senderAddr.toIPv4Address(),
+                                                  senderPort, datagram);
+            }
+        }
+    });
+
+    QList<double> first;
+    QList<double> all;
+    for (int rep = 0; rep < repeat; rep++) {
+        QEventLoop    loop;
+        QObject       ctx;
+        QElapsedTimer elapsed;
+        double tFirst = -1;
+        QObject::connect(thNet, static_cast<void (NetEngine::*)(const DeviceInfo&)>
+                         (&NetEngine::configinfo), &ctx, [&](const DeviceInfo&) {
+            if (tFirst < 0) {
+                tFirst = elapsed.nsecsElapsed() / 1e6;
+            }
+            if (thNet->deviceList().count() >= count) {
+                loop.exit(0);
+            }
+        });
+        elapsed.start();
+        thNet->findDevices(BENCH_HUB_ADDR);
+        if (waitFor(loop, DEF_TOUT_DGRAM * 2)) {
+            first.append(tFirst);
+            all.append(elapsed.nsecsElapsed() / 1e6);
+        }
+    }
+    qDeleteAll(stations);
+
+    std::sort(first.begin(), first.end());
+    std::sort(all.begin(), all.end());
+    QJsonObject res;
+    res.insert("stations", count);
+    res.insert("rtt_ms", rtt);
+    res.insert("runs", repeat);
+    res.insert("complete", all.count());
+    res.insert("first_ms_p50", first.isEmpty() ? -1.0 : first.at(first.count() / 2));
+    res.insert("all_ms_p50", all.isEmpty() ? -1.0 : all.at(all.count() / 2));
+    res.insert("all_ms_max", all.isEmpty() ? -1.0 : all.last());
+    return res;
+
+} // benchDiscovery
+
+// CPU wątku sieciowego: żądania DEVINFO i odpowiedzi, paczkami
+// mieszczącymi się w kolejce wysyłania
+static QJsonObject benchCpu(const QString& dir, int requests)
+{
+    SimStation station(BENCH_SIM_ADDR, BENCH_SIM_PORT, 0x51000001,
+                       simConfig(0, 0, dir));
+    station.open();
+
+    QEventLoop loop;
+    QObject    ctx;
+    int received = 0;
+    int expected = 0;
+    QObject::connect(thNet, static_cast<void (NetEngine::*)(const DeviceInfo&)>
+                     (&NetEngine::configinfo), &ctx, [&](const DeviceInfo&) {
+        if (++received >= expected) {
+            loop.exit(0);
+        }
+    });
+
+    qint64 cpu0 = engineCpu();
+    int sent = 0;
+    while (sent < requests) {
+        int batch = qMin(128, requests - sent);
+        expected = received + batch;
+        for (int cnt = 0; cnt < batch; cnt++) {
+            thNet->sendDevInfoReq(BENCH_SIM_ADDR);
+        }
+        sent += batch;
+        if (!waitFor(loop, DEF_TOUT_DGRAM)) {
+            break;
+        }
+    }
+    qint64 cpu1 = engineCpu();
+
+    int datagrams = sent + received;
+    QJsonObject res;
+    res.insert("datagrams", datagrams);
+    res.insert("engine_cpu_ms", (cpu0 < 0) ? -1.0 : (cpu1 - cpu0) / 1000.0);
+    res.insert("cpu_us_per_1000", ((cpu0 < 0) || (datagrams == 0)) ? -1.0
+               : (cpu1 - cpu0) * 1000.0 / datagrams);
+    return res;
+
+} // benchCpu
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption optQuick("quick", "Skrócona macierz przypadków.");
+    QCommandLineOption optLabel("label", "Nazwa wersji w wynikach.", "label", "");
+    QCommandLineOption optOut("out", "Plik wyników (domyślnie stdout).", "file");
+    parser.addOption(optQuick);
+    parser.addOption(optLabel);
+    parser.addOption(optOut);
+    parser.process(a);
+    bool fQuick = parser.isSet(optQuick);
+
+    QTemporaryDir dir;
+    if (!dir.isValid()) {
+        return 1;
+    }
+
+    thNet = new NetEngine(&a);
+#ifdef Q_OS_LINUX
+    // zegar CPU pobrany w wątku sieciowym
+    QObject::connect(thNet, &NetEngine::connected, thNet, [](quint16) {
+        fEngineClock = (pthread_getcpuclockid(pthread_self(), &engineClock) == 0);
+    }, Qt::DirectConnection);
+#endif
+    {
+        QEventLoop loop;
+        QObject::connect(thNet, &NetEngine::connected, &loop,
+                         [&loop](quint16 port) { loop.exit(port > 0 ? 0 : 1); },
+                         Qt::QueuedConnection);
+        thNet->openSocket(BENCH_LOCAL_PORT, BENCH_SIM_PORT);
+        if (loop.exec() != 0) {
+            QTextStream(stderr) << "Nie można otworzyć portu " << BENCH_LOCAL_PORT << "\n";
+            return 1;
+        }
+    }
+
+    QList<qint64> sizes;
+    QList<int> rtts;
+    QList<int> losses;
+    QList<int> counts;
+    QList<int> blocks;
+    // blok równy stronie i mieszczący się w ramce Ethernet
+    blocks << 1 << UPG_DEF_MTU - UPG_IP_OVERHEAD - static_cast<int>(sizeof(UpgradeSparse_dg));
+    if (fQuick) {
+        sizes << 65536;
+        rtts << 0 << 10;
+        losses << 0 << 2;
+        counts << 1 << 8;
+    }
+    else {
+        sizes << 65536 << 262144 << 1048576;
+        rtts << 0 << 5 << 20;
+        losses << 0 << 1 << 5;
+        counts << 1 << 8 << 32;
+    }
+
+    QJsonArray upgrade;
+    for (int s = 0; s < sizes.count(); s++) {
+        for (int m = UPGRADE_WLAN; m <= UPGRADE_DCCGEN; m++) {
+            for (int r = 0; r < rtts.count(); r++) {
+                for (int l = 0; l < losses.count(); l++) {
+                    for (int b = 0; b < blocks.count(); b++) {
+                        upgrade.append(benchUpgrade(dir.path(), sizes.at(s), m,
+                                                    rtts.at(r), losses.at(l),
+                                                    DEF_UPG_WINDOW, blocks.at(b)));
+                    }
+                }
+            }
+        }
+    }
+
+    // wydanie poprawkowe: pełna aktualizacja i tylko zmienione strony
+    QJsonArray patch;
+    for (int m = UPGRADE_WLAN; m <= UPGRADE_DCCGEN; m++) {
+        for (int r = 0; r < rtts.count(); r++) {
+            patch.append(benchUpgrade(dir.path(), sizes.last(), m, rtts.at(r),
+                                      0, DEF_UPG_WINDOW, blocks.last()));
+            patch.append(benchUpgrade(dir.path(), sizes.last(), m, rtts.at(r),
+                                      0, DEF_UPG_WINDOW, blocks.last(), 10));
+        }
+    }
+
+    QJsonArray discovery;
+    for (int c = 0; c < counts.count(); c++) {
+        discovery.append(benchDiscovery(dir.path(), counts.at(c), 0, fQuick ? 5 : 20));
+        discovery.append(benchDiscovery(dir.path(), counts.at(c), 10, fQuick ? 5 : 20));
+    }
+
+    QJsonObject result;
+    result.insert("label", parser.value(optLabel));
+    result.insert("timestamp", QDateTime::currentDateTimeUtc().toString(Qt::ISODate));
+    result.insert("upgrade", upgrade);
+    result.insert("patch", patch);
+    result.insert("discovery", discovery);
+    result.insert("cpu", benchCpu(dir.path(), fQuick ? 2000 : 20000));
+    result.insert("metrics", thNet->metricsJson());
+
+    thNet->closeSocket();
+    thNet->wait();
+
+    QByteArray json = QJsonDocument(result).toJson(QJsonDocument::Indented);
+    if (parser.isSet(optOut)) {
+        QFile out(parser.value(optOut));
+        if (!out.open(QIODevice::WriteOnly)) {
+            return 1;
+        }
+        out.write(json);
+    }
+    else {
+        QTextStream(stdout) << json;
+    }
+
+    return 0;
+
+} // main
+
+// EOF wics_bench.cpp
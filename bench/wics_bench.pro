@@ -0,0 +1,23 @@
+#-------------------------------------------------
+#
+# Benchmark NetEngine: aktualizacja, wyszukiwanie, CPU wątku sieciowego
+#
+#-------------------------------------------------
+
+QT       -= gui
+
+TARGET = wics_bench
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+INCLUDEPATH += ../sim
+
+SOURCES += \
+        wics_bench.cpp \
+        ../sim/simstation.cpp
+
+HEADERS += \
+        ../sim/simstation.h
+
+include(../netengine.pri)
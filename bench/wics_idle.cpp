@@ -0,0 +1,206 @@
+//
+// Wireless Command Station
+//
+// Copyright 2020 Robert Nagowski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// See gpl-3.0.md file for details.
+//
+// Bezczynny wątek sieciowy: CPU procesu przez --idle ms, potem opóźnienie
+// odpowiedzi na pojedyncze żądania DEVINFO, od sendDevInfoReq() do sygnału
+// configinfo. Używa tylko slotów i sygnałów obecnych od pierwszej wersji
+// NetEngine, więc mierzy także wersję sprzed pętli zdarzeń (bez
+// netengine.pri wics_idle.pro ustawia WICS_IDLE_BASELINE).
+// Użycie: wics_idle [--idle ms] [--requests n] [--label nazwa] [--out plik.json]
+//
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QHostAddress>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTextStream>
+#include <QTimer>
+#include <QUdpSocket>
+#include <QtEndian>
+
+#include <algorithm>
+#include <vector>
+
+#ifdef Q_OS_UNIX
+#include <time.h>
+#endif
+
+#include "datagrams.h"
+#include "netengine.h"
+
+#define IDLE_PORT           21210   // port NetEngine i centralki
+#define IDLE_STATION_ADDR   0x7F000002  // 127.0.0.2
+
+// czas CPU procesu [us], -1: niedostępny; bezczynny wątek GUI czeka
+// w pętli zdarzeń, więc to w praktyce CPU wątku sieciowego
+static qint64 processCpu()
+{
+#ifdef Q_OS_UNIX
+    struct timespec ts;
+    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) == 0) {
+        return static_cast<qint64>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+    }
+#endif
+    return -1;
+}
+
+// pętla zdarzeń do wywołania exit(0) lub upływu tout [ms]
+static bool waitFor(QEventLoop& loop, int tout)
+{
+    QTimer timer;
+    timer.setSingleShot(true);
+    QObject::connect(&timer, &QTimer::timeout, &loop, [&loop]() { loop.exit(1); });
+    timer.start(tout);
+    return loop.exec() == 0;
+}
+
+// odpowiedź centralki na WICS_DEVINFO_GET, inne żądania pomijane
+static void answerDevInfo(QUdpSocket& station)
+{
+    while (station.hasPendingDatagrams()) {
+        QByteArray   datagram(static_cast<int>(station.pendingDatagramSize()), 0);
+        QHostAddress senderAddr;
+        quint16      senderPort;
+        if ((station.readDatagram(datagram.data(), datagram.size(),
+                                  &senderAddr, &senderPort) < 6)
+            || (qFromLittleEndian<quint16>(datagram.constData() + 4)
+                != WICS_DEVINFO_GET)) {
+            continue;
+        }
+        uchar reply[sizeof(DeviceInfo_dg)] = {};
+        qToLittleEndian<quint16>(sizeof(DeviceInfo_dg), reply);
+        qToLittleEndian<quint16>(LAN_WICS_MESSAGE, reply + 2);
+        qToLittleEndian<quint16>(WICS_DEVINFO, reply + 4);
+        qToLittleEndian<quint16>(HW_NGS_WICS, reply + 8);
+        qToLittleEndian<quint32>(0x51000002, reply + 20);
+        station.writeDatagram(reinterpret_cast<const char*>(reply), sizeof(reply),
+                              senderAddr, senderPort);
+    }
+}
+
+static qint64 percentile(std::vector<qint64>& v, int p)
+{
+    if (v.empty()) {
+        return -1;
+    }
+    std::sort(v.begin(), v.end());
+    return v.at(std::min(v.size() - 1, v.size() * static_cast<size_t>(p) / 100));
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption optIdle("idle", "Czas pomiaru bezczynności [ms].", "ms", "10000");
+    QCommandLineOption optRequests("requests", "Liczba żądań DEVINFO.", "n", "1000");
+    QCommandLineOption optLabel("label", "Nazwa wersji w wynikach.", "label", "");
+    QCommandLineOption optOut("out", "Plik wyników JSON.", "file", "");
+    parser.addOption(optIdle);
+    parser.addOption(optRequests);
+    parser.addOption(optLabel);
+    parser.addOption(optOut);
+    parser.process(a);
+
+    // NetEngine nasłuchuje na wszystkich adresach, centralka na 127.0.0.2
+    // i tym samym porcie (wersja bazowa wysyła na własny port)
+    QUdpSocket station;
+    if (!station.bind(QHostAddress(IDLE_STATION_ADDR), IDLE_PORT,
+                      QUdpSocket::ShareAddress | QUdpSocket::ReuseAddressHint)) {
+        qCritical("Centralka: port %d zajęty", IDLE_PORT);
+        return 1;
+    }
+    QObject::connect(&station, &QUdpSocket::readyRead, [&station]() {
+        answerDevInfo(station);
+    });
+
+    NetEngine  engine;
+    QEventLoop loop;
+    QObject::connect(&engine, &NetEngine::connected, &loop, [&loop](quint16 port) {
+        loop.exit((port != 0) ? 0 : 1);
+    });
+#ifdef WICS_IDLE_BASELINE
+    QObject::connect(&engine, &NetEngine::configinfo, &loop,
+                     [&loop](quint16, QString) { loop.exit(0); });
+#else
+    QObject::connect(&engine, static_cast<void (NetEngine::*)(const DeviceInfo&)>
+                     (&NetEngine::configinfo), &loop,
+                     [&loop](const DeviceInfo&) { loop.exit(0); });
+#endif
+    engine.openSocket(IDLE_PORT);
+    if (!waitFor(loop, DEF_TOUT_DGRAM)) {
+        qCritical("NetEngine: port %d zajęty", IDLE_PORT);
+        return 1;
+    }
+
+    // bezczynność: otwarte gniazdo, brak ruchu
+    QElapsedTimer wall;
+    qint64 cpu0 = processCpu();
+    wall.start();
+    waitFor(loop, parser.value(optIdle).toInt());
+    qint64 cpu1 = processCpu();
+    qint64 elapsed = qMax(wall.elapsed(), Q_INT64_C(1));
+
+    // opóźnienie: następne żądanie po odpowiedzi na poprzednie
+    std::vector<qint64> latency;
+    int requests = parser.value(optRequests).toInt();
+    QElapsedTimer rtt;
+    for (int cnt = 0; cnt < requests; cnt++) {
+        rtt.start();
+        engine.sendDevInfoReq(IDLE_STATION_ADDR);
+        if (!waitFor(loop, DEF_TOUT_DGRAM)) {
+            break;
+        }
+        latency.push_back(rtt.nsecsElapsed() / 1000);
+    }
+    int answered = static_cast<int>(latency.size());
+
+    QJsonObject result;
+    result.insert("label", parser.value(optLabel));
+    result.insert("timestamp", QDateTime::currentDateTimeUtc().toString(Qt::ISODate));
+#ifdef WICS_IDLE_BASELINE
+    result.insert("baseline", true);
+#else
+    result.insert("baseline", false);
+#endif
+    result.insert("idle_ms", elapsed);
+    result.insert("idle_cpu_pct", (cpu0 < 0) ? -1.0 : (cpu1 - cpu0) / (elapsed * 10.0));
+    result.insert("requests", answered);
+    result.insert("latency_max_us", latency.empty() ? -1
+                  : *std::max_element(latency.begin(), latency.end()));
+    result.insert("latency_p50_us", percentile(latency, 50));
+    result.insert("latency_p99_us", percentile(latency, 99));
+
+    QByteArray json = QJsonDocument(result).toJson(QJsonDocument::Indented);
+    if (parser.isSet(optOut)) {
+        QFile out(parser.value(optOut));
+        if (!out.open(QIODevice::WriteOnly)) {
+            return 1;
+        }
+        out.write(json);
+    }
+    else {
+        QTextStream(stdout) << json;
+    }
+
+    engine.closeSocket();
+    engine.wait();
+    return (answered == requests) ? 0 : 1;
+
+} // main
+
+// EOF wics_idle.cpp
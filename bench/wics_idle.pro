@@ -0,0 +1,27 @@
+#-------------------------------------------------
+#
+# CPU bezczynnego wątku sieciowego i opóźnienie odpowiedzi,
+# także dla wersji NetEngine sprzed netengine.pri
+#
+#-------------------------------------------------
+
+QT       -= gui
+QT       += network
+
+TARGET = wics_idle
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+SOURCES += \
+        wics_idle.cpp
+
+exists(../netengine.pri) {
+    include(../netengine.pri)
+} else {
+    # pierwsza wersja: pętla run() bez pętli zdarzeń
+    DEFINES += WICS_IDLE_BASELINE
+    INCLUDEPATH += ..
+    SOURCES += ../netengine.cpp
+    HEADERS += ../datagrams.h ../netengine.h
+}
@@ -0,0 +1,32 @@
+//
+// Wireless Command Station
+//
+// Copyright 2020 Robert Nagowski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// See gpl-3.0.md file for details.
+//
+
+#include <QCoreApplication>
+
+#include "wicscli.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("wics_cli");
+
+    WicsCli cli;
+    int res = cli.start(a.arguments());
+    if (res >= 0) {
+        return res;
+    }
+
+    return a.exec();
+
+} // main
+
+// EOF main.cpp
@@ -0,0 +1,27 @@
+#-------------------------------------------------
+#
+# wics_cli: obsługa centralek z linii poleceń, bez QtWidgets
+#
+#-------------------------------------------------
+
+QT       -= gui
+
+TARGET = wics_cli
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+SOURCES += \
+        main.cpp \
+        wicscli.cpp
+
+HEADERS += \
+        wicscli.h
+
+include(../netengine.pri)
+
+# Default rules for deployment.
+unix:!android: target.path = /opt/sw_wics_control/bin
+!isEmpty(target.path): INSTALLS += target
@@ -0,0 +1,527 @@
+//
+// Wireless Command Station
+//
+// Copyright 2020 Robert Nagowski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// See gpl-3.0.md file for details.
+//
+
+#include "wicscli.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QHostAddress>
+#include <QJsonDocument>
+
+WicsCli::WicsCli(QObject *parent)
+       : QObject(parent),
+         out(stdout)
+{
+    thNet = nullptr;
+    devAddr = 0;
+    netPort = DEF_LAN_PORTNUM;
+    peerPort = 0;
+    module = UPGRADE_WLAN;
+    blocks = 0;
+    nextBlock = 0;
+    targetsLeft = 0;
+    targetsFailed = 0;
+    retryCount = DEF_MAX_RETRY;
+    cfgDgramTout = DEF_TOUT_DGRAM;
+    cfgMetrics = false;
+    cfgResume = false;
+    upgWaitDigest = false;
+
+    timerNet = new QTimer(this);
+    timerNet->setSingleShot(true);
+    connect(timerNet, SIGNAL(timeout()), this, SLOT(commandTout()));
+}
+
+// analiza argumentów i otwarcie portu; wynik >= 0: kod wyjścia bez
+// uruchamiania pętli zdarzeń
+int WicsCli::start(const QStringList& arguments)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Wireless Command Station: obsługa centralek");
+    parser.addHelpOption();
+    parser.addPositionalArgument("command",
+        "discover [adres]\n"
+        "devinfo <adres>\n"
+        "wifi-get <adres>\n"
+        "wifi-set <adres> <ssid> <hasło>\n"
+        "upgrade <adres> <plik>\n"
+        "upgrade-group <grupa> <plik> <adres>...");
+    QCommandLineOption optPort(QStringList() << "p" << "port",
+        "Port UDP (domyślnie 21105).", "port", QString::number(DEF_LAN_PORTNUM));
+    QCommandLineOption optPeer("peer-port",
+        "Port UDP centralek, gdy inny niż lokalny (symulator).", "port", "0");
+    QCommandLineOption optTout(QStringList() << "t" << "timeout",
+        "Czas oczekiwania na odpowiedź [ms].", "ms", QString::number(DEF_TOUT_DGRAM));
+    QCommandLineOption optModule(QStringList() << "m" << "module",
+        "Aktualizowany moduł: wlan lub dcc.", "module", "wlan");
+    QCommandLineOption optWindow(QStringList() << "w" << "window",
+        "Liczba bloków wysyłanych bez potwierdzenia.", "n",
+        QString::number(DEF_UPG_WINDOW));
+    QCommandLineOption optSparse(QStringList() << "s" << "sparse",
+        "Aktualizacja tylko stron różniących się od zapisanych w centralce.");
+    QCommandLineOption optBlock(QStringList() << "b" << "block",
+        "Maks. rozmiar bloku aktualizacji, 0: według MTU interfejsu.", "bytes", "0");
+    QCommandLineOption optChecksum(QStringList() << "c" << "checksum",
+        "CRC32C każdego bloku i skróty obrazu (CRC32C, SHA-256) w starcie aktualizacji.");
+    QCommandLineOption optResume(QStringList() << "r" << "resume",
+        "Wznowienie przerwanej aktualizacji tego samego obrazu według dziennika.");
+    QCommandLineOption optJournal("journal",
+        "Plik dziennika aktualizacji.", "file", NetJournal::defaultFile());
+    QCommandLineOption optMetrics("metrics",
+        "Liczniki i opóźnienia silnika sieciowego (JSON) na zakończenie.");
+    QCommandLineOption optCapture("capture",
+        "Zapis wysyłanych i odbieranych datagramów do pliku pcap.", "file");
+    QCommandLineOption optHeartbeat("heartbeat",
+        "Okres heartbeat centralki [ms], 0: wyłączony.", "ms", "0");
+    parser.addOption(optPort);
+    parser.addOption(optPeer);
+    parser.addOption(optTout);
+    parser.addOption(optModule);
+    parser.addOption(optWindow);
+    parser.addOption(optSparse);
+    parser.addOption(optBlock);
+    parser.addOption(optChecksum);
+    parser.addOption(optResume);
+    parser.addOption(optJournal);
+    parser.addOption(optMetrics);
+    parser.addOption(optCapture);
+    parser.addOption(optHeartbeat);
+    parser.process(arguments);
+
+    params = parser.positionalArguments();
+    command = params.isEmpty() ? QString() : params.takeFirst();
+
+    // liczba parametrów polecenia
+    int count;
+    if (command == "discover") {
+        count = params.count() <= 1 ? params.count() : -1;
+    }
+    else if ((command == "devinfo") || (command == "wifi-get")) {
+        count = 1;
+    }
+    else if (command == "wifi-set") {
+        count = 3;
+    }
+    else if (command == "upgrade") {
+        count = 2;
+    }
+    else if (command == "upgrade-group") {
+        // adres grupy, plik i co najmniej jedna centralka
+        count = params.count() >= 3 ? params.count() : -1;
+    }
+    else {
+        count = -1;
+    }
+    if ((count < 0) || (params.count() != count)) {
+        QTextStream(stderr) << parser.helpText();
+        return CLI_EXIT_USAGE;
+    }
+
+    if (!params.isEmpty()) {
+        devAddr = QHostAddress(params.first()).toIPv4Address();
+        if (devAddr == 0) {
+            QTextStream(stderr) << "Błędny adres: " << params.first() << "\n";
+            return CLI_EXIT_USAGE;
+        }
+    }
+    else {
+        devAddr = QHostAddress(QHostAddress::Broadcast).toIPv4Address();
+    }
+    for (int cnt = 2; (command == "upgrade-group") && (cnt < params.count()); cnt++) {
+        quint32 addr = QHostAddress(params.at(cnt)).toIPv4Address();
+        if (addr == 0) {
+            QTextStream(stderr) << "Błędny adres: " << params.at(cnt) << "\n";
+            return CLI_EXIT_USAGE;
+        }
+        if (!targetNext.contains(addr)) {
+            targets.append(addr);
+            targetNext.insert(addr, 0);
+        }
+    }
+    targetsLeft = targets.count();
+
+    netPort = static_cast<quint16>(parser.value(optPort).toUInt());
+    peerPort = static_cast<quint16>(parser.value(optPeer).toUInt());
+    cfgDgramTout = qMax(parser.value(optTout).toUInt(), 100u);
+    cfgMetrics = parser.isSet(optMetrics);
+    QString mod = parser.value(optModule);
+    if (mod == "wlan") {
+        module = UPGRADE_WLAN;
+    }
+    else if (mod == "dcc") {
+        module = UPGRADE_DCCGEN;
+    }
+    else {
+        QTextStream(stderr) << "Nieznany moduł: " << mod << "\n";
+        return CLI_EXIT_USAGE;
+    }
+
+    thNet = new NetEngine(this);
+    connect(thNet, SIGNAL(connected(quint16)),
+            this, SLOT(networkConnected(quint16)));
+    connect(thNet, SIGNAL(configinfo(DeviceInfo)),
+            this, SLOT(updateConfigInfo(DeviceInfo)));
+    connect(thNet, SIGNAL(configinfo(WiFiStation)),
+            this, SLOT(updateConfigInfo(WiFiStation)));
+    connect(thNet, SIGNAL(imageopened(QString, qint64)),
+            this, SLOT(imageOpened(QString, qint64)));
+    connect(thNet, SIGNAL(imagedigest(QString)),
+            this, SLOT(imageDigest(QString)));
+    connect(thNet, SIGNAL(upgradeinit(quint32, int)),
+            this, SLOT(upgradeInit(quint32, int)));
+    connect(thNet, SIGNAL(upgradestep(quint32, quint16, quint16)),
+            this, SLOT(updateUpgradeStat(quint32, quint16, quint16)));
+    connect(thNet, SIGNAL(noanswer(quint32)),
+            this, SLOT(upgradeNoAnswer(quint32)));
+    connect(thNet, SIGNAL(linkchanged(quint32, bool)),
+            this, SLOT(linkChanged(quint32, bool)));
+
+    thNet->setUpgradeWindow(parser.value(optWindow).toInt());
+    thNet->setUpgradeSparse(parser.isSet(optSparse));
+    thNet->setUpgradeBlock(parser.value(optBlock).toInt());
+    thNet->setUpgradeChecksum(parser.isSet(optChecksum));
+    thNet->setJournal(parser.value(optJournal));
+    thNet->setHeartbeat(parser.value(optHeartbeat).toInt());
+    cfgResume = parser.isSet(optResume);
+    if (parser.isSet(optCapture)) {
+        thNet->setCapture(parser.value(optCapture));
+        if (!thNet->capturing()) {
+            QTextStream(stderr) << "Nie można utworzyć pliku: "
+                                << parser.value(optCapture) << "\n";
+            return CLI_EXIT_USAGE;
+        }
+    }
+    thNet->openSocket(netPort, peerPort);
+
+    return -1;
+
+} // WicsCli::start
+
+void WicsCli::networkConnected(quint16 port)
+{
+    if (port == 0) {
+        fail(CLI_EXIT_ERROR, QString("Nie można otworzyć portu %1").arg(netPort));
+        return;
+    }
+    startCommand();
+}
+
+// wysłanie żądania polecenia, także przy ponowieniu
+void WicsCli::startCommand()
+{
+    if (command == "discover") {
+        timerNet->start(static_cast<int>(cfgDgramTout * 2));
+        thNet->findDevices(devAddr);
+    }
+    else if (command == "devinfo") {
+        timerNet->start(static_cast<int>(cfgDgramTout));
+        thNet->sendDevInfoReq(devAddr);
+    }
+    else if (command == "wifi-get") {
+        timerNet->start(static_cast<int>(cfgDgramTout));
+        thNet->sendWiFiStaReq(devAddr);
+    }
+    else if (command == "wifi-set") {
+        // zapis i odczyt kontrolny
+        timerNet->start(static_cast<int>(cfgDgramTout));
+        thNet->sendWiFiSta(devAddr, params.at(1), params.at(2));
+        thNet->sendWiFiStaReq(devAddr);
+    }
+    else if ((command == "upgrade") || (command == "upgrade-group")) {
+        // ponowienia startu i bloków wykonuje NetEngine
+        thNet->openImageFile(params.at(1));
+    }
+
+} // WicsCli::startCommand
+
+// przeterminowanie żądania: ponowienie lub koniec
+void WicsCli::commandTout()
+{
+    if (command == "discover") {
+        QList<DeviceInfo> list = thNet->deviceList();
+        for (int cnt = 0; cnt < list.count(); cnt++) {
+            print(deviceJson(list.at(cnt)));
+        }
+        finish(list.isEmpty() ? CLI_EXIT_NOANSWER : CLI_EXIT_OK);
+        return;
+    }
+
+    if (--retryCount) {
+        startCommand();
+    }
+    else {
+        fail(CLI_EXIT_NOANSWER, "Urządzenie nie odpowiada");
+    }
+
+} // WicsCli::commandTout
+
+void WicsCli::updateConfigInfo(const DeviceInfo& info)
+{
+    if ((command == "devinfo") && (info.addr == devAddr)) {
+        timerNet->stop();
+        print(deviceJson(info));
+        finish(CLI_EXIT_OK);
+    }
+}
+
+void WicsCli::updateConfigInfo(const WiFiStation& sta)
+{
+    if (sta.addr != devAddr) {
+        return;
+    }
+
+    QJsonObject obj;
+    obj.insert("event", "wifi");
+    obj.insert("addr", QHostAddress(sta.addr).toString());
+    obj.insert("ssid", sta.ssidString());
+    obj.insert("pass", sta.passString());
+
+    if (command == "wifi-get") {
+        timerNet->stop();
+        print(obj);
+        finish(CLI_EXIT_OK);
+    }
+    else if (command == "wifi-set") {
+        timerNet->stop();
+        print(obj);
+        bool fSet = (sta.ssidString() == params.at(1))
+                    && (sta.passString() == params.at(2));
+        finish(fSet ? CLI_EXIT_OK : CLI_EXIT_ERROR);
+    }
+
+} // WicsCli::updateConfigInfo
+
+void WicsCli::imageOpened(QString iname, qint64 isize)
+{
+    if ((command != "upgrade") && (command != "upgrade-group")) {
+        return;
+    }
+    if (isize <= 0) {
+        fail(CLI_EXIT_ERROR, QString("Nie można otworzyć pliku %1").arg(iname));
+        return;
+    }
+
+    if (command == "upgrade-group") {
+        // bloki do adresu grupy, bez wznowienia według dziennika
+        thNet->sendGroupUpgrade(devAddr, targets, module);
+    }
+    else {
+        startUpgrade();
+    }
+
+} // WicsCli::imageOpened
+
+// start aktualizacji; z --resume i wpisem w dzienniku po obliczeniu
+// skrótu obrazu (imagedigest)
+void WicsCli::startUpgrade()
+{
+    NetJournal::Entry entry;
+    int resume = cfgResume ? thNet->resumePoint(devAddr, module, &entry) : 0;
+    upgWaitDigest = (resume < 0);
+    if (upgWaitDigest) {
+        return;
+    }
+    if (resume > 0) {
+        thNet->sendUpgradeInit(devAddr, module, resume, entry.bsize);
+    }
+    else {
+        thNet->sendUpgradeInit(devAddr, module);
+    }
+}
+
+void WicsCli::imageDigest(QString iname)
+{
+    Q_UNUSED(iname)
+    if (upgWaitDigest) {
+        startUpgrade();
+    }
+}
+
+void WicsCli::upgradeInit(quint32 addr, int steps)
+{
+    if ((command == "upgrade-group") ? !targetNext.contains(addr)
+                                     : (addr != devAddr)) {
+        return;
+    }
+    blocks = steps;
+    nextBlock = 0;
+
+    QJsonObject obj;
+    obj.insert("event", "upgrade");
+    obj.insert("addr", QHostAddress(addr).toString());
+    obj.insert("blocks", steps);
+    print(obj);
+
+} // WicsCli::upgradeInit
+
+// postęp aktualizacji, jak w MainWindow::updateUpgradeStat
+void WicsCli::updateUpgradeStat(quint32 addr, quint16 block, quint16 result)
+{
+    if (command == "upgrade-group") {
+        updateGroupStat(addr, block, result);
+        return;
+    }
+    if ((addr != devAddr) || (static_cast<int>(block) < nextBlock)) {
+        return;
+    }
+
+    if (result != RESULT_OK) {
+        fail(CLI_EXIT_ERROR, QString("Błąd aktualizacji, blok: %1, wynik: %2")
+                             .arg(block).arg(result));
+        return;
+    }
+
+    nextBlock = block + 1;
+
+    QJsonObject obj;
+    obj.insert("event", "progress");
+    obj.insert("block", block);
+    obj.insert("blocks", blocks);
+    print(obj);
+
+    if (static_cast<int>(block) >= blocks) {
+        obj = QJsonObject();
+        obj.insert("event", "done");
+        obj.insert("addr", QHostAddress(addr).toString());
+        print(obj);
+        finish(CLI_EXIT_OK);
+    }
+
+} // WicsCli::updateUpgradeStat
+
+// postęp centralki aktualizacji grupowej; błąd jednej centralki nie
+// przerywa aktualizacji pozostałych
+void WicsCli::updateGroupStat(quint32 addr, quint16 block, quint16 result)
+{
+    int next = targetNext.value(addr, -1);
+    if ((next < 0) || (static_cast<int>(block) < next)) {
+        return;
+    }
+
+    QJsonObject obj;
+    obj.insert("addr", QHostAddress(addr).toString());
+    if (result != RESULT_OK) {
+        obj.insert("event", "error");
+        obj.insert("error", QString("Błąd aktualizacji, blok: %1, wynik: %2")
+                            .arg(block).arg(result));
+        print(obj);
+        targetDone(addr, false);
+        return;
+    }
+
+    targetNext.insert(addr, block + 1);
+    obj.insert("event", "progress");
+    obj.insert("block", block);
+    obj.insert("blocks", blocks);
+    print(obj);
+
+    if (static_cast<int>(block) >= blocks) {
+        obj = QJsonObject();
+        obj.insert("event", "done");
+        obj.insert("addr", QHostAddress(addr).toString());
+        print(obj);
+        targetDone(addr, true);
+    }
+
+} // WicsCli::updateGroupStat
+
+// koniec aktualizacji centralki grupy; po ostatniej koniec polecenia
+void WicsCli::targetDone(quint32 addr, bool fOk)
+{
+    targetNext.insert(addr, -1);
+    if (!fOk) {
+        targetsFailed++;
+    }
+    if (--targetsLeft == 0) {
+        finish((targetsFailed > 0) ? CLI_EXIT_ERROR : CLI_EXIT_OK);
+    }
+}
+
+void WicsCli::upgradeNoAnswer(quint32 addr)
+{
+    if ((command == "upgrade") && (addr == devAddr)) {
+        fail(CLI_EXIT_NOANSWER, "Urządzenie nie odpowiada");
+    }
+    else if ((command == "upgrade-group") && (targetNext.value(addr, -1) >= 0)) {
+        QJsonObject obj;
+        obj.insert("event", "error");
+        obj.insert("addr", QHostAddress(addr).toString());
+        obj.insert("error", QString("Urządzenie nie odpowiada"));
+        print(obj);
+        targetDone(addr, false);
+    }
+}
+
+// zmiana stanu łącza według heartbeat
+void WicsCli::linkChanged(quint32 addr, bool online)
+{
+    NetLink link = thNet->linkInfo(addr);
+
+    QJsonObject obj;
+    obj.insert("event", "link");
+    obj.insert("addr", QHostAddress(addr).toString());
+    obj.insert("online", online);
+    if (link.rtt >= 0) {
+        obj.insert("rtt", link.rtt);
+        obj.insert("jitter", link.jitter);
+    }
+    obj.insert("loss", link.loss / 1000.0);
+    print(obj);
+
+} // WicsCli::linkChanged
+
+QJsonObject WicsCli::deviceJson(const DeviceInfo& info)
+{
+    QJsonObject obj;
+    obj.insert("event", "device");
+    obj.insert("serial", info.serialString());
+    obj.insert("addr", info.address());
+    obj.insert("hardware", QString("%1").arg(info.hardware, 4, 16, QChar('0')));
+    obj.insert("hw", info.hwString());
+    obj.insert("sw", info.swString());
+    obj.insert("fw", info.fwString());
+    return obj;
+}
+
+void WicsCli::print(const QJsonObject& obj)
+{
+    out << QJsonDocument(obj).toJson(QJsonDocument::Compact) << "\n";
+    out.flush();
+}
+
+void WicsCli::fail(int code, const QString& error)
+{
+    QJsonObject obj;
+    obj.insert("event", "error");
+    obj.insert("error", error);
+    print(obj);
+    finish(code);
+}
+
+void WicsCli::finish(int code)
+{
+    timerNet->stop();
+    if (thNet != nullptr) {
+        thNet->closeSession(devAddr);
+        if (cfgMetrics) {
+            QJsonObject obj;
+            obj.insert("event", "metrics");
+            obj.insert("metrics", thNet->metricsJson());
+            print(obj);
+        }
+        // zapis pozostałych datagramów do pliku pcap
+        thNet->setCapture(QString());
+    }
+    QCoreApplication::exit(code);
+}
+
+// EOF wicscli.cpp
@@ -0,0 +1,89 @@
+//
+// Wireless Command Station
+//
+// Copyright 2020 Robert Nagowski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// See gpl-3.0.md file for details.
+//
+
+#ifndef WICSCLI_H
+#define WICSCLI_H
+
+#include <QObject>
+#include <QHash>
+#include <QJsonObject>
+#include <QStringList>
+#include <QTextStream>
+#include <QTimer>
+
+#include "datagrams.h"
+#include "netengine.h"
+
+// Polecenia wics_cli; wyniki jako wiersze JSON na stdout
+class WicsCli : public QObject
+{
+    Q_OBJECT
+
+private:
+    NetEngine  *thNet;
+    QTimer     *timerNet;
+    QTextStream out;
+    QString     command;
+    QStringList params;
+    quint32     devAddr;        // adres centralki
+    quint16     netPort;
+    quint16     peerPort;       // port centralek, 0: jak netPort
+    int         module;         // moduł aktualizowanego firmware
+    int         blocks;         // liczba bloków aktualizacji
+    int         nextBlock;      // pierwszy niepotwierdzony blok
+    QList<quint32> targets;     // centralki aktualizacji grupowej
+    QHash<quint32, int> targetNext; // pierwszy niepotwierdzony blok
+                                    // centralki grupy, -1: zakończona
+    int         targetsLeft;    // centralki grupy w trakcie aktualizacji
+    int         targetsFailed;  // centralki grupy z błędem
+    quint8      retryCount;     // ponowienia devinfo i wifi
+    quint32     cfgDgramTout;
+    bool        cfgMetrics;     // liczniki NetEngine na zakończenie
+    bool        cfgResume;      // wznowienie według dziennika
+    bool        upgWaitDigest;  // start aktualizacji czeka na skrót obrazu
+
+public:
+    explicit WicsCli(QObject *parent = nullptr);
+
+    int start(const QStringList& arguments);
+
+private:
+    void startCommand();
+    void print(const QJsonObject& obj);
+    void finish(int code);
+    void fail(int code, const QString& error);
+    void startUpgrade();
+    void updateGroupStat(quint32 addr, quint16 block, quint16 result);
+    void targetDone(quint32 addr, bool fOk);
+    static QJsonObject deviceJson(const DeviceInfo& info);
+
+private slots:
+    void networkConnected(quint16 port);
+    void updateConfigInfo(const DeviceInfo& info);
+    void updateConfigInfo(const WiFiStation& sta);
+    void imageOpened(QString iname, qint64 isize);
+    void imageDigest(QString iname);
+    void upgradeInit(quint32 addr, int steps);
+    void updateUpgradeStat(quint32 addr, quint16 block, quint16 result);
+    void upgradeNoAnswer(quint32 addr);
+    void linkChanged(quint32 addr, bool online);
+    void commandTout();
+
+}; // WicsCli
+
+// kody wyjścia
+#define CLI_EXIT_OK         0
+#define CLI_EXIT_USAGE      1
+#define CLI_EXIT_NOANSWER   2
+#define CLI_EXIT_ERROR      3
+
+#endif // WICSCLI_H
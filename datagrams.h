@@ -19,30 +19,121 @@
 #define DEF_MAX_RETRY       3
 #define DEF_TOUT_DGRAM      3000
 #define DEF_TOUT_UPGRADE    30000
+#define DEF_TOUT_CLIENT     60000
+#define DEF_TOUT_METRICS    1000    // odświeżanie liczników w GUI [ms]
+#define DEF_TOUT_JOURNAL    1000    // okres zapisu dziennika aktualizacji [ms]
+#define DEF_TOUT_PROGRESS   100     // min. odstęp powiadomień o postępie [ms]
+#define DEF_TOUT_HEARTBEAT  1000    // okres heartbeat bezczynnej centralki [ms]
+#define DEF_TOUT_Z21_CACHE  500     // maks. wiek stanu Z21 z pamięci bramki [ms]
+#define DEF_HEARTBEAT_LOST  3       // okresy bez odpowiedzi do stanu offline
+#define DEF_UPG_WINDOW      4
+#define DEF_GRP_ROUND       32      // nowe bloki w rundzie aktualizacji grupowej
+#define DEF_RTO_INIT        1000    // RTO przed pierwszą próbką RTT [ms]
+#define DEF_RTO_MIN         100
+#define DEF_RTO_MAX         DEF_TOUT_UPGRADE
+#define DEF_MAX_RETRANS     6       // ok. 60 s przy RTO_INIT i backoff
 
 #define HW_NGS_WICS         0xDCC1
 
 #define LAN_WICS_MESSAGE    0x38
 
+// Z21: nagłówki komunikatów przekazywanych przez bramkę
+#define LAN_GET_SERIAL_NUMBER       0x10
+#define LAN_GET_CODE                0x18
+#define LAN_GET_HWINFO              0x1A
+#define LAN_LOGOFF                  0x30
+#define LAN_X_MESSAGE               0x40
+#define LAN_SET_BROADCASTFLAGS      0x50
+#define LAN_GET_BROADCASTFLAGS      0x51
+#define LAN_GET_LOCOMODE            0x60
+#define LAN_GET_TURNOUTMODE         0x70
+#define LAN_RMBUS_DATACHANGED       0x80
+#define LAN_RMBUS_GETDATA           0x81
+#define LAN_SYSTEMSTATE_DATACHANGED 0x84
+#define LAN_SYSTEMSTATE_GETDATA     0x85
+#define LAN_RAILCOM_DATACHANGED     0x88
+#define LAN_RAILCOM_GETDATA         0x89
+#define LAN_LOCONET_Z21_RX          0xA0
+#define LAN_LOCONET_DETECTOR        0xA4
+
+// Z21: X-nagłówki komunikatów LAN_X
+#define LAN_X_GET_SETTING           0x21
+#define LAN_X_BC_TRACK              0x61
+#define LAN_X_STATUS_CHANGED        0x62
+#define LAN_X_GET_VERSION           0x63
+#define LAN_X_CV_READ               0x23
+#define LAN_X_CV_WRITE              0x24
+#define LAN_X_CV_RESULT             0x64
+#define LAN_X_TURNOUT_INFO          0x43
+#define LAN_X_SET_STOP              0x80
+#define LAN_X_SET_TURNOUT           0x53
+#define LAN_X_BC_STOPPED            0x81
+#define LAN_X_GET_LOCO_INFO         0xE3
+#define LAN_X_SET_LOCO              0xE4
+#define LAN_X_LOCO_INFO             0xEF
+#define LAN_X_GET_FIRMWARE_VERSION  0xF1
+#define LAN_X_FIRMWARE_VERSION      0xF3
+
+// Z21: flagi LAN_SET_BROADCASTFLAGS
+#define Z21_BC_BASIC        0x00000001
+#define Z21_BC_RMBUS        0x00000002
+#define Z21_BC_RAILCOM      0x00000004
+#define Z21_BC_SYSTEMSTATE  0x00000100
+#define Z21_BC_ALL_LOCOS    0x00010000
+#define Z21_BC_RAILCOM_ALL  0x00040000
+#define Z21_BC_LOCONET      0x01000000
+
+#define Z21_MAX_LOCOS       16      // subskrybowane lokomotywy klienta
+
+// Z21: DB0 komunikatu LAN_X_SET_LOCO
+#define Z21_LOCO_DRIVE_14   0x10    // jazda, 14 kroków
+#define Z21_LOCO_DRIVE_28   0x12    // jazda, 28 kroków
+#define Z21_LOCO_DRIVE_128  0x13    // jazda, 128 kroków
+#define Z21_LOCO_FUNCTION   0xF8    // funkcja, DB3: TTNNNNNN
+#define Z21_FUNC_OFF        0x00
+#define Z21_FUNC_ON         0x01
+#define Z21_FUNC_TOGGLE     0x02
+#define Z21_SET_LOCO_SIZE   10      // rozmiar LAN_X_SET_LOCO z XOR
+
 #define WICS_DEVINFO_GET    0x49
 #define WICS_WIFISTA_GET    0x57
 #define WICS_UPGRADE_START  0x55
 #define WICS_UPGRADE_DATA   0x48
+#define WICS_PAGEHASH_GET   0x50
+#define WICS_HEARTBEAT_GET  0x4B    // NetDatagram_dg, param: numer kolejny
+#define WICS_UPGRADE_POLL   0x4E    // UpgradePoll_dg, do grupy centralek
 
 #define WICS_DEVINFO        0x69
 #define WICS_WIFISTA        0x77
 #define WICS_UPGRADE        0x75
+#define WICS_PAGEHASH       0x70
+#define WICS_HEARTBEAT      0x6B    // param z WICS_HEARTBEAT_GET
+#define WICS_UPGRADE_NACK   0x6E    // UpgradeNack_dg, brakujące bloki
 
 #define WICS_PARAM_NONE     0
 
 #define UPGRADE_WLAN        0x01
 #define UPGRADE_DCCGEN      0x02
 #define UPGRADE_MODULE_MASK 0x0F
+#define UPGRADE_SPARSE      0x10    // tylko zmienione strony, UpgradeSparse_dg
+#define UPGRADE_BSIZE       0x20    // proponowany rozmiar bloku, UpgradeInitSize_dg
+#define UPGRADE_CRC         0x40    // CRC32C każdego bloku, UpgradeCrc_dg
+#define UPGRADE_DIGEST      0x80    // CRC32C i SHA-256 obrazu, UpgradeInitDigest_dg
+#define UPGRADE_RESUME      0x100   // wznowienie po bloku resume, UpgradeInitResume_dg
+#define UPGRADE_GROUP       0x200   // bloki do grupy bez potwierdzeń, braki
+                                    // w odpowiedzi na WICS_UPGRADE_POLL
 
 #define UPG_WLAN_PAGE       1024
 #define UPG_DCCG_PAGE       256
+#define UPG_HASH_COUNT      128     // skrótów stron w jednym datagramie
+#define UPG_MAX_BLOCK       8192    // maks. proponowany rozmiar bloku
+#define UPG_DEF_MTU         1500    // MTU, gdy interfejs nieznany
+#define UPG_IP_OVERHEAD     28      // nagłówki IPv4 i UDP
+#define UPG_SHA256_SIZE     32
+#define UPG_NACK_COUNT      64      // maks. brakujących bloków w UpgradeNack_dg
 
 #define RESULT_OK           0
+#define RESULT_BSIZE        0xFFFF  // wynik lokalny: rozmiar bloku spoza propozycji
 
 #define MAX_WLAN_NAME       32
 #define MAX_WLAN_PASS       32
@@ -74,6 +165,43 @@ typedef struct __attribute__ ((packed)) {
     quint32 fwsize;
 } UpgradeInit_dg;
 
+// UPGRADE_BSIZE: start aktualizacji z proponowanym rozmiarem bloku
+typedef struct __attribute__ ((packed)) {
+    quint16 bytes;
+    quint16 header;
+    quint16 opcode;
+    quint16 flags;
+    quint32 fwsize;
+    quint16 bsize;
+} UpgradeInitSize_dg;
+
+// UPGRADE_DIGEST: start aktualizacji ze skrótami całego obrazu,
+// sprawdzanymi przez centralkę po ostatnim bloku; bsize == 0 bez UPGRADE_BSIZE
+typedef struct __attribute__ ((packed)) {
+    quint16 bytes;
+    quint16 header;
+    quint16 opcode;
+    quint16 flags;
+    quint32 fwsize;
+    quint16 bsize;
+    quint32 crc;
+    char    sha256[UPG_SHA256_SIZE];
+} UpgradeInitDigest_dg;
+
+// UPGRADE_RESUME: wznowienie przerwanej aktualizacji tego samego obrazu
+// (sha256) i rozmiaru bloku; centralka ma bloki 1..resume
+typedef struct __attribute__ ((packed)) {
+    quint16 bytes;
+    quint16 header;
+    quint16 opcode;
+    quint16 flags;
+    quint32 fwsize;
+    quint16 bsize;
+    quint32 crc;
+    char    sha256[UPG_SHA256_SIZE];
+    quint16 resume;
+} UpgradeInitResume_dg;
+
 typedef struct __attribute__ ((packed)) {
     quint16 bytes;
     quint16 header;
@@ -82,6 +210,39 @@ typedef struct __attribute__ ((packed)) {
     quint16 block;
 } UpgradeData_dg;
 
+// UPGRADE_SPARSE: blok danych z numerem poprzedniego wysłanego bloku
+typedef struct __attribute__ ((packed)) {
+    quint16 bytes;
+    quint16 header;
+    quint16 opcode;
+    quint16 flags;
+    quint16 block;
+    quint16 prev;
+} UpgradeSparse_dg;
+
+// UPGRADE_CRC: blok danych z CRC32C danych bloku; pole prev zawsze
+// obecne, bez UPGRADE_SPARSE równe block - 1
+typedef struct __attribute__ ((packed)) {
+    quint16 bytes;
+    quint16 header;
+    quint16 opcode;
+    quint16 flags;
+    quint16 block;
+    quint16 prev;
+    quint32 crc;
+} UpgradeCrc_dg;
+
+// skróty stron first..first+count-1 modułu z flags; w odpowiedzi
+// (WICS_PAGEHASH) za nagłówkiem count x quint32, netPageHash()
+typedef struct __attribute__ ((packed)) {
+    quint16 bytes;
+    quint16 header;
+    quint16 opcode;
+    quint16 flags;
+    quint16 first;
+    quint16 count;
+} PageHash_dg;
+
 typedef struct __attribute__ ((packed)) {
     quint16 bytes;
     quint16 header;
@@ -90,6 +251,54 @@ typedef struct __attribute__ ((packed)) {
     quint16 result;
 } UpgradeState_dg;
 
+// potwierdzenie startu (block 0) z rozmiarem bloku przyjętym przez
+// centralkę, nie większym niż proponowany
+typedef struct __attribute__ ((packed)) {
+    quint16 bytes;
+    quint16 header;
+    quint16 opcode;
+    quint16 block;
+    quint16 result;
+    quint16 bsize;
+} UpgradeStateSize_dg;
+
+// potwierdzenie startu z UPGRADE_RESUME: ostatni blok zachowany przez
+// centralkę, nie większy niż proponowany; 0: aktualizacja od początku
+typedef struct __attribute__ ((packed)) {
+    quint16 bytes;
+    quint16 header;
+    quint16 opcode;
+    quint16 block;
+    quint16 result;
+    quint16 bsize;
+    quint16 resume;
+} UpgradeStateResume_dg;
+
+// aktualizacja grupowa: pytanie o brakujące bloki do numeru last;
+// round odróżnia odpowiedzi kolejnych pytań
+typedef struct __attribute__ ((packed)) {
+    quint16 bytes;
+    quint16 header;
+    quint16 opcode;
+    quint16 flags;
+    quint16 round;
+    quint16 last;
+} UpgradePoll_dg;
+
+// odpowiedź centralki z grupy: bloki 1..acked zapisane, za nagłówkiem
+// count x quint16 brakujących bloków z zakresu acked+1..last; result
+// różny od RESULT_OK po błędzie, acked równy liczbie bloków: obraz
+// kompletny i sprawdzony
+typedef struct __attribute__ ((packed)) {
+    quint16 bytes;
+    quint16 header;
+    quint16 opcode;
+    quint16 round;
+    quint16 result;
+    quint16 acked;
+    quint16 count;
+} UpgradeNack_dg;
+
 typedef struct __attribute__ ((packed)) {
     quint16 bytes;
     quint16 header;
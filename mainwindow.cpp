@@ -22,10 +22,12 @@ MainWindow::MainWindow(QWidget *parent)
     ui->setupUi(this);
     setWindowTitle(APP_NAME);
 
-    retryCount = DEF_MAX_RETRY;
-    cfgRetryMax = DEF_MAX_RETRY;
+    devAddr = 0;
+    scanBroadcast = false;
+    upgWaitDigest = false;
     cfgDgramTout = DEF_TOUT_DGRAM;
-    cfgUpgradeTout = DEF_TOUT_UPGRADE;
+    cfgUpgWindow = DEF_UPG_WINDOW;
+    cfgHeartbeat = DEF_TOUT_HEARTBEAT;
 
     statConn = new QLabel(tr("Łączenie..."), this);
     statConn->setFrameStyle(QFrame::Panel | QFrame::Sunken);
@@ -34,22 +36,54 @@ MainWindow::MainWindow(QWidget *parent)
     statStatus->setFrameStyle(QFrame::Panel | QFrame::Sunken);
     statStatus->setMinimumWidth(150);
     statusBar()->addWidget(statStatus);
+    statLink = new QLabel(QString("--"), this);
+    statLink->setFrameStyle(QFrame::Panel | QFrame::Sunken);
+    statusBar()->addPermanentWidget(statLink);
+    statMetrics = new QLabel(QString("--"), this);
+    statMetrics->setFrameStyle(QFrame::Panel | QFrame::Sunken);
+    statusBar()->addPermanentWidget(statMetrics);
 
     thNet = new NetEngine(this);
     connect(thNet, SIGNAL(connected(quint16)),
             this, SLOT(networkConnected(quint16)));
-    connect(thNet, SIGNAL(configinfo(quint16, QString)),
-            this, SLOT(updateConfigInfo(quint16, QString)));
+    connect(thNet, SIGNAL(configinfo(DeviceInfo)),
+            this, SLOT(updateConfigInfo(DeviceInfo)));
+    connect(thNet, SIGNAL(configinfo(WiFiStation)),
+            this, SLOT(updateConfigInfo(WiFiStation)));
     connect(thNet, SIGNAL(imageopened(QString, qint64)),
             this, SLOT(imageOpened(QString, qint64)));
-    connect(thNet, SIGNAL(upgradeinit(int)),
-            this, SLOT(upgradeInit(int)));
-    connect(thNet, SIGNAL(upgradestep(quint16, quint16)),
-            this, SLOT(updateUpgradeStat(quint16, quint16)));
+    connect(thNet, SIGNAL(imagedigest(QString)),
+            this, SLOT(imageDigest(QString)));
+    connect(thNet, SIGNAL(upgradeinit(quint32, int)),
+            this, SLOT(upgradeInit(quint32, int)));
+    connect(thNet, SIGNAL(upgradestep(quint32, quint16, quint16)),
+            this, SLOT(updateUpgradeStat(quint32, quint16, quint16)));
+    connect(thNet, SIGNAL(noanswer(quint32)),
+            this, SLOT(upgradeNoAnswer(quint32)));
+    connect(thNet, SIGNAL(linkchanged(quint32, bool)),
+            this, SLOT(linkChanged(quint32, bool)));
+
+    thNet->setUpgradeWindow(cfgUpgWindow);
+    thNet->setHeartbeat(cfgHeartbeat);
+    thNet->setJournal(NetJournal::defaultFile());
 
     timerNet = new QTimer(this);
     timerNet->setSingleShot(true);
 
+    // liczniki na pasku stanu, Ctrl+Shift+M: zapis do pliku JSON
+    timerMetrics = new QTimer(this);
+    connect(timerMetrics, SIGNAL(timeout()), this, SLOT(updateMetrics()));
+    timerMetrics->start(DEF_TOUT_METRICS);
+    QAction *actMetrics = new QAction(tr("Zapisz liczniki"), this);
+    actMetrics->setShortcut(QKeySequence(tr("Ctrl+Shift+M")));
+    connect(actMetrics, SIGNAL(triggered()), this, SLOT(saveMetrics()));
+    addAction(actMetrics);
+    // Ctrl+Shift+P: zapis datagramów do pliku pcap, ponownie: koniec zapisu
+    QAction *actCapture = new QAction(tr("Zapis datagramów"), this);
+    actCapture->setShortcut(QKeySequence(tr("Ctrl+Shift+P")));
+    connect(actCapture, SIGNAL(triggered()), this, SLOT(toggleCapture()));
+    addAction(actCapture);
+
     ui->cboxUpgModule->addItem(tr("Moduł WLAN"));
     ui->cboxUpgModule->addItem(tr("Moduł DCC"));
     ui->cboxUpgModule->setCurrentIndex(0);
@@ -109,6 +143,7 @@ void MainWindow::clearUpgFilename()
 {
     ui->edUpgFilename->clear();
     ui->labUpgStatus->setText(tr("Wybierz plik firmware"));
+    upgWaitDigest = false;
 }
 
 // adres interfejsu sieciowego
@@ -145,38 +180,80 @@ void MainWindow::networkConnected(quint16 port)
 
 } // MainWindow::networkConnected
 
-void MainWindow::updateConfigInfo(quint16 opcode, QString data)
+// aktualizacja informacji o urządzeniu
+void MainWindow::updateConfigInfo(const DeviceInfo& info)
 {
-    QStringList citems = data.split(";");
-    switch (opcode) {
-    case WICS_WIFISTA:
-        // informacje o podłączeniu do sieci
-        if (citems.count() == 2) {
-            ui->edDevSsid->setText(citems.at(0));
-            ui->edDevPass->setText(citems.at(1));
-        }
-        break;
-    case WICS_DEVINFO:
-        // aktualizacja informacji o urządzeniu
+    QTreeWidgetItem *item = updateDevice(info);
+    if (info.addr == devAddr) {
+        updateDevInfo(item);
+    }
+    else if ((devAddr == 0) && timerNet->isActive() && !scanBroadcast) {
+        // zapytanie do jednej centralki, koniec wyszukiwania
         timerNet->stop();
-        if (citems.count() == 5) {
-            statConn->setText(tr("Połączono z %1").arg(citems.at(0)));
-            ui->grpDevInfo->setEnabled(true);
-            ui->labInfoHW->setText(citems.at(1));
-            ui->labInfoSW->setText(citems.at(2));
-            ui->labInfoFW->setText(citems.at(3));
-            ui->labInfoSN->setText(citems.at(4));
-            ui->btnDevClose->setEnabled(true);
-            controlEnable();
-        }
-        break;
-    default:
-        qDebug("ConfigInfo zły opcode: %d", opcode);
-        break;
-    } // switch opcode
+        findDeviceTout();
+    }
 
 } // MainWindow::updateConfigInfo
 
+// informacje o podłączeniu do sieci
+void MainWindow::updateConfigInfo(const WiFiStation& sta)
+{
+    if (sta.addr == devAddr) {
+        ui->edDevSsid->setText(sta.ssidString());
+        ui->edDevPass->setText(sta.passString());
+    }
+}
+
+// dodanie lub odświeżenie wiersza listy urządzeń, klucz: numer seryjny
+QTreeWidgetItem* MainWindow::updateDevice(const DeviceInfo& info)
+{
+    QTreeWidgetItem *item;
+    QString serial = info.serialString();
+    QList<QTreeWidgetItem*> found =
+            ui->treeDevices->findItems(serial, Qt::MatchExactly, 0);
+
+    if (found.isEmpty()) {
+        item = new QTreeWidgetItem(ui->treeDevices);
+        item->setText(0, serial);
+    }
+    else {
+        item = found.first();
+    }
+    item->setData(0, Qt::UserRole, info.addr);
+    item->setText(1, info.address());
+    item->setText(2, info.hwString());
+    item->setText(3, info.swString());
+    item->setText(4, info.fwString());
+    item->setText(5, QDateTime::fromMSecsSinceEpoch(info.lastSeen)
+                        .toString("hh:mm:ss"));
+
+    return item;
+
+} // MainWindow::updateDevice
+
+// informacje o podłączonym urządzeniu
+void MainWindow::updateDevInfo(QTreeWidgetItem *item)
+{
+    ui->labInfoHW->setText(item->text(2));
+    ui->labInfoSW->setText(item->text(3));
+    ui->labInfoFW->setText(item->text(4));
+    ui->labInfoSN->setText(item->text(0));
+}
+
+// podłączenie do wybranej centralki
+void MainWindow::connectDevice(QTreeWidgetItem *item)
+{
+    devAddr = item->data(0, Qt::UserRole).toUInt();
+    statConn->setText(tr("Połączono z %1").arg(item->text(1)));
+    ui->grpDevInfo->setEnabled(true);
+    updateDevInfo(item);
+    ui->btnDevConnect->setEnabled(false);
+    ui->btnDevClose->setEnabled(true);
+    controlEnable();
+    thNet->sendWiFiStaReq(devAddr);
+
+} // MainWindow::connectDevice
+
 // dane otwartego pliku
 void MainWindow::imageOpened(QString iname, qint64 isize)
 {
@@ -193,32 +270,54 @@ void MainWindow::imageOpened(QString iname, qint64 isize)
 } // MainWindow::imageOpened
 
 // inicjalizacja kontrolek aktualizacji
-void MainWindow::upgradeInit(int steps)
+void MainWindow::upgradeInit(quint32 addr, int steps)
 {
+    if (addr != devAddr) {
+        return;
+    }
+
     ui->pbarUpgrade->setMaximum(steps);
     ui->pbarUpgrade->setValue(0);
 }
 
-// wysłanie żądania komunikacji z urządzeniem
+// wyszukiwanie urządzeń, odpowiedzi zbierane przez cały czas timerNet
 void MainWindow::findDevice()
 {
+    quint32 scanAddr = QHostAddress(ui->cboxDevAddress->currentText())
+                        .toIPv4Address();
+
     statConn->setText(tr("Szukanie urządzenia...."));   
+    devAddr = 0;
+    scanBroadcast = ((scanAddr & 0x000000FF) == 0x000000FF);
+    ui->treeDevices->clear();
     timerNet->disconnect(SIGNAL(timeout()));
     connect(timerNet, SIGNAL(timeout()), this, SLOT(findDeviceTout()));
     timerNet->start(static_cast<int>(cfgDgramTout * 2));
-    thNet->sendDevInfoReq(QHostAddress(ui->cboxDevAddress->currentText())
-                            .toIPv4Address());
+    thNet->findDevices(scanAddr);
 
 } // MainWindow::findDevice
 
-// przeterminowanie żądania komunikacji z urządzeniem
+// koniec wyszukiwania urządzeń
 void MainWindow::findDeviceTout()
 {
-    qDebug("findDevice tout");
-    statConn->setText(tr("Nie połączono"));
+    int count = ui->treeDevices->topLevelItemCount();
+
+    qDebug("findDevice tout, znaleziono: %d", count);
+    if (count == 1) {
+        connectDevice(ui->treeDevices->topLevelItem(0));
+        return;
+    }
+
+    if (count == 0) {
+        statConn->setText(tr("Nie połączono"));
+    }
+    else {
+        statConn->setText(tr("Znaleziono: %1, wybierz urządzenie").arg(count));
+    }
     ui->btnDevConnect->setEnabled(true);
     controlEnable();
-}
+
+} // MainWindow::findDeviceTout
 
 // urządzenie nie odpowiada
 void MainWindow::deviceNoAnswwer()
@@ -228,41 +327,25 @@ void MainWindow::deviceNoAnswwer()
     controlEnable();
 }
 
-// przetermnowanie wiadomosci: start aktualizacji
-void MainWindow::upgradeInitTout()
+// ponowienia aktualizacji wyczerpane w wątku sieciowym
+void MainWindow::upgradeNoAnswer(quint32 addr)
 {
-    qDebug("upgradeInit tout %d", retryCount);
-    if (--retryCount) {
-        // ponowienie
-        timerNet->disconnect(SIGNAL(timeout()));
-        connect(timerNet, SIGNAL(timeout()), this, SLOT(upgradeInitTout()));
-        timerNet->start(static_cast<int>(cfgUpgradeTout));
-        thNet->sendUpgradeInit(ui->cboxUpgModule->currentIndex() + UPGRADE_WLAN);
-    }
-    else {
-        // limit prób wyczerpany
+    if (addr == devAddr) {
         deviceNoAnswwer();
     }
+}
 
-} // MainWindow::upgradeInitTout
-
-// przeterminowanie wiadomości: dane aktualizacji
-void MainWindow::upgradeDataTout()
+// centralka przestała odpowiadać na heartbeat lub znów odpowiada
+void MainWindow::linkChanged(quint32 addr, bool online)
 {
-    qDebug("upgradeData tout %d", retryCount);
-    if (--retryCount) {
-        // ponowienie
-        timerNet->disconnect(SIGNAL(timeout()));
-        connect(timerNet, SIGNAL(timeout()), this, SLOT(upgradeDataTout()));
-        timerNet->start(static_cast<int>(cfgDgramTout * 3));
-        thNet->sendUpgradeData();
-    }
-    else {
-        // limit prób wyczerpany
-        deviceNoAnswwer();
+    if (addr != devAddr) {
+        return;
     }
 
-} // MainWindow::upgradeDataTout
+    statStatus->setText(online ? tr("Centralka odpowiada")
+                               : tr("Brak odpowiedzi centralki"));
+    updateMetrics();
+}
 
 // klawisz Podłącz
 void MainWindow::on_btnDevConnect_clicked()
@@ -273,9 +356,22 @@ void MainWindow::on_btnDevConnect_clicked()
     findDevice();
 }
 
+// wybór urządzenia z listy
+void MainWindow::on_treeDevices_itemDoubleClicked(QTreeWidgetItem *item,
+                                                  int column)
+{
+    Q_UNUSED(column)
+    if (!ui->btnDevClose->isEnabled() && !timerNet->isActive()) {
+        clearUpgFilename();
+        connectDevice(item);
+    }
+}
+
 // klawisz Rozłącz
 void MainWindow::on_btnDevClose_clicked()
 {
+    thNet->closeSession(devAddr);
+    devAddr = 0;
     clearDevInfo();
     ui->btnDevConnect->setEnabled(true);
     ui->btnDevClose->setEnabled(false);
@@ -287,13 +383,13 @@ void MainWindow::on_btnDevRead_clicked()
 {
     ui->edDevSsid->clear();
     ui->edDevPass->clear();
-    thNet->sendWiFiStaReq();
+    thNet->sendWiFiStaReq(devAddr);
 }
 
 // klawisz Zastosuj
 void MainWindow::on_btnDevApply_clicked()
 {
-    thNet->sendWiFiSta(ui->edDevSsid->text(), ui->edDevPass->text());
+    thNet->sendWiFiSta(devAddr, ui->edDevSsid->text(), ui->edDevPass->text());
 }
 
 // zmiana wyboru na liście modułów
@@ -336,44 +432,73 @@ void MainWindow::on_btnUpgStart_clicked()
 {
     ui->btnDevClose->setEnabled(false);
     controlEnable();
-    retryCount = cfgRetryMax;
-    timerNet->disconnect(SIGNAL(timeout()));
-    connect(timerNet, SIGNAL(timeout()), this, SLOT(upgradeInitTout()));
     ui->labUpgStatus->setText(tr("Uruchomienie aktualizacji"));
     statStatus->setText(tr("Aktualizacja oprogramowania"));
-    timerNet->start(static_cast<int>(cfgUpgradeTout));
-    thNet->sendUpgradeInit(ui->cboxUpgModule->currentIndex() + UPGRADE_WLAN);
+    startUpgrade();
 
 } // MainWindow::on_btnUpgStart_clicked
 
+// start aktualizacji; wpis w dzienniku przed obliczeniem skrótu obrazu:
+// pytanie o wznowienie po sygnale imagedigest
+void MainWindow::startUpgrade()
+{
+    int module = ui->cboxUpgModule->currentIndex() + UPGRADE_WLAN;
+    // przerwana aktualizacja tego samego obrazu: wznowienie z dziennika
+    NetJournal::Entry entry;
+    int resume = thNet->resumePoint(devAddr, module, &entry);
+    if (resume < 0) {
+        upgWaitDigest = true;
+        ui->labUpgStatus->setText(tr("Obliczanie skrótu obrazu"));
+        return;
+    }
+    upgWaitDigest = false;
+    bool fResume = (resume > 0)
+                   && (QMessageBox::question(this, tr("Aktualizacja"),
+                           tr("Poprzednia aktualizacja tym plikiem została przerwana "
+                              "po bloku %1. Wznowić?").arg(resume))
+                       == QMessageBox::Yes);
+    // ponowienia i limit czasu w NetEngine, wynik: upgradestep lub noanswer
+    if (fResume) {
+        thNet->sendUpgradeInit(devAddr, module, resume, entry.bsize);
+    }
+    else {
+        thNet->sendUpgradeInit(devAddr, module);
+    }
+
+} // MainWindow::startUpgrade
+
+void MainWindow::imageDigest(QString iname)
+{
+    if (upgWaitDigest && (iname == ui->edUpgFilename->text())) {
+        ui->labUpgStatus->setText(tr("Uruchomienie aktualizacji"));
+        startUpgrade();
+    }
+}
+
 // aktualizacja stanu ładowania firmware
-void MainWindow::updateUpgradeStat(quint16 block, quint16 result)
+void MainWindow::updateUpgradeStat(quint32 addr, quint16 block, quint16 result)
 {
-    if (ui->pbarUpgrade->value() != static_cast<int>(block)) {
-        ui->labUpgStatus->setText(tr("Potwierdzenie bloku %1, oczekiwany %2")
-                                  .arg(block).arg(ui->pbarUpgrade->value()));
-        qDebug("Blok upgrade: %d zamiast %d", block, ui->pbarUpgrade->value());
+    if (addr != devAddr) {
+        return;
+    }
+
+    if (static_cast<int>(block) < ui->pbarUpgrade->value()) {
+        // duplikat lub spóźnione potwierdzenie, już uwzględnione
+        qDebug("Blok upgrade: %d, oczekiwany %d", block, ui->pbarUpgrade->value());
         return;
     }
 
-    timerNet->disconnect(SIGNAL(timeout()));
-    timerNet->stop();
     if (result == RESULT_OK) {
-        qDebug("Upgrade stat: %d", block);
-        // OK, wysłanie następnego bloku
-        if (ui->pbarUpgrade->value() == ui->pbarUpgrade->maximum()) {
+        // okno przesuwa NetEngine, tu tylko postęp (co DEF_TOUT_PROGRESS)
+        if (static_cast<int>(block) >= ui->pbarUpgrade->maximum()) {
             // zakończenie
+            ui->pbarUpgrade->setValue(ui->pbarUpgrade->maximum());
             ui->labUpgStatus->setText(tr("Aktualizacja zakończona"));
             statStatus->setText(tr("Oprogramowanie zaktualizowane"));
         }
         else {
-            // następny blok
-            ui->pbarUpgrade->setValue(ui->pbarUpgrade->value() + 1);
-            thNet->sendUpgradeNewData();
-            timerNet->disconnect(SIGNAL(timeout()));
-            retryCount = cfgRetryMax;
-            connect(timerNet, SIGNAL(timeout()), this, SLOT(upgradeDataTout()));
-            timerNet->start(static_cast<int>(cfgUpgradeTout * 2));
+            // następne bloki
+            ui->pbarUpgrade->setValue(block + 1);
         }
     }
     else {
@@ -384,4 +509,71 @@ void MainWindow::updateUpgradeStat(quint16 block, quint16 result)
 
 } // MainWindow::updateUpgradeStat
 
+void MainWindow::updateMetrics()
+{
+    const NetMetrics& m = thNet->metrics();
+    statMetrics->setText(m.summary());
+    QString latency = m.latencySummary();
+    statMetrics->setToolTip(latency.isEmpty() ? tr("Ctrl+Shift+M: zapis liczników")
+                                              : latency);
+
+    // RTT, rozrzut i utrata heartbeat podłączonej centralki
+    NetLink link = thNet->linkInfo(devAddr);
+    if (devAddr == 0) {
+        statLink->setText(QString("--"));
+    }
+    else if (!link.online) {
+        statLink->setText(tr("offline"));
+    }
+    else if (link.rtt < 0) {
+        statLink->setText(tr("online"));
+    }
+    else {
+        statLink->setText(tr("RTT %1 ms ±%2, utrata %3%")
+                          .arg(link.rtt).arg(link.jitter)
+                          .arg(link.loss / 10.0, 0, 'f', 1));
+    }
+}
+
+// zapis liczników i histogramów opóźnień jako JSON
+void MainWindow::saveMetrics()
+{
+    QString filename = QFileDialog::getSaveFileName(this, tr("Zapisz liczniki"),
+                                                    QString("wics-metrics.json"),
+                                                    tr("JSON (*.json)"));
+    if (filename.isEmpty()) {
+        return;
+    }
+
+    QJsonObject obj = thNet->metricsJson();
+    obj.insert("timestamp", QDateTime::currentDateTimeUtc().toString(Qt::ISODate));
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly)
+        || (file.write(QJsonDocument(obj).toJson()) < 0)) {
+        statStatus->setText(tr("Błąd zapisu %1").arg(filename));
+    }
+
+} // MainWindow::saveMetrics
+
+// początek lub koniec zapisu datagramów do pliku pcap
+void MainWindow::toggleCapture()
+{
+    if (thNet->capturing()) {
+        thNet->setCapture(QString());
+        statStatus->setText(tr("Zapis datagramów zakończony"));
+        return;
+    }
+
+    QString filename = QFileDialog::getSaveFileName(this, tr("Zapis datagramów"),
+                                                    QString("wics.pcap"),
+                                                    tr("pcap (*.pcap)"));
+    if (filename.isEmpty()) {
+        return;
+    }
+    thNet->setCapture(filename);
+    statStatus->setText(thNet->capturing() ? tr("Zapis datagramów: %1").arg(filename)
+                                           : tr("Błąd zapisu %1").arg(filename));
+
+} // MainWindow::toggleCapture
+
 // EOF mainwindow.cpp
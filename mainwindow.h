@@ -15,10 +15,16 @@
 
 #include <QMainWindow>
 #include <QLabel>
+#include <QFile>
 #include <QFileDialog>
 #include <QTimer>
 #include <QHostAddress>
 #include <QNetworkInterface>
+#include <QTreeWidgetItem>
+#include <QDateTime>
+#include <QAction>
+#include <QJsonDocument>
+#include <QMessageBox>
 
 #include "datagrams.h"
 #include "netengine.h"
@@ -35,14 +41,19 @@ private:
     Ui::MainWindow *ui;
     QLabel *statConn;
     QLabel *statStatus;
+    QLabel *statLink;       // łącze z centralką według heartbeat
+    QLabel *statMetrics;    // liczniki NetEngine
 private:
     NetEngine *thNet;
     QTimer *timerNet;
+    QTimer *timerMetrics;
+    quint32 devAddr;        // adres podłączonej centralki
+    bool    scanBroadcast;  // wyszukiwanie adresem rozgłoszeniowym
+    bool    upgWaitDigest;  // start aktualizacji czeka na skrót obrazu
 private:
-    quint8  retryCount;
-    quint8  cfgRetryMax;
     quint32 cfgDgramTout;
-    quint32 cfgUpgradeTout;
+    int     cfgUpgWindow;
+    int     cfgHeartbeat;   // okres heartbeat [ms], 0: wyłączony
 
 public:
     explicit MainWindow(QWidget *parent = nullptr);
@@ -55,26 +66,35 @@ private:
     quint32 getNIaddress();
     void deviceNoAnswwer();
     void findDevice();
-    void updateDevInfo(const DeviceInfo_dg *data);
+    QTreeWidgetItem* updateDevice(const DeviceInfo& info);
+    void updateDevInfo(QTreeWidgetItem *item);
+    void connectDevice(QTreeWidgetItem *item);
+    void startUpgrade();
 
 private slots:
     void on_cboxUpgModule_currentIndexChanged(int index);
     void on_btnDevConnect_clicked();
     void on_btnDevClose_clicked();
+    void on_treeDevices_itemDoubleClicked(QTreeWidgetItem *item, int column);
     void on_btnDevRead_clicked();
     void on_btnDevApply_clicked();
     void on_btnUpgFile_clicked();
     void on_btnUpgStart_clicked();
     void findDeviceTout();
-    void upgradeInitTout();
-    void upgradeDataTout();
+    void upgradeNoAnswer(quint32 addr);
+    void linkChanged(quint32 addr, bool online);
+    void updateMetrics();
+    void saveMetrics();
+    void toggleCapture();
 
 public slots:
     void networkConnected(quint16 port);
-    void updateConfigInfo(quint16 opcode, QString data);
+    void updateConfigInfo(const DeviceInfo& info);
+    void updateConfigInfo(const WiFiStation& sta);
     void imageOpened(QString iname, qint64 isize);
-    void upgradeInit(int steps);
-    void updateUpgradeStat(quint16 block, quint16 result);
+    void imageDigest(QString iname);
+    void upgradeInit(quint32 addr, int steps);
+    void updateUpgradeStat(quint32 addr, quint16 block, quint16 result);
 
 }; // MainWindow
 
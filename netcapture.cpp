@@ -0,0 +1,204 @@
+//
+// Wireless Command Station
+//
+// Copyright 2020 Robert Nagowski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// See gpl-3.0.md file for details.
+//
+
+#include "netcapture.h"
+
+#include <QtEndian>
+#include <chrono>
+#include <cstring>
+
+#define PCAP_MAGIC          0xA1B2C3D4  // znaczniki czasu w us
+#define PCAP_LINKTYPE_RAW   101         // pakiet zaczyna się nagłówkiem IP
+#define PCAP_IPUDP_SIZE     28          // nagłówki IPv4 i UDP
+
+NetCapture::NetCapture(QObject *parent)
+          : QThread(parent)
+{
+    ring = nullptr;
+    head.store(0, std::memory_order_relaxed);
+    tail.store(0, std::memory_order_relaxed);
+    enabled.store(false, std::memory_order_relaxed);
+    lost.store(0, std::memory_order_relaxed);
+    fStop = false;
+}
+
+NetCapture::~NetCapture()
+{
+    close();
+    delete[] ring;
+}
+
+// otwarcie pliku pcap i wątku zapisu; pierścień pozostaje przydzielony
+// do końca, bo producent może jeszcze zapisywać rekord po close()
+bool NetCapture::open(const QString& filename)
+{
+    close();
+
+    file.setFileName(filename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qDebug("Capture: nie można otworzyć %s", filename.toLocal8Bit().data());
+        return false;
+    }
+
+    // nagłówek pliku pcap, kolejność bajtów hosta rozpoznawana z PCAP_MAGIC
+    struct {
+        quint32 magic;
+        quint16 major;
+        quint16 minor;
+        qint32  zone;
+        quint32 sigfigs;
+        quint32 snaplen;
+        quint32 linktype;
+    } hdr = { PCAP_MAGIC, 2, 4, 0, 0, NETCAP_SNAPLEN + PCAP_IPUDP_SIZE,
+              PCAP_LINKTYPE_RAW };
+    file.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+
+    if (ring == nullptr) {
+        ring = new Record[NETCAP_SLOTS];
+    }
+    tail.store(head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    lost.store(0, std::memory_order_relaxed);
+    fStop = false;
+    QThread::start(QThread::LowPriority);
+    enabled.store(true, std::memory_order_release);
+    return true;
+
+} // NetCapture::open
+
+// zatrzymanie zapisu, rekordy z pierścienia trafiają jeszcze do pliku
+void NetCapture::close()
+{
+    if (!enabled.exchange(false)) {
+        return;
+    }
+    waitMutex.lock();
+    fStop = true;
+    waitCond.wakeAll();
+    waitMutex.unlock();
+    wait();
+    file.close();
+    qDebug("Capture: pominięte %llu datagramów",
+           static_cast<unsigned long long>(dropped()));
+}
+
+void NetCapture::record(NetCaptureDir dir, quint32 addr, quint16 port,
+                        quint16 local, const void *data, int size,
+                        const void *payload, int psize)
+{
+    if (!enabled.load(std::memory_order_acquire)) {
+        return;
+    }
+
+    quint64 pos = head.load(std::memory_order_relaxed);
+    if (pos - tail.load(std::memory_order_acquire) >= NETCAP_SLOTS) {
+        lost.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    Record& rec = ring[pos & (NETCAP_SLOTS - 1)];
+    rec.time = std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::system_clock::now().time_since_epoch()).count();
+    rec.addr = addr;
+    rec.port = port;
+    rec.local = local;
+    rec.dir = static_cast<quint16>(dir);
+    rec.size = static_cast<quint16>(qMin(size + psize, 0xFFFF - PCAP_IPUDP_SIZE));
+    int len = qMin(size, NETCAP_SNAPLEN);
+    memcpy(rec.data, data, static_cast<size_t>(len));
+    if ((psize > 0) && (len < NETCAP_SNAPLEN)) {
+        memcpy(rec.data + len, payload,
+               static_cast<size_t>(qMin(psize, NETCAP_SNAPLEN - len)));
+    }
+    head.store(pos + 1, std::memory_order_release);
+
+} // NetCapture::record
+
+// wątek zapisu: opróżnianie pierścienia co NETCAP_FLUSH do close()
+void NetCapture::run()
+{
+    for (;;) {
+        waitMutex.lock();
+        if (!fStop) {
+            waitCond.wait(&waitMutex, NETCAP_FLUSH);
+        }
+        bool fEnd = fStop;
+        waitMutex.unlock();
+
+        drain();
+        if (fEnd) {
+            break;
+        }
+    }
+    file.flush();
+}
+
+void NetCapture::drain()
+{
+    quint64 pos = tail.load(std::memory_order_relaxed);
+    quint64 end = head.load(std::memory_order_acquire);
+
+    while (pos != end) {
+        writeRecord(ring[pos & (NETCAP_SLOTS - 1)]);
+        pos++;
+        tail.store(pos, std::memory_order_release);
+    }
+    file.flush();
+}
+
+// rekord pcap: nagłówki IPv4 i UDP, adres lokalny 0.0.0.0
+void NetCapture::writeRecord(const Record& rec)
+{
+    int incl = qMin(static_cast<int>(rec.size), NETCAP_SNAPLEN);
+    int orig = rec.size + PCAP_IPUDP_SIZE;
+
+    struct {
+        quint32 sec;
+        quint32 usec;
+        quint32 incl;
+        quint32 orig;
+    } phdr = { static_cast<quint32>(rec.time / 1000000),
+               static_cast<quint32>(rec.time % 1000000),
+               static_cast<quint32>(incl + PCAP_IPUDP_SIZE),
+               static_cast<quint32>(orig) };
+
+    uchar ip[PCAP_IPUDP_SIZE];
+    memset(ip, 0, sizeof(ip));
+    quint32 src = (rec.dir == CaptureIn) ? rec.addr : 0;
+    quint32 dst = (rec.dir == CaptureIn) ? 0 : rec.addr;
+    ip[0] = 0x45;                           // IPv4, nagłówek 20B
+    qToBigEndian<quint16>(static_cast<quint16>(orig), ip + 2);
+    qToBigEndian<quint16>(0x4000, ip + 6);  // DF
+    ip[8] = 64;                             // TTL
+    ip[9] = 17;                             // UDP
+    qToBigEndian<quint32>(src, ip + 12);
+    qToBigEndian<quint32>(dst, ip + 16);
+    quint32 sum = 0;
+    for (int i = 0; i < 20; i += 2) {
+        sum += static_cast<quint32>((ip[i] << 8) | ip[i + 1]);
+    }
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum += sum >> 16;
+    qToBigEndian<quint16>(static_cast<quint16>(~sum), ip + 10);
+
+    quint16 sport = (rec.dir == CaptureIn) ? rec.port : rec.local;
+    quint16 dport = (rec.dir == CaptureIn) ? rec.local : rec.port;
+    qToBigEndian<quint16>(sport, ip + 20);
+    qToBigEndian<quint16>(dport, ip + 22);
+    qToBigEndian<quint16>(static_cast<quint16>(rec.size + 8), ip + 24);
+
+    file.write(reinterpret_cast<const char*>(&phdr), sizeof(phdr));
+    file.write(reinterpret_cast<const char*>(ip), sizeof(ip));
+    file.write(rec.data, incl);
+
+} // NetCapture::writeRecord
+
+// EOF netcapture.cpp
@@ -0,0 +1,89 @@
+//
+// Wireless Command Station
+//
+// Copyright 2020 Robert Nagowski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// See gpl-3.0.md file for details.
+//
+
+#ifndef NETCAPTURE_H
+#define NETCAPTURE_H
+
+#include <QFile>
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <QWaitCondition>
+#include <QtGlobal>
+#include <atomic>
+
+#define NETCAP_SLOTS        4096    // rekordów w pierścieniu, potęga 2
+#define NETCAP_SNAPLEN      1536    // maks. zapisana część datagramu
+#define NETCAP_FLUSH        100     // okres zapisu do pliku [ms]
+
+// kierunek zapisanego datagramu
+enum NetCaptureDir {
+    CaptureIn = 0,
+    CaptureOut
+};
+
+// Zapis datagramów do pliku pcap (LINKTYPE_RAW, nagłówki IPv4/UDP
+// tworzone przy zapisie). Jeden producent, wątek sieciowy, kopiuje
+// datagram do stałego pierścienia bez blokad i formatowania; wątek
+// zapisu opróżnia pierścień co NETCAP_FLUSH. Przy pełnym pierścieniu
+// datagramy są pomijane i liczone w dropped().
+class NetCapture : public QThread
+{
+    Q_OBJECT
+
+public:
+    struct Record {
+        qint64  time;           // czas odbioru lub wysłania [us od epoki]
+        quint32 addr;           // adres centralki lub klienta
+        quint16 port;           // port centralki lub klienta
+        quint16 local;          // port lokalny
+        quint16 dir;            // NetCaptureDir
+        quint16 size;           // rozmiar datagramu
+        char    data[NETCAP_SNAPLEN];
+    };
+
+private:
+    Record *ring;               // przydzielany przy pierwszym open()
+    std::atomic<quint64> head;  // producent
+    char    pad[64];            // rozdzielenie linii cache
+    std::atomic<quint64> tail;  // wątek zapisu
+    std::atomic<bool> enabled;
+    std::atomic<quint64> lost;
+    QFile   file;
+    QMutex  waitMutex;
+    QWaitCondition waitCond;
+    bool    fStop;          // close(): koniec wątku zapisu
+
+    void drain();
+    void writeRecord(const Record& rec);
+
+protected:
+    void run();
+
+public:
+    explicit NetCapture(QObject *parent = nullptr);
+    ~NetCapture();
+
+    bool open(const QString& filename);
+    void close();
+
+    bool active() const { return enabled.load(std::memory_order_relaxed); }
+    quint64 dropped() const { return lost.load(std::memory_order_relaxed); }
+
+    // producent, wątek sieciowy; payload dopisywany za head
+    void record(NetCaptureDir dir, quint32 addr, quint16 port, quint16 local,
+                const void *data, int size,
+                const void *payload = nullptr, int psize = 0);
+
+}; // NetCapture
+
+#endif // NETCAPTURE_H
@@ -0,0 +1,197 @@
+//
+// Wireless Command Station
+//
+// Copyright 2020 Robert Nagowski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// See gpl-3.0.md file for details.
+//
+
+#ifndef NETCODEC_H
+#define NETCODEC_H
+
+#include <QtGlobal>
+#include <QtEndian>
+#include <cstring>
+
+#include "datagrams.h"
+
+// Opis wiadomości: opcode -> układ datagramu z datagrams.h.
+// Na tej podstawie powstają widoki, ramki i tablice obsługi.
+template<quint16 OPCODE> struct NetMessage;
+
+#define NET_MESSAGE(opcode, layout) \
+    template<> struct NetMessage<opcode> { typedef layout Layout; };
+
+NET_MESSAGE(WICS_DEVINFO_GET,   NetDatagram_dg)
+NET_MESSAGE(WICS_WIFISTA_GET,   NetDatagram_dg)
+NET_MESSAGE(WICS_UPGRADE_START, UpgradeInit_dg)
+NET_MESSAGE(WICS_UPGRADE_DATA,  UpgradeData_dg)
+NET_MESSAGE(WICS_DEVINFO,       DeviceInfo_dg)
+NET_MESSAGE(WICS_WIFISTA,       WiFiStation_dg)
+NET_MESSAGE(WICS_UPGRADE,       UpgradeState_dg)
+NET_MESSAGE(WICS_PAGEHASH_GET,  PageHash_dg)
+NET_MESSAGE(WICS_PAGEHASH,      PageHash_dg)
+NET_MESSAGE(WICS_HEARTBEAT_GET, NetDatagram_dg)
+NET_MESSAGE(WICS_HEARTBEAT,     NetDatagram_dg)
+NET_MESSAGE(WICS_UPGRADE_POLL,  UpgradePoll_dg)
+NET_MESSAGE(WICS_UPGRADE_NACK,  UpgradeNack_dg)
+
+template<typename F> struct NetField { typedef F Type; };
+
+// Widok odebranego datagramu, bez kopiowania. Pola czytane w kolejności
+// bajtów little-endian (Z21), bez założeń o wyrównaniu. Tworzony
+// wyłącznie przez netDispatch(), po sprawdzeniu rozmiaru.
+template<typename T>
+class NetView
+{
+private:
+    const char *dg;
+
+public:
+    explicit NetView(const char *data) : dg(data) {}
+
+    template<typename F>
+    F get(F T::*field) const
+    {
+        return qFromLittleEndian<F>(&(reinterpret_cast<const T*>(dg)->*field));
+    }
+
+    template<size_t N>
+    const char* text(char (T::*field)[N]) const
+    {
+        return reinterpret_cast<const T*>(dg)->*field;
+    }
+
+    quint16 bytes() const { return get(&T::bytes); }
+    const uchar* payload() const
+    {
+        return reinterpret_cast<const uchar*>(dg) + sizeof(T);
+    }
+    int payloadSize() const { return bytes() - static_cast<int>(sizeof(T)); }
+
+    // dłuższy nagłówek wariantu datagramu, rozmiar sprawdza wywołujący
+    template<typename U>
+    NetView<U> as() const { return NetView<U>(dg); }
+
+}; // NetView
+
+// Ramka wysyłanego datagramu: bytes, header i opcode wypełnione,
+// pozostałe pola wyzerowane
+template<typename T>
+class NetFrame
+{
+private:
+    T dg;
+
+public:
+    explicit NetFrame(quint16 opcode, int size = sizeof(T))
+    {
+        memset(&dg, 0, sizeof(T));
+        set(&T::bytes, static_cast<quint16>(size));
+        set(&T::header, LAN_WICS_MESSAGE);
+        set(&T::opcode, opcode);
+    }
+
+    template<typename F>
+    void set(F T::*field, typename NetField<F>::Type value)
+    {
+        qToLittleEndian<F>(value, &(dg.*field));
+    }
+
+    template<typename F>
+    F get(F T::*field) const
+    {
+        return qFromLittleEndian<F>(&(dg.*field));
+    }
+
+    template<size_t N>
+    char* text(char (T::*field)[N]) { return dg.*field; }
+
+    const T* data() const { return &dg; }
+    // rozmiar wysyłany: pole bytes, krótszy dla starszych wariantów
+    int size() const { return get(&T::bytes); }
+
+}; // NetFrame
+
+// skrót strony firmware (FNV-1a, 32 bity), liczony tak samo w centralce
+inline quint32 netPageHash(const uchar *data, qint64 size)
+{
+    quint32 hash = 0x811C9DC5;
+    for (qint64 i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * 0x01000193;
+    }
+    return hash;
+}
+
+// wynik dekodowania datagramu
+enum NetDecode {
+    DecodeOk = 0,
+    DecodeShort,        // krótszy niż nagłówek
+    DecodeHeader,       // nieznany header
+    DecodeLength,       // pole bytes niezgodne z rozmiarem
+    DecodeOpcode        // brak obsługi opcode
+};
+
+// Pozycja tablicy obsługi: opcode, minimalny rozmiar, funkcja
+template<class R>
+struct NetHandler {
+    quint16 opcode;
+    quint16 minSize;
+    void (*invoke)(R& receiver, quint32 addr, const char *data);
+};
+
+template<class R, quint16 OP,
+         void (R::*H)(quint32, const NetView<typename NetMessage<OP>::Layout>&)>
+void netInvoke(R& receiver, quint32 addr, const char *data)
+{
+    (receiver.*H)(addr, NetView<typename NetMessage<OP>::Layout>(data));
+}
+
+// pozycja tablicy obsługi wyznaczana w czasie kompilacji z opisu wiadomości
+template<class R, quint16 OP,
+         void (R::*H)(quint32, const NetView<typename NetMessage<OP>::Layout>&)>
+constexpr NetHandler<R> netHandler()
+{
+    return NetHandler<R>{ OP,
+                          static_cast<quint16>(sizeof(typename NetMessage<OP>::Layout)),
+                          &netInvoke<R, OP, H> };
+}
+
+// sprawdzenie rozmiaru i wywołanie obsługi z tablicy
+template<class R, size_t N>
+NetDecode netDispatch(const NetHandler<R> (&table)[N], R& receiver,
+                      quint32 addr, const char *data, int size)
+{
+    if (size < static_cast<int>(sizeof(NetDatagram_dg))) {
+        return DecodeShort;
+    }
+
+    NetView<NetDatagram_dg> dg(data);
+    if (dg.get(&NetDatagram_dg::header) != LAN_WICS_MESSAGE) {
+        return DecodeHeader;
+    }
+    int bytes = dg.bytes();
+    if (bytes > size) {
+        return DecodeLength;
+    }
+
+    quint16 opcode = dg.get(&NetDatagram_dg::opcode);
+    for (size_t i = 0; i < N; i++) {
+        if (table[i].opcode == opcode) {
+            if (bytes < table[i].minSize) {
+                return DecodeLength;
+            }
+            table[i].invoke(receiver, addr, data);
+            return DecodeOk;
+        }
+    }
+
+    return DecodeOpcode;
+
+} // netDispatch
+
+#endif // NETCODEC_H
@@ -0,0 +1,109 @@
+//
+// Wireless Command Station
+//
+// Copyright 2020 Robert Nagowski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// See gpl-3.0.md file for details.
+//
+
+#include "netdevice.h"
+
+#include <QHostAddress>
+#include <cstring>
+
+DeviceInfo::DeviceInfo()
+{
+    addr = 0;
+    hardware = 0;
+    hwVersion = 0;
+    swVersion = 0;
+    fwVersion = 0;
+    serialNum = 0;
+    lastSeen = 0;
+}
+
+DeviceInfo::DeviceInfo(quint32 from, const NetView<DeviceInfo_dg>& data,
+                       qint64 seen)
+{
+    addr = from;
+    hardware = data.get(&DeviceInfo_dg::hardware);
+    hwVersion = data.get(&DeviceInfo_dg::hwVersion);
+    swVersion = data.get(&DeviceInfo_dg::swVersion);
+    fwVersion = data.get(&DeviceInfo_dg::fwVersion);
+    serialNum = data.get(&DeviceInfo_dg::serialNum);
+    lastSeen = seen;
+}
+
+QString DeviceInfo::address() const
+{
+    return QHostAddress(addr).toString();
+}
+
+QString DeviceInfo::hwString() const
+{
+    return QString("%1.%2")
+            .arg(hwVersion / 100)
+            .arg(hwVersion % 100);
+}
+
+QString DeviceInfo::swString() const
+{
+    return QString("%1.%2.%3")
+            .arg((swVersion >> 24) & 0xFF)
+            .arg((swVersion >> 16) & 0xFF)
+            .arg(swVersion & 0xFFFF);
+}
+
+QString DeviceInfo::fwString() const
+{
+    return QString("%1.%2.%3")
+            .arg((fwVersion >> 24) & 0xFF)
+            .arg((fwVersion >> 16) & 0xFF)
+            .arg(fwVersion & 0xFFFF);
+}
+
+QString DeviceInfo::serialString() const
+{
+    return QString("%1").arg(serialNum, 8, 16, QChar('0'));
+}
+
+WiFiStation::WiFiStation()
+{
+    addr = 0;
+    memset(ssid, 0, sizeof(ssid));
+    memset(pass, 0, sizeof(pass));
+}
+
+WiFiStation::WiFiStation(quint32 from, const NetView<WiFiStation_dg>& data)
+{
+    addr = from;
+    memcpy(ssid, data.text(&WiFiStation_dg::ssid), MAX_WLAN_NAME);
+    memcpy(pass, data.text(&WiFiStation_dg::pass), MAX_WLAN_PASS);
+    ssid[MAX_WLAN_NAME] = 0;
+    pass[MAX_WLAN_PASS] = 0;
+}
+
+WiFiStation::WiFiStation(quint32 to, const QString& wssid, const QString& wpass)
+{
+    addr = to;
+    memset(ssid, 0, sizeof(ssid));
+    memset(pass, 0, sizeof(pass));
+    strncpy(ssid, wssid.toLocal8Bit().constData(), MAX_WLAN_NAME);
+    strncpy(pass, wpass.toLocal8Bit().constData(), MAX_WLAN_PASS);
+}
+
+QString WiFiStation::ssidString() const
+{
+    return QString::fromLocal8Bit(ssid);
+}
+
+QString WiFiStation::passString() const
+{
+    return QString::fromLocal8Bit(pass);
+}
+
+// EOF netdevice.cpp
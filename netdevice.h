@@ -0,0 +1,68 @@
+//
+// Wireless Command Station
+//
+// Copyright 2020 Robert Nagowski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// See gpl-3.0.md file for details.
+//
+
+#ifndef NETDEVICE_H
+#define NETDEVICE_H
+
+#include <QMetaType>
+#include <QString>
+
+#include "datagrams.h"
+#include "netcodec.h"
+
+// Informacje o centralce z odpowiedzi WICS_DEVINFO.
+// Wartości binarne, tekst tworzony dopiero przy wyświetlaniu.
+class DeviceInfo
+{
+public:
+    quint32 addr;           // adres, z którego przyszła odpowiedź
+    quint16 hardware;
+    quint16 hwVersion;
+    quint32 swVersion;
+    quint32 fwVersion;
+    quint32 serialNum;
+    qint64  lastSeen;       // czas odpowiedzi [ms od epoki]
+
+public:
+    DeviceInfo();
+    DeviceInfo(quint32 from, const NetView<DeviceInfo_dg>& data, qint64 seen);
+
+    QString address() const;
+    QString hwString() const;
+    QString swString() const;
+    QString fwString() const;
+    QString serialString() const;
+
+}; // DeviceInfo
+
+// Konfiguracja WiFi centralki (WICS_WIFISTA)
+class WiFiStation
+{
+public:
+    quint32 addr;
+    char    ssid[MAX_WLAN_NAME+1];
+    char    pass[MAX_WLAN_PASS+1];
+
+public:
+    WiFiStation();
+    WiFiStation(quint32 from, const NetView<WiFiStation_dg>& data);
+    WiFiStation(quint32 to, const QString& wssid, const QString& wpass);
+
+    QString ssidString() const;
+    QString passString() const;
+
+}; // WiFiStation
+
+Q_DECLARE_METATYPE(DeviceInfo)
+Q_DECLARE_METATYPE(WiFiStation)
+
+#endif // NETDEVICE_H
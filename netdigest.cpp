@@ -0,0 +1,107 @@
+//
+// Wireless Command Station
+//
+// Copyright 2020 Robert Nagowski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// See gpl-3.0.md file for details.
+//
+
+#include "netdigest.h"
+
+#include <QtEndian>
+#include <cstring>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <nmmintrin.h>
+#define NET_CRC_SSE42
+#endif
+
+// tablice CRC32C slicing-by-8, wielomian odwrócony 0x82F63B78
+static quint32 crcTable[8][256];
+
+static bool crcTableInit()
+{
+    for (quint32 n = 0; n < 256; n++) {
+        quint32 crc = n;
+        for (int k = 0; k < 8; k++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78 : crc >> 1;
+        }
+        crcTable[0][n] = crc;
+    }
+    for (quint32 n = 0; n < 256; n++) {
+        for (int t = 1; t < 8; t++) {
+            crcTable[t][n] = (crcTable[t - 1][n] >> 8)
+                             ^ crcTable[0][crcTable[t - 1][n] & 0xFF];
+        }
+    }
+    return true;
+}
+
+static quint32 crc32cTable(const uchar *p, qint64 size, quint32 crc)
+{
+    static const bool fInit = crcTableInit();
+    Q_UNUSED(fInit)
+
+    while ((size > 0) && (reinterpret_cast<quintptr>(p) & 7)) {
+        crc = crcTable[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        size--;
+    }
+    while (size >= 8) {
+        quint32 lo = qFromLittleEndian<quint32>(p) ^ crc;
+        quint32 hi = qFromLittleEndian<quint32>(p + 4);
+        crc = crcTable[7][lo & 0xFF] ^ crcTable[6][(lo >> 8) & 0xFF]
+              ^ crcTable[5][(lo >> 16) & 0xFF] ^ crcTable[4][lo >> 24]
+              ^ crcTable[3][hi & 0xFF] ^ crcTable[2][(hi >> 8) & 0xFF]
+              ^ crcTable[1][(hi >> 16) & 0xFF] ^ crcTable[0][hi >> 24];
+        p += 8;
+        size -= 8;
+    }
+    while (size-- > 0) {
+        crc = crcTable[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#ifdef NET_CRC_SSE42
+__attribute__ ((target("sse4.2")))
+static quint32 crc32cSse42(const uchar *p, qint64 size, quint32 crc)
+{
+    quint64 crc64 = crc;
+
+    while ((size > 0) && (reinterpret_cast<quintptr>(p) & 7)) {
+        crc64 = _mm_crc32_u8(static_cast<quint32>(crc64), *p++);
+        size--;
+    }
+    while (size >= 8) {
+        quint64 v;
+        memcpy(&v, p, sizeof(v));
+        crc64 = _mm_crc32_u64(crc64, v);
+        p += 8;
+        size -= 8;
+    }
+    while (size-- > 0) {
+        crc64 = _mm_crc32_u8(static_cast<quint32>(crc64), *p++);
+    }
+    return static_cast<quint32>(crc64);
+}
+#endif
+
+quint32 netCrc32c(const void *data, qint64 size, quint32 crc)
+{
+    const uchar *p = static_cast<const uchar*>(data);
+    crc = ~crc;
+#ifdef NET_CRC_SSE42
+    static const bool fSse42 = __builtin_cpu_supports("sse4.2");
+    if (fSse42) {
+        return ~crc32cSse42(p, size, crc);
+    }
+#endif
+    return ~crc32cTable(p, size, crc);
+
+} // netCrc32c
+
+// EOF netdigest.cpp
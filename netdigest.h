@@ -0,0 +1,22 @@
+//
+// Wireless Command Station
+//
+// Copyright 2020 Robert Nagowski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// See gpl-3.0.md file for details.
+//
+
+#ifndef NETDIGEST_H
+#define NETDIGEST_H
+
+#include <QtGlobal>
+
+// CRC32C (Castagnoli), instrukcja crc32 SSE4.2, gdy procesor ją ma,
+// w przeciwnym razie tablice slicing-by-8; crc: wynik poprzedniej części
+quint32 netCrc32c(const void *data, qint64 size, quint32 crc = 0);
+
+#endif // NETDIGEST_H
@@ -0,0 +1,186 @@
+//
+// Wireless Command Station
+//
+// Copyright 2020 Robert Nagowski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// See gpl-3.0.md file for details.
+//
+
+#include "netdrive.h"
+
+#include <QMutexLocker>
+#include <QtEndian>
+#include <cstring>
+
+// adres lokomotywy z DB1..DB2 LAN_X_SET_LOCO
+static quint16 locoAddress(const char *db)
+{
+    return static_cast<quint16>(((static_cast<quint8>(db[0]) & 0x3F) << 8)
+                                | static_cast<quint8>(db[1]));
+}
+
+// nagłówek, adres lokomotywy i XOR komunikatu LAN_X_SET_LOCO
+static void setLocoFrame(char *data, quint8 db0, quint16 loco, quint8 db3)
+{
+    qToLittleEndian<quint16>(Z21_SET_LOCO_SIZE, data);
+    qToLittleEndian<quint16>(LAN_X_MESSAGE, data + 2);
+    data[4] = static_cast<char>(LAN_X_SET_LOCO);
+    data[5] = static_cast<char>(db0);
+    // adres długi (>= 128): dwa najstarsze bity ustawione
+    data[6] = static_cast<char>(((loco >> 8) & 0x3F) | ((loco >= 128) ? 0xC0 : 0));
+    data[7] = static_cast<char>(loco & 0xFF);
+    data[8] = static_cast<char>(db3);
+
+    quint8 x = 0;
+    for (int i = 4; i < Z21_SET_LOCO_SIZE - 1; i++) {
+        x ^= static_cast<quint8>(data[i]);
+    }
+    data[Z21_SET_LOCO_SIZE - 1] = static_cast<char>(x);
+}
+
+NetDrive::NetDrive()
+{
+    commands.reserve(NETD_SLOTS);
+    count.store(0, std::memory_order_relaxed);
+}
+
+NetDrive::Result NetDrive::push(quint32 addr, quint16 port, const char *data,
+                                int size)
+{
+    if (size != Z21_SET_LOCO_SIZE) {
+        return DriveFull;
+    }
+
+    quint16 loco = locoAddress(data + 6);
+    quint64 k = key(addr, loco);
+
+    QMutexLocker locker(&mutex);
+    int pos = index.value(k, -1);
+    if (pos >= 0) {
+        memcpy(commands[pos].data, data, Z21_SET_LOCO_SIZE);
+        return DriveReplaced;
+    }
+    if (commands.count() >= NETD_SLOTS) {
+        return DriveFull;
+    }
+
+    Command c;
+    c.addr = addr;
+    c.port = port;
+    c.loco = loco;
+    memcpy(c.data, data, Z21_SET_LOCO_SIZE);
+    index.insert(k, commands.count());
+    commands.append(c);
+    count.store(commands.count(), std::memory_order_release);
+    return DriveAdded;
+
+} // NetDrive::push
+
+void NetDrive::take(Commands& out)
+{
+    out.clear();
+    if (isEmpty()) {
+        return;
+    }
+
+    QMutexLocker locker(&mutex);
+    out.swap(commands);
+    commands.reserve(NETD_SLOTS);
+    index.clear();
+    count.store(0, std::memory_order_release);
+}
+
+bool NetDrive::take(quint32 addr, quint16 loco, Command& out)
+{
+    if (isEmpty()) {
+        return false;
+    }
+
+    QMutexLocker locker(&mutex);
+    int pos = index.value(key(addr, loco), -1);
+    if (pos < 0) {
+        return false;
+    }
+    out = commands.at(pos);
+    commands.remove(pos);
+    index.remove(key(addr, loco));
+    // kolejne polecenia przesunięte o jedno miejsce
+    for (int i = pos; i < commands.count(); i++) {
+        index.insert(key(commands.at(i).addr, commands.at(i).loco), i);
+    }
+    count.store(commands.count(), std::memory_order_release);
+    return true;
+
+} // NetDrive::take
+
+// polecenie jazdy: LAN_X_SET_LOCO z DB0 0x10..0x13
+bool NetDrive::isDrive(const char *data, int size)
+{
+    if ((size != Z21_SET_LOCO_SIZE)
+        || (qFromLittleEndian<quint16>(data + 2) != LAN_X_MESSAGE)
+        || (static_cast<quint8>(data[4]) != LAN_X_SET_LOCO)) {
+        return false;
+    }
+    quint8 db0 = static_cast<quint8>(data[5]);
+    return (db0 & 0xF0) == Z21_LOCO_DRIVE_14;
+}
+
+// zapytanie o stan lokomotywy: LAN_X_GET_LOCO_INFO z DB0 0xF0
+bool NetDrive::isLocoQuery(const char *data, int size, quint16& loco)
+{
+    if ((size != 9) || (qFromLittleEndian<quint16>(data + 2) != LAN_X_MESSAGE)
+        || (static_cast<quint8>(data[4]) != LAN_X_GET_LOCO_INFO)
+        || (static_cast<quint8>(data[5]) != 0xF0)) {
+        return false;
+    }
+    loco = locoAddress(data + 6);
+    return true;
+}
+
+// jazda: speed 0 - stop, 1..steps-1 - krok, < 0 - zatrzymanie awaryjne;
+// zwraca rozmiar komunikatu
+int NetDrive::driveFrame(char *data, quint16 loco, int speed, bool forward,
+                         int steps)
+{
+    quint8 db0;
+    quint8 v;
+
+    if (steps == 14) {
+        db0 = Z21_LOCO_DRIVE_14;
+        speed = qMin(speed, 14);
+        v = static_cast<quint8>((speed < 0) ? 1 : (speed == 0) ? 0 : speed + 1);
+    }
+    else if (steps == 28) {
+        // kroki 1..28 jako 4..31, najmłodszy bit na pozycji 4 (V5)
+        db0 = Z21_LOCO_DRIVE_28;
+        speed = qMin(speed, 28);
+        int n = (speed < 0) ? 2 : (speed == 0) ? 0 : speed + 3;
+        v = static_cast<quint8>((n >> 1) | ((n & 1) << 4));
+    }
+    else {
+        db0 = Z21_LOCO_DRIVE_128;
+        speed = qMin(speed, 126);
+        v = static_cast<quint8>((speed < 0) ? 1 : (speed == 0) ? 0 : speed + 1);
+    }
+    if (forward) {
+        v |= 0x80;
+    }
+
+    setLocoFrame(data, db0, loco, v);
+    return Z21_SET_LOCO_SIZE;
+
+} // NetDrive::driveFrame
+
+// funkcja 0..63, action: Z21_FUNC_OFF, Z21_FUNC_ON, Z21_FUNC_TOGGLE
+int NetDrive::functionFrame(char *data, quint16 loco, int function, int action)
+{
+    setLocoFrame(data, Z21_LOCO_FUNCTION, loco,
+                 static_cast<quint8>(((action & 0x03) << 6) | (function & 0x3F)));
+    return Z21_SET_LOCO_SIZE;
+}
+
+// EOF netdrive.cpp
@@ -0,0 +1,83 @@
+//
+// Wireless Command Station
+//
+// Copyright 2020 Robert Nagowski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// See gpl-3.0.md file for details.
+//
+
+#ifndef NETDRIVE_H
+#define NETDRIVE_H
+
+#include <QHash>
+#include <QMutex>
+#include <QVector>
+#include <QtGlobal>
+#include <atomic>
+
+#include "datagrams.h"
+
+#define NETD_SLOTS          64      // maks. liczba lokomotyw w oczekiwaniu
+
+// Polecenia jazdy lokomotyw (LAN_X_SET_LOCO, DB0 0x10..0x13) czekające na
+// wysłanie: jedno na centralkę i adres lokomotywy, nowsze zastępuje
+// starsze na swoim miejscu w kolejności. Wątek sieciowy wysyła tylko
+// najnowszą prędkość i kierunek, więc opóźnienie nie rośnie z liczbą
+// poleceń. Zapytanie o stan lokomotywy (LAN_X_GET_LOCO_INFO) wysyła
+// przed sobą jej oczekujące polecenie. Funkcje lokomotyw idą przez
+// NetQueue, w kolejności.
+// Własna blokada, wywołania z dowolnego wątku.
+class NetDrive
+{
+    Q_DISABLE_COPY(NetDrive)
+
+public:
+    struct Command {
+        quint32 addr;
+        quint16 port;
+        quint16 loco;
+        char    data[Z21_SET_LOCO_SIZE];
+    };
+    typedef QVector<Command> Commands;
+
+    enum Result {
+        DriveAdded = 0,     // nowe polecenie
+        DriveReplaced,      // zastąpione polecenie tej samej lokomotywy
+        DriveFull           // brak miejsca, polecenie odrzucone
+    };
+
+private:
+    QMutex  mutex;
+    Commands commands;                  // w kolejności pierwszego polecenia
+    QHash<quint64, int> index;          // miejsce według centralki i adresu
+    std::atomic<int> count;             // liczba poleceń, bez blokady
+
+    static quint64 key(quint32 addr, quint16 loco)
+    {
+        return (static_cast<quint64>(addr) << 16) | loco;
+    }
+
+public:
+    NetDrive();
+
+    // polecenie jazdy z danymi LAN_X_SET_LOCO
+    Result push(quint32 addr, quint16 port, const char *data, int size);
+    // wszystkie oczekujące polecenia, wątek sieciowy
+    void take(Commands& out);
+    // oczekujące polecenie jednej lokomotywy, przed zapytaniem o jej stan
+    bool take(quint32 addr, quint16 loco, Command& out);
+    bool isEmpty() const { return count.load(std::memory_order_acquire) == 0; }
+
+    static bool isDrive(const char *data, int size);
+    static bool isLocoQuery(const char *data, int size, quint16& loco);
+    static int driveFrame(char *data, quint16 loco, int speed, bool forward,
+                          int steps);
+    static int functionFrame(char *data, quint16 loco, int function, int action);
+
+}; // NetDrive
+
+#endif // NETDRIVE_H
@@ -12,20 +12,60 @@
 
 #include "netengine.h"
 
+#include <QDateTime>
+#include <QNetworkInterface>
+#include <QPair>
+
+#ifdef Q_OS_UNIX
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
 NetEngine::NetEngine(QObject *parent)
          : QThread(parent)
 {
     thePort = 0;
-    targetAddr = 0;
+    peerPort = 0;
+    udpSocket = nullptr;
+    group = nullptr;
+#ifdef WICS_MMSG
+    udpBatch = nullptr;
+#endif
+    imageWindow = DEF_UPG_WINDOW;
+    imageSparse = false;
+    imageChecksum = false;
+    imageBlockMax = 0;
+    for (int i = 0; i < LatencyMax; i++) {
+        requestAny[i] = 0;
+    }
+    rtoTimer = nullptr;
+    // dziennik zapisywany w wątku GUI, nie w ścieżce odbioru ACK
+    journalTimer = new QTimer(this);
+    connect(journalTimer, SIGNAL(timeout()), this, SLOT(flushJournal()));
+    beatInterval = 0;
+    outWake.store(false);
+    clock.start();
+    qRegisterMetaType<DeviceInfo>("DeviceInfo");
+    qRegisterMetaType<WiFiStation>("WiFiStation");
+#ifndef Q_OS_UNIX
+    imageData.resize(static_cast<int>(sizeof(UpgradeCrc_dg)) + UPG_MAX_BLOCK);
+#endif
 }
 
 NetEngine::~NetEngine()
 {
     closeSocket();
     wait();
+    journal.flush();
+    qDeleteAll(sessions);
+    delete group;
+    // wątek skrótów kończony przed zniszczeniem obiektu (imagedigest)
+    image.clear();
 }
 
-void NetEngine::openSocket(quint16 theport)
+// port lokalny i port centralek; peerport == 0: ten sam co lokalny
+void NetEngine::openSocket(quint16 theport, quint16 peerport)
 {
     if (theport == 0) {
         closeSocket();
@@ -33,6 +73,8 @@ void NetEngine::openSocket(quint16 theport)
     else {
         mutex.lock();
         thePort = theport;
+        peerPort = (peerport == 0) ? theport : peerport;
+        gateway.setStationPort(peerPort);
         mutex.unlock();
         if (!isRunning()) {
             start();
@@ -45,280 +87,1383 @@ void NetEngine::closeSocket()
     mutex.lock();
     thePort = 0;
     mutex.unlock();
+    quit();
 }
 
 void NetEngine::run()
 {
     QUdpSocket udp;
-    qint64     bytes;
-    quint32    address;
-    QByteArray datagram;
+#ifdef WICS_MMSG
+    NetMmsg batch;
+    QScopedPointer<QSocketNotifier> notifier;
+#endif
 
     // otwarcie portu
     if (thePort > 0) {
+#ifdef WICS_MMSG
+        // Linux: wsadowy odbiór i wysyłanie, QUdpSocket jako rezerwa
+        if (batch.bind(thePort)) {
+            udpBatch = &batch;
+            notifier.reset(new QSocketNotifier(batch.socketDescriptor(),
+                                               QSocketNotifier::Read));
+            connect(notifier.data(), SIGNAL(activated(int)),
+                    this, SLOT(readDatagrams()), Qt::DirectConnection);
+        }
+        else
+#endif
         if (udp.bind(thePort)) {
-            emit connected(thePort);
+            udpSocket = &udp;
+            connect(&udp, SIGNAL(readyRead()),
+                    this, SLOT(readDatagrams()), Qt::DirectConnection);
         }
         else {
-            emit connected(0);
             thePort = 0;
         }
     }
+    emit connected(thePort);
+
+    if (thePort == 0) {
+        return;
+    }
+
+    // wątek czeka w pętli zdarzeń: budzi go odebrany datagram
+    // lub sygnał outqueued() po dopisaniu pakietu do kolejki
+    connect(this, &NetEngine::outqueued,
+            &udp, [this]() { writeDatagrams(); },
+            Qt::QueuedConnection);
+
+    // ponowienia wysyłane z wątku sieciowego w terminie RTO sesji
+    QTimer rto;
+    rto.setSingleShot(true);
+    rto.setTimerType(Qt::PreciseTimer);
+    connect(&rto, &QTimer::timeout, &udp, [this]() { retransmit(); });
+    rtoTimer = &rto;
+
+    // heartbeat sesji; okres zmieniany przez setHeartbeat()
+    QTimer beat;
+    connect(&beat, &QTimer::timeout, &udp, [this]() { heartbeat(); });
+    connect(this, &NetEngine::heartbeatset, &udp, [this, &beat]() {
+                mutex.lock();
+                int interval = beatInterval;
+                mutex.unlock();
+                if (interval > 0) {
+                    beat.start(interval);
+                }
+                else {
+                    beat.stop();
+                }
+            }, Qt::QueuedConnection);
+    emit heartbeatset();
+
+    writeDatagrams();
+    readDatagrams();
+    exec();
+
+    rtoTimer = nullptr;
+    udpSocket = nullptr;
+#ifdef WICS_MMSG
+    udpBatch = nullptr;
+#endif
+
+} // NetEngine::run
+
+// wysłanie pakietów z kolejki
+void NetEngine::writeDatagrams()
+{
+    const NetQueue::Slot *slot;
+
+    outWake.exchange(false);
+    while ((slot = outQueue.front()) != nullptr) {
+        sendDatagram(slot->addr, peerPort, slot->data, slot->size);
+        outQueue.pop();
+    } // front
+
+    writeDrives();
+    writeUpgradeData();
+    flushDatagrams();
+    armRetransmit();
+
+} // NetEngine::writeDatagrams
+
+// wysłanie najnowszych poleceń jazdy lokomotyw
+void NetEngine::writeDrives()
+{
+    NetDrive::Commands out;
+
+    drives.take(out);
+    for (int cnt = 0; cnt < out.count(); cnt++) {
+        sendDatagram(out.at(cnt).addr, out.at(cnt).port, out.at(cnt).data,
+                     Z21_SET_LOCO_SIZE);
+    }
+
+} // NetEngine::writeDrives
+
+// sesje po terminie potwierdzenia: start lub okno wysyłane ponownie
+void NetEngine::retransmit()
+{
+    QList<quint32> failed;
+    QList<QPair<quint32, NetFrame<UpgradeInitResume_dg> > > inits;
+    QList<QPair<quint32, NetFrame<PageHash_dg> > > hashes;
+    QList<quint32> groupInits;
+    NetFrame<UpgradeInitDigest_dg> groupInit(WICS_UPGRADE_START);
+    NetGroup::Events events;
+    int blocks = 0;
+    qint64 now = clock.elapsed();
+
+    mutex.lock();
+    if (group != nullptr) {
+        group->timeout(now, groupInits, events);
+        if (!groupInits.isEmpty()) {
+            group->initFrame(groupInit);
+            group->initSent(now);
+        }
+        blocks = group->blocks();
+    }
+    QHashIterator<quint32, NetSession*> i(sessions);
+    while (i.hasNext()) {
+        i.next();
+        switch (i.value()->timeout(now)) {
+        case TimeoutHash: {
+            QList<NetFrame<PageHash_dg> > frames;
+            i.value()->hashFrames(frames, now);
+            for (int cnt = 0; cnt < frames.count(); cnt++) {
+                hashes.append(qMakePair(i.key(), frames.at(cnt)));
+            }
+            break;
+        }
+        case TimeoutInit: {
+            NetFrame<UpgradeInitResume_dg> data(WICS_UPGRADE_START);
+            i.value()->initFrame(data);
+            inits.append(qMakePair(i.key(), data));
+            break;
+        }
+        case TimeoutData:
+            netMetrics.add(CountRetrans);
+            break;
+        case TimeoutFailed:
+            failed.append(i.key());
+            break;
+        default:
+            break;
+        } // switch timeout
+    }
+    mutex.unlock();
+
+    netMetrics.add(CountRetrans, static_cast<quint64>(hashes.count() + inits.count()
+                                                      + groupInits.count()));
+    for (int cnt = 0; cnt < hashes.count(); cnt++) {
+        sendDatagram(hashes.at(cnt).first, peerPort, hashes.at(cnt).second.data(),
+                     hashes.at(cnt).second.size());
+    }
+    for (int cnt = 0; cnt < inits.count(); cnt++) {
+        qDebug("Resend upgrade init: %s",
+               QHostAddress(inits.at(cnt).first).toString().toLatin1().data());
+        sendDatagram(inits.at(cnt).first, peerPort, inits.at(cnt).second.data(),
+                     inits.at(cnt).second.size());
+    }
+    for (int cnt = 0; cnt < groupInits.count(); cnt++) {
+        sendDatagram(groupInits.at(cnt), peerPort, groupInit.data(), groupInit.size());
+    }
+    for (int cnt = 0; cnt < failed.count(); cnt++) {
+        netMetrics.add(CountNoAnswer);
+        emit noanswer(failed.at(cnt));
+    }
+    emitGroupEvents(events, blocks);
+    writeUpgradeData();
+    flushDatagrams();
+    armRetransmit();
+
+} // NetEngine::retransmit
+
+// heartbeat bezczynnych sesji i zmiany stanu łącza centralek
+void NetEngine::heartbeat()
+{
+    QList<QPair<quint32, NetFrame<NetDatagram_dg> > > beats;
+    QList<QPair<quint32, bool> > changes;
+    qint64 now = clock.elapsed();
+
+    mutex.lock();
+    int interval = beatInterval;
+    QHashIterator<quint32, NetSession*> i(sessions);
+    while (i.hasNext() && (interval > 0)) {
+        i.next();
+        NetFrame<NetDatagram_dg> data(WICS_HEARTBEAT_GET);
+        if (i.value()->heartbeat(data, now, interval)) {
+            beats.append(qMakePair(i.key(), data));
+        }
+        int change = i.value()->linkCheck(now, interval);
+        if (change != 0) {
+            changes.append(qMakePair(i.key(), change > 0));
+        }
+    }
+    mutex.unlock();
+
+    for (int cnt = 0; cnt < beats.count(); cnt++) {
+        sendDatagram(beats.at(cnt).first, peerPort, beats.at(cnt).second.data(),
+                     beats.at(cnt).second.size());
+    }
+    flushDatagrams();
+    for (int cnt = 0; cnt < changes.count(); cnt++) {
+        qDebug("Link %s: %s",
+               QHostAddress(changes.at(cnt).first).toString().toLatin1().data(),
+               changes.at(cnt).second ? "online" : "offline");
+        emit linkchanged(changes.at(cnt).first, changes.at(cnt).second);
+    }
+
+} // NetEngine::heartbeat
+
+// zegar ponowień na najbliższy termin spośród sesji
+void NetEngine::armRetransmit()
+{
+    qint64 next = 0;
+
+    mutex.lock();
+    if (group != nullptr) {
+        next = group->retransmitAt();
+    }
+    QHashIterator<quint32, NetSession*> i(sessions);
+    while (i.hasNext()) {
+        i.next();
+        qint64 at = i.value()->retransmitAt();
+        if ((at > 0) && ((next == 0) || (at < next))) {
+            next = at;
+        }
+    }
+    mutex.unlock();
+
+    if (rtoTimer == nullptr) {
+        return;
+    }
+    if (next == 0) {
+        rtoTimer->stop();
+    }
     else {
-        emit connected(0);
+        rtoTimer->start(static_cast<int>(qMax(Q_INT64_C(0), next - clock.elapsed())));
     }
 
-    while (thePort != 0) {
+} // NetEngine::armRetransmit
 
-        // wysłanie pakietów
-        mutex.lock();
-        QHashIterator<quint32, QByteArray> i(outBuffer);
+// wysłanie bloków aktualizacji mieszczących się w oknach sesji
+// i bloków bieżącej rundy aktualizacji grupowej
+void NetEngine::writeUpgradeData()
+{
+    NetFrame<UpgradeCrc_dg> data(WICS_UPGRADE_DATA);
+    const uchar   *payload;
+    qint64         psize;
+    QList<quint32> active;
+    qint64         now = clock.elapsed();
 
-        while (i.hasNext()) {
-            i.next();
-            address = i.key();
-            datagram = i.value();
-            bytes = udp.writeDatagram(datagram, QHostAddress(address), thePort);
-            if (bytes == -1) {
+    mutex.lock();
+    QHashIterator<quint32, NetSession*> i(sessions);
+    while (i.hasNext()) {
+        i.next();
+        if (i.value()->upgradeActive()) {
+            active.append(i.key());
+        }
+    }
+    mutex.unlock();
 
+    for (int cnt = 0; cnt < active.count(); cnt++) {
+        quint32 addr = active.at(cnt);
+        // img utrzymuje mapowanie pliku do końca wysyłania
+        QSharedPointer<NetImage> img;
+        for (;;) {
+            // pobranie numeru bloku, wysyłanie poza sekcją krytyczną
+            mutex.lock();
+            NetSession *s = sessions.value(addr, nullptr);
+            int hsize = 0;
+            if (s != nullptr) {
+                img = s->upgradeImage();
+                hsize = s->headerSize();
             }
-        } // hasNext
+            bool fNext = (s != nullptr) && s->nextBlock(data, payload, psize, now);
+            mutex.unlock();
+            if (!fNext) {
+                break;
+            }
+
+            quint16 block = data.get(&UpgradeCrc_dg::block);
+            if (!sendUpgradeBlock(addr, data.data(), hsize, payload, psize)) {
+                mutex.lock();
+                s = sessions.value(addr, nullptr);
+                if (s != nullptr) {
+                    s->blockFailed(block);
+                }
+                mutex.unlock();
+                break;
+            }
+        } // okno
+        flushDatagrams();
+    } // active
 
-        outBuffer.clear();
+    // bloki rundy raz do adresu grupy, po ostatnim pytanie o braki
+    QSharedPointer<NetImage> img;
+    NetFrame<UpgradePoll_dg> poll(WICS_UPGRADE_POLL);
+    quint32 groupaddr = 0;
+    bool fPoll = false;
+    for (;;) {
+        mutex.lock();
+        int hsize = 0;
+        bool fNext = (group != nullptr) && group->nextBlock(data, payload, psize);
+        if (fNext) {
+            img = group->upgradeImage();
+            hsize = group->headerSize();
+            groupaddr = group->address();
+        }
+        else if (group != nullptr) {
+            groupaddr = group->address();
+            fPoll = group->pollFrame(poll, now);
+        }
         mutex.unlock();
+        if (!fNext) {
+            break;
+        }
 
-        // odbiór pakietów
-        while (udp.hasPendingDatagrams()) {
-            quint16      senderPort;
-            QHostAddress senderAddr;
-            //datagram.clear();
-            bytes = udp.pendingDatagramSize();
-            qDebug("UDP datagram: %dB", static_cast<int>(bytes));
-            datagram.resize(static_cast<int>(bytes));
-            if (-1 != udp.readDatagram(datagram.data(), datagram.size(),
-                                       &senderAddr, &senderPort)) {
-                qDebug("%s", datagram.toHex().constData());
-                processDatagram(senderAddr.toIPv4Address(), datagram);
+        if (!sendUpgradeBlock(groupaddr, data.data(), hsize, payload, psize)) {
+            mutex.lock();
+            if (group != nullptr) {
+                group->blockFailed(data.get(&UpgradeCrc_dg::block));
             }
+            mutex.unlock();
+            break;
         }
+    } // runda
+    if (fPoll) {
+        sendDatagram(groupaddr, peerPort, poll.data(), poll.size());
+    }
+    flushDatagrams();
 
-    } // główna pętla
+} // NetEngine::writeUpgradeData
 
-} // NetEngine::run
+// wysłanie datagramu lub dopisanie go do paczki
+bool NetEngine::sendDatagram(quint32 addr, quint16 port,
+                             const void *data, int size)
+{
+    bool fSent;
+#ifdef WICS_MMSG
+    if (udpBatch != nullptr) {
+        // dane dłuższe niż NET_MMSG_HEAD muszą istnieć do flushDatagrams()
+        fSent = (size > NET_MMSG_HEAD) ? udpBatch->add(addr, port, data, 0, data, size)
+                                       : udpBatch->add(addr, port, data, size);
+    }
+    else {
+        fSent = udpSocket->writeDatagram(static_cast<const char*>(data), size,
+                                         QHostAddress(addr), port) != -1;
+    }
+#else
+    fSent = udpSocket->writeDatagram(static_cast<const char*>(data), size,
+                                     QHostAddress(addr), port) != -1;
+#endif
 
-// przetwarzanie odebranego datagramu
-void NetEngine::processDatagram(quint32 addr, const QByteArray& datagram)
-{
-    const NetDatagram_dg *data =
-            reinterpret_cast<const NetDatagram_dg*>(datagram.constData());
-    if (data->header != LAN_WICS_MESSAGE) {
-        qDebug("Nieznany header: %X04 od %s", data->header,
-               QHostAddress(addr).toString().toLatin1().data());
-        qDebug("%s", datagram.toHex().constData());
+    netMetrics.add(fSent ? CountSent : CountSendError);
+    if (fSent) {
+        capture.record(CaptureOut, addr, port, thePort, data, size);
+        noteRequest(addr, data, size);
+    }
+    return fSent;
+
+} // NetEngine::sendDatagram
+
+// czas wysłania żądania, na które centralka odpowiada
+void NetEngine::noteRequest(quint32 addr, const void *data, int size)
+{
+    if (size < static_cast<int>(sizeof(NetDatagram_dg))) {
+        return;
+    }
+    NetView<NetDatagram_dg> dg(static_cast<const char*>(data));
+    if (dg.get(&NetDatagram_dg::header) != LAN_WICS_MESSAGE) {
         return;
     }
 
-    switch (data->opcode) {
-    // informacje o urządzeniu
+    quint16 opcode = dg.get(&NetDatagram_dg::opcode);
+    int l;
+    switch (opcode) {
+    case WICS_DEVINFO_GET:
+        l = LatencyDevInfo;
+        break;
+    case WICS_WIFISTA_GET:
+        l = LatencyWiFi;
+        break;
+    case WICS_PAGEHASH_GET:
+        l = LatencyPageHash;
+        break;
+    default:
+        // start i bloki aktualizacji: próbki z NetSession::sampleAck()
+        return;
+    } // switch opcode
+
+    qint64 now = clock.nsecsElapsed() / 1000;
+    requestAt.insert((static_cast<quint64>(addr) << 16) | opcode, now);
+    requestAny[l] = now;
+
+} // NetEngine::noteRequest
+
+// opóźnienie odpowiedzi od żądania do tego adresu lub, gdy go nie było,
+// od ostatniego żądania rozgłoszeniowego
+void NetEngine::noteReply(quint32 addr, quint16 opcode)
+{
+    quint16 request;
+    NetLatency l;
+    switch (opcode) {
     case WICS_DEVINFO:
-        emitDevInfo(QHostAddress(addr).toString(),
-                    reinterpret_cast<const DeviceInfo_dg*>(datagram.constData()));
-        targetAddr = addr;
-        sendWiFiStaReq();
+        request = WICS_DEVINFO_GET;
+        l = LatencyDevInfo;
         break;
-    // informacje o podłączeniu do sieci
     case WICS_WIFISTA:
-        if (addr == targetAddr) {
-            emitWiFiSta(reinterpret_cast<const WiFiStation_dg*>
-                        (datagram.constData()));
-        }
+        request = WICS_WIFISTA_GET;
+        l = LatencyWiFi;
+        break;
+    case WICS_PAGEHASH:
+        request = WICS_PAGEHASH_GET;
+        l = LatencyPageHash;
         break;
-    // stan aktualizacji
-    case WICS_UPGRADE:
-        if (addr == targetAddr) {
-            emitUpgradeStep(reinterpret_cast<const UpgradeState_dg*>
-                            (datagram.constData()));
+    default:
+        return;
+    } // switch opcode
+
+    qint64 now = clock.nsecsElapsed() / 1000;
+    qint64 sent = requestAt.take((static_cast<quint64>(addr) << 16) | request);
+    if ((sent == 0) && (requestAny[l] > 0)
+        && (now - requestAny[l] < DEF_TOUT_DGRAM * 1000)) {
+        sent = requestAny[l];
+    }
+    if (sent > 0) {
+        netMetrics.record(l, now - sent);
+    }
+
+} // NetEngine::noteReply
+
+// wysłanie zebranej paczki datagramów
+void NetEngine::flushDatagrams()
+{
+#ifdef WICS_MMSG
+    if ((udpBatch != nullptr) && (udpBatch->pending() > 0)
+        && (udpBatch->flush() < 0)) {
+        netMetrics.add(CountSendError);
+    }
+#endif
+}
+
+// wysłanie nagłówka i fragmentu zmapowanego pliku jednym datagramem
+bool NetEngine::sendUpgradeBlock(quint32 addr, const void *head, int hsize,
+                                 const uchar* payload, qint64 psize)
+{
+    bool fSent;
+    capture.record(CaptureOut, addr, peerPort, thePort, head, hsize,
+                   payload, static_cast<int>(psize));
+#ifdef WICS_MMSG
+    if (udpBatch != nullptr) {
+        fSent = udpBatch->add(addr, peerPort, head, hsize,
+                              payload, static_cast<int>(psize));
+        netMetrics.add(fSent ? CountSent : CountSendError);
+        return fSent;
+    }
+#endif
+#ifdef Q_OS_UNIX
+    struct sockaddr_in dest;
+    memset(&dest, 0, sizeof(dest));
+    dest.sin_family = AF_INET;
+    dest.sin_port = htons(peerPort);
+    dest.sin_addr.s_addr = htonl(addr);
+
+    struct iovec iov[2];
+    iov[0].iov_base = const_cast<void*>(head);
+    iov[0].iov_len  = static_cast<size_t>(hsize);
+    iov[1].iov_base = const_cast<uchar*>(payload);
+    iov[1].iov_len  = static_cast<size_t>(psize);
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name    = &dest;
+    msg.msg_namelen = sizeof(dest);
+    msg.msg_iov     = iov;
+    msg.msg_iovlen  = (psize > 0) ? 2 : 1;
+
+    fSent = ::sendmsg(static_cast<int>(udpSocket->socketDescriptor()),
+                      &msg, 0) != -1;
+#else
+    // brak sendmsg: złożenie datagramu w stałym buforze
+    memcpy(imageData.data(), head, static_cast<size_t>(hsize));
+    memcpy(imageData.data() + hsize, payload, static_cast<size_t>(psize));
+    fSent = udpSocket->writeDatagram(imageData.constData(), hsize + psize,
+                                     QHostAddress(addr), peerPort) != -1;
+#endif
+    netMetrics.add(fSent ? CountSent : CountSendError);
+    return fSent;
+
+} // NetEngine::sendUpgradeBlock
+
+// odbiór pakietów
+void NetEngine::readDatagrams()
+{
+#ifdef WICS_MMSG
+    if (udpBatch != nullptr) {
+        int count;
+        while ((count = udpBatch->receive()) > 0) {
+            for (int cnt = 0; cnt < count; cnt++) {
+                if (udpBatch->truncated(cnt)) {
+                    netMetrics.add(CountReceived);
+                    netMetrics.add(CountBadLength);
+                    capture.record(CaptureIn, udpBatch->sender(cnt),
+                                   udpBatch->senderPort(cnt), thePort,
+                                   udpBatch->data(cnt), udpBatch->size(cnt));
+                    continue;
+                }
+                processDatagram(udpBatch->sender(cnt), udpBatch->senderPort(cnt),
+                                QByteArray::fromRawData(udpBatch->data(cnt),
+                                                        udpBatch->size(cnt)));
+            }
         }
-        else {
-            qDebug("Upgrade od %s",
-                   QHostAddress(addr).toString().toLatin1().data());
+        // polecenia jazdy klientów bramki z całej paczki
+        writeDrives();
+        flushDatagrams();
+        return;
+    }
+#endif
+
+    qint64     bytes;
+    QByteArray datagram;
+
+    while (udpSocket->hasPendingDatagrams()) {
+        quint16      senderPort;
+        QHostAddress senderAddr;
+        bytes = udpSocket->pendingDatagramSize();
+        datagram.resize(static_cast<int>(bytes));
+        if (-1 != udpSocket->readDatagram(datagram.data(), datagram.size(),
+                                          &senderAddr, &senderPort)) {
+            processDatagram(senderAddr.toIPv4Address(), senderPort, datagram);
         }
+    }
+    writeDrives();
+
+} // NetEngine::readDatagrams
+
+// obsługa datagramów odbieranych przez program, według opcode
+const NetHandler<NetEngine> NetEngine::handlers[] = {
+    netHandler<NetEngine, WICS_DEVINFO, &NetEngine::updateDevice>(),
+    netHandler<NetEngine, WICS_WIFISTA, &NetEngine::updateWiFi>(),
+    netHandler<NetEngine, WICS_UPGRADE, &NetEngine::emitUpgradeStep>(),
+    netHandler<NetEngine, WICS_PAGEHASH, &NetEngine::updatePageHash>(),
+    netHandler<NetEngine, WICS_HEARTBEAT, &NetEngine::updateHeartbeat>(),
+    netHandler<NetEngine, WICS_UPGRADE_NACK, &NetEngine::updateGroupNack>()
+};
+
+// przetwarzanie odebranego datagramu
+void NetEngine::processDatagram(quint32 addr, quint16 port,
+                                const QByteArray& datagram)
+{
+    netMetrics.add(CountReceived);
+    capture.record(CaptureIn, addr, port, thePort,
+                   datagram.constData(), datagram.size());
+
+    // komunikaty Z21 klientów i centralek obsługuje bramka
+    if ((datagram.size() >= 4) && (qFromLittleEndian<quint16>(
+            datagram.constData() + 2) != LAN_WICS_MESSAGE)) {
+        routeZ21(addr, port, datagram);
+        return;
+    }
+
+    // błędne datagramy: liczniki, treść w zapisie pcap (setCapture)
+    switch (netDispatch(handlers, *this, addr, datagram.constData(),
+                        datagram.size())) {
+    case DecodeOk:
+        noteReply(addr, qFromLittleEndian<quint16>(datagram.constData() + 4));
         break;
-    // nie rozpoznany datagram
-    default:
-        qDebug("Nieznany opcode: %X04 od %s\n%s", data->opcode,
-               QHostAddress(addr).toString().toLatin1().data(),
-               datagram.toHex().data());
+    case DecodeShort:
+    case DecodeHeader:
+        netMetrics.add(CountBadHeader);
+        break;
+    case DecodeLength:
+        netMetrics.add(CountBadLength);
+        break;
+    case DecodeOpcode:
+        netMetrics.add(CountBadOpcode);
         break;
-    } // switch data.header
+    } // switch netDispatch
 
 } // NetEngine::processDatagram
 
-void NetEngine::emitDevInfo(QString addr, const DeviceInfo_dg* data)
-{
-    QStringList citems;
-    citems << addr
-           << QString("%1.%2")
-                .arg(data->hwVersion / 100)
-                .arg(data->hwVersion % 100)
-           << QString("%1.%2.%3")
-                .arg((data->swVersion >> 24) & 0xFF)
-                .arg((data->swVersion >> 16) & 0xFF)
-                .arg(data->swVersion & 0xFFFF)
-           << QString("%1.%2.%3")
-                .arg((data->fwVersion >> 24) & 0xFF)
-                .arg((data->fwVersion >> 16) & 0xFF)
-                .arg(data->fwVersion & 0xFFFF)
-           << QString("%1")
-                .arg(data->serialNum, 8, 16, QChar('0'));
-    emit configinfo(WICS_DEVINFO, citems.join(";"));
-} // NetEngine::emitDevInfo
-
-void NetEngine::emitWiFiSta(const WiFiStation_dg* data)
-{
-    QStringList citems;
-    citems << QString(data->ssid)
-           << QString(data->pass);
-    emit configinfo(WICS_WIFISTA, citems.join(";"));
+// przekazanie komunikatów Z21 przez bramkę
+void NetEngine::routeZ21(quint32 addr, quint16 port, const QByteArray& datagram)
+{
+    NetGateway::Packets out;
+
+    mutex.lock();
+    bool fActive = gateway.isActive();
+    bool fValid = fActive
+                  && gateway.route(addr, port, datagram.constData(), datagram.size(),
+                                   QDateTime::currentMSecsSinceEpoch(), out);
+    mutex.unlock();
+
+    if (!fActive) {
+        netMetrics.add(CountBadHeader);
+        return;
+    }
+    if (!fValid) {
+        // treść w zapisie pcap (setCapture)
+        netMetrics.add(CountBadLength);
+    }
+
+    for (int cnt = 0; cnt < out.count(); cnt++) {
+        const NetGateway::Packet& p = out.at(cnt);
+        if (NetDrive::isDrive(p.data.constData(), p.data.size())) {
+            // wysyłane po odbiorze wszystkich oczekujących datagramów
+            queueDrive(p.addr, p.port, p.data.constData(), p.data.size());
+        }
+        else {
+            NetDrive::Command c;
+            quint16 loco;
+            // zapytanie o lokomotywę po jej oczekującym poleceniu jazdy,
+            // inaczej centralka i pamięć bramki podają stan sprzed niego
+            if (NetDrive::isLocoQuery(p.data.constData(), p.data.size(), loco)
+                && drives.take(p.addr, loco, c)) {
+                sendDatagram(c.addr, c.port, c.data, Z21_SET_LOCO_SIZE);
+            }
+            sendDatagram(p.addr, p.port, p.data.constData(), p.data.size());
+        }
+    }
+    // out zawiera dane wskazywane przez paczkę sendmmsg
+    flushDatagrams();
+
+} // NetEngine::routeZ21
+
+// aktualizacja tablicy znalezionych centralek; ta sama centralka
+// odpowiadająca z kilku adresów zajmuje jeden wpis
+void NetEngine::updateDevice(quint32 addr, const NetView<DeviceInfo_dg>& data)
+{
+    DeviceInfo info(addr, data, QDateTime::currentMSecsSinceEpoch());
+
+    mutex.lock();
+    devices.insert(info.serialNum, info);
+    mutex.unlock();
+    emit configinfo(info);
+
+} // NetEngine::updateDevice
+
+// konfiguracja WiFi odczytana z centralki
+void NetEngine::updateWiFi(quint32 addr, const NetView<WiFiStation_dg>& data)
+{
+    WiFiStation sta(addr, data);
+
+    mutex.lock();
+    if (!sessions.contains(addr)) {
+        // odpowiedź bez żądania
+        mutex.unlock();
+        return;
+    }
+    session(addr)->setWiFi(sta);
+    session(addr)->heard(clock.elapsed());
+    mutex.unlock();
+    emit configinfo(sta);
+
+} // NetEngine::updateWiFi
+
+// kopia tablicy znalezionych centralek
+QList<DeviceInfo> NetEngine::deviceList()
+{
+    QMutexLocker locker(&mutex);
+    return devices.values();
 }
 
-void NetEngine::emitUpgradeStep(const UpgradeState_dg* data)
+bool NetEngine::hasSession(quint32 addr)
 {
-    emit upgradestep(data->block, data->result);
+    QMutexLocker locker(&mutex);
+    return sessions.contains(addr);
 }
 
+// sesja centralki, tworzona przy pierwszym użyciu; wymaga blokady mutex
+NetSession* NetEngine::session(quint32 addr)
+{
+    NetSession *s = sessions.value(addr, nullptr);
+    if (s == nullptr) {
+        s = new NetSession(addr);
+        sessions.insert(addr, s);
+    }
+    return s;
+}
+
+void NetEngine::emitUpgradeStep(quint32 addr, const NetView<UpgradeState_dg>& data)
+{
+    quint16 block = data.get(&UpgradeState_dg::block);
+    quint16 result = data.get(&UpgradeState_dg::result);
+
+    int steps = 0;
+    int resumed = 0;
+    int module = 0;
+
+    // próbka RTT w chwili odbioru, przed kolejką do wątku GUI
+    mutex.lock();
+    NetSession *s = sessions.value(addr, nullptr);
+    if (s != nullptr) {
+        s->heard(clock.elapsed());
+    }
+    if ((group != nullptr) && group->isJoining(addr)
+        && ((block == 0) || (result != RESULT_OK))) {
+        // potwierdzenie startu aktualizacji grupowej
+        NetGroup::Events events;
+        QList<quint32> inits;
+        NetFrame<UpgradeInitDigest_dg> init(WICS_UPGRADE_START);
+        int bsize = (data.bytes() >= static_cast<int>(sizeof(UpgradeStateSize_dg)))
+                    ? data.as<UpgradeStateSize_dg>().get(&UpgradeStateSize_dg::bsize)
+                    : 0;
+        group->join(addr, result, bsize, clock.elapsed(), inits, events);
+        if (!inits.isEmpty()) {
+            // mniejszy rozmiar bloku przyjęty przez inną centralkę
+            group->initFrame(init);
+            group->initSent(clock.elapsed());
+        }
+        int blocks = group->blocks();
+        mutex.unlock();
+
+        for (int cnt = 0; cnt < inits.count(); cnt++) {
+            sendDatagram(inits.at(cnt), peerPort, init.data(), init.size());
+        }
+        flushDatagrams();
+        emitGroupEvents(events, blocks);
+        writeUpgradeData();
+        armRetransmit();
+        return;
+    }
+    if ((s != nullptr) && (block == 0) && (result == RESULT_OK)
+        && (data.bytes() >= static_cast<int>(sizeof(UpgradeStateSize_dg)))) {
+        // rozmiar bloku przyjęty przez centralkę
+        steps = s->acceptBlockSize(
+                    data.as<UpgradeStateSize_dg>().get(&UpgradeStateSize_dg::bsize));
+        if (steps < 0) {
+            result = RESULT_BSIZE;
+        }
+    }
+    if ((s != nullptr) && (block == 0) && (result == RESULT_OK) && s->resuming()) {
+        // centralka bez wznowienia potwierdza start krótszym datagramem
+        resumed = s->acceptResume(
+                    (data.bytes() >= static_cast<int>(sizeof(UpgradeStateResume_dg)))
+                    ? data.as<UpgradeStateResume_dg>().get(&UpgradeStateResume_dg::resume)
+                    : 0);
+    }
+    if (s != nullptr) {
+        if (result == RESULT_OK) {
+            int r = s->sampleAck(block, clock.elapsed());
+            if (r >= 0) {
+                netMetrics.record((block == 0) ? LatencyUpgradeStart
+                                               : LatencyUpgradeData, r * 1000);
+            }
+            else if (r == -2) {
+                netMetrics.add(CountAckDuplicate);
+            }
+        }
+        else {
+            // błąd centralki kończy aktualizację i ponowienia
+            module = s->module();
+            s->stopUpgrade();
+        }
+    }
+    mutex.unlock();
+
+    if (module != 0) {
+        // przerwany obraz nie nadaje się do wznowienia
+        journal.remove(addr, module);
+    }
+
+    if (s == nullptr) {
+        qDebug("Upgrade od %s", QHostAddress(addr).toString().toLatin1().data());
+        return;
+    }
+    if (steps > 0) {
+        emit upgradeinit(addr, steps);
+    }
+    if (resumed > 0) {
+        // potwierdzenie startu jak potwierdzenie bloków 1..resumed
+        qDebug("Resume upgrade: %s po bloku %d",
+               QHostAddress(addr).toString().toLatin1().data(), resumed);
+        block = static_cast<quint16>(resumed);
+    }
+    if (result != RESULT_OK) {
+        progressAt.remove(addr);
+        emit upgradestep(addr, block, result);
+        return;
+    }
+
+    // przesunięcie okna i następne bloki od razu, w wątku sieciowym
+    bool fDone = false;
+    if (!ackBlocks(addr, block, fDone)) {
+        return;
+    }
+    writeUpgradeData();
+    armRetransmit();
+
+    // postęp dla GUI nie częściej niż co DEF_TOUT_PROGRESS
+    qint64 now = clock.elapsed();
+    if (fDone || (block == 0) || (now - progressAt.value(addr, 0) >= DEF_TOUT_PROGRESS)) {
+        progressAt.insert(addr, now);
+        emit upgradestep(addr, block, result);
+    }
+    if (fDone) {
+        progressAt.remove(addr);
+    }
+
+} // NetEngine::emitUpgradeStep
+
+// zmiany stanu centralek aktualizacji grupowej; postęp dla GUI nie
+// częściej niż co DEF_TOUT_PROGRESS, zakończona grupa usuwana
+void NetEngine::emitGroupEvents(const NetGroup::Events& events, int blocks)
+{
+    qint64 now = clock.elapsed();
+
+    for (int cnt = 0; cnt < events.count(); cnt++) {
+        const NetGroup::Event& e = events.at(cnt);
+        if (e.noAnswer) {
+            progressAt.remove(e.addr);
+            netMetrics.add(CountNoAnswer);
+            emit noanswer(e.addr);
+            continue;
+        }
+        if (e.steps > 0) {
+            emit upgradeinit(e.addr, e.steps);
+        }
+        bool fEnd = (e.result != RESULT_OK) || (e.block >= blocks);
+        if (fEnd || (e.block == 0)
+            || (now - progressAt.value(e.addr, 0) >= DEF_TOUT_PROGRESS)) {
+            progressAt.insert(e.addr, now);
+            emit upgradestep(e.addr, e.block, e.result);
+        }
+        if (fEnd) {
+            progressAt.remove(e.addr);
+        }
+    }
+
+    mutex.lock();
+    if ((group != nullptr) && group->finished()) {
+        delete group;
+        group = nullptr;
+    }
+    mutex.unlock();
+
+} // NetEngine::emitGroupEvents
+
+// odpowiedź centralki na pytanie aktualizacji grupowej
+void NetEngine::updateGroupNack(quint32 addr, const NetView<UpgradeNack_dg>& data)
+{
+    NetGroup::Events events;
+    int blocks = 0;
+    qint64 now = clock.elapsed();
+
+    mutex.lock();
+    NetSession *s = sessions.value(addr, nullptr);
+    if (s != nullptr) {
+        s->heard(now);
+    }
+    if (group != nullptr) {
+        group->nack(addr, data, now, events);
+        blocks = group->blocks();
+    }
+    mutex.unlock();
+
+    emitGroupEvents(events, blocks);
+    writeUpgradeData();
+    armRetransmit();
+
+} // NetEngine::updateGroupNack
+
+// skróty stron centralki; po komplecie start aktualizacji
+void NetEngine::updatePageHash(quint32 addr, const NetView<PageHash_dg>& data)
+{
+    NetFrame<UpgradeInitResume_dg> init(WICS_UPGRADE_START);
+    bool fInit = false;
+
+    mutex.lock();
+    NetSession *s = sessions.value(addr, nullptr);
+    if (s != nullptr) {
+        s->heard(clock.elapsed());
+    }
+    if ((s != nullptr) && s->updateHash(data)) {
+        s->initFrame(init);
+        s->initSent(clock.elapsed());
+        fInit = true;
+    }
+    mutex.unlock();
+
+    if (fInit) {
+        sendDatagram(addr, peerPort, init.data(), init.size());
+        flushDatagrams();
+        armRetransmit();
+    }
+
+} // NetEngine::updatePageHash
+
+// odpowiedź centralki na heartbeat: RTT, rozrzut i utrata
+void NetEngine::updateHeartbeat(quint32 addr, const NetView<NetDatagram_dg>& data)
+{
+    int r = -1;
+    int change = 0;
+    qint64 now = clock.elapsed();
+
+    mutex.lock();
+    NetSession *s = sessions.value(addr, nullptr);
+    if (s != nullptr) {
+        r = s->heartbeatReply(data.get(&NetDatagram_dg::param), now);
+        if (beatInterval > 0) {
+            change = s->linkCheck(now, beatInterval);
+        }
+    }
+    mutex.unlock();
+
+    if (r >= 0) {
+        netMetrics.record(LatencyHeartbeat, r * 1000);
+    }
+    if (change != 0) {
+        qDebug("Link %s: %s", QHostAddress(addr).toString().toLatin1().data(),
+               (change > 0) ? "online" : "offline");
+        emit linkchanged(addr, change > 0);
+    }
+
+} // NetEngine::updateHeartbeat
+
+// otwarcie pliku firmware dla kolejnych aktualizacji
 void NetEngine::openImageFile(QString filename)
 {
-    imageFile.setFileName(filename);
-    if (imageFile.open(QIODevice::ReadOnly)) {
-        // plik z oprogramowaniem otwarty
-        emit imageopened(imageFile.fileName(), imageFile.size());
+    // koniec liczenia skrótów w wątku obrazu, sygnał do wątku odbiorcy
+    QSharedPointer<NetImage> img(new NetImage(filename, [this, filename]() {
+        emit imagedigest(filename);
+    }));
+
+    mutex.lock();
+    image = img;
+    mutex.unlock();
+
+    if (img->size() > 0) {
+        emit imageopened(img->fileName(), img->size());
     }
     else {
         // błąd otwarcia pliku
-        emit imageopened(imageFile.fileName(), 0);
+        emit imageopened(img->fileName(), 0);
     }
 
 } // NetEngine::openImageFile
 
+// wstawienie datagramu do kolejki i obudzenie wątku sieciowego
+void NetEngine::queueDatagram(quint32 addr, const void *data, int size)
+{
+    if (!outQueue.push(addr, data, size)) {
+        netMetrics.add(CountQueueFull);
+    }
+    wakeEngine();
+}
+
+// polecenie jazdy zastępujące oczekujące polecenie tej samej lokomotywy
+void NetEngine::queueDrive(quint32 addr, quint16 port, const char *data, int size)
+{
+    switch (drives.push(addr, port, data, size)) {
+    case NetDrive::DriveReplaced:
+        netMetrics.add(CountCoalesced);
+        break;
+    case NetDrive::DriveFull:
+        netMetrics.add(CountQueueFull);
+        break;
+    default:
+        break;
+    } // switch push
+}
+
+void NetEngine::wakeEngine()
+{
+    if (!outWake.exchange(true)) {
+        emit outqueued();
+    }
+}
+
+// wyszukiwanie centralek: nowe okno, tablica wypełniana odpowiedziami
+void NetEngine::findDevices(quint32 targetaddr)
+{
+    mutex.lock();
+    devices.clear();
+    mutex.unlock();
+    sendDevInfoReq(targetaddr);
+}
+
 // wysłanie żądania informacji o urządzeniu
 void NetEngine::sendDevInfoReq(quint32 targetaddr)
 {
-    static NetDatagram_dg data;
-    data.bytes = static_cast<quint16>(sizeof(NetDatagram_dg));
-    data.header = LAN_WICS_MESSAGE;
-    data.opcode = WICS_DEVINFO_GET;
-    data.param = WICS_PARAM_NONE;
+    NetFrame<NetDatagram_dg> data(WICS_DEVINFO_GET);
+    data.set(&NetDatagram_dg::param, WICS_PARAM_NONE);
+
+    queueDatagram(targetaddr, data.data(), data.size());
+
+} // NetEngine::sendDevInfoReq
+
+// jazda lokomotywy przez centralkę; oczekujące polecenie tej lokomotywy
+// jest zastępowane, więc wysyłana jest tylko najnowsza prędkość i kierunek
+void NetEngine::sendLocoDrive(quint32 targetaddr, quint16 loco, int speed,
+                              bool forward, int steps)
+{
+    char data[Z21_SET_LOCO_SIZE];
+    NetDrive::driveFrame(data, loco, speed, forward, steps);
 
-    targetAddr = targetaddr;
     mutex.lock();
-    outBuffer.insert(targetAddr, QByteArray::fromRawData
-                     (reinterpret_cast<char*>(&data), sizeof(NetDatagram_dg)));
+    quint16 port = peerPort;
     mutex.unlock();
 
-} // NetEngine::sendDevInfoReq
+    queueDrive(targetaddr, port, data, sizeof(data));
+    wakeEngine();
 
-// wysłanie żądania danych połączenia WiFi
-void NetEngine::sendWiFiStaReq()
+} // NetEngine::sendLocoDrive
+
+// funkcja lokomotywy; przełączenia wysyłane wszystkie, w kolejności
+void NetEngine::sendLocoFunction(quint32 targetaddr, quint16 loco, int function,
+                                 int action)
 {
-    static NetDatagram_dg data;
+    char data[Z21_SET_LOCO_SIZE];
+    NetDrive::functionFrame(data, loco, function, action);
+
+    queueDatagram(targetaddr, data, sizeof(data));
 
-    data.bytes = static_cast<quint16>(sizeof(NetDatagram_dg));
-    data.header = LAN_WICS_MESSAGE;
-    data.opcode = WICS_WIFISTA_GET;
-    data.param = WICS_PARAM_NONE;
+} // NetEngine::sendLocoFunction
+
+// wysłanie żądania danych połączenia WiFi
+void NetEngine::sendWiFiStaReq(quint32 targetaddr)
+{
+    NetFrame<NetDatagram_dg> data(WICS_WIFISTA_GET);
+    data.set(&NetDatagram_dg::param, WICS_PARAM_NONE);
 
     mutex.lock();
-    outBuffer.insert(targetAddr, QByteArray::fromRawData
-                     (reinterpret_cast<char*>(&data), sizeof(NetDatagram_dg)));
+    session(targetaddr);
     mutex.unlock();
 
+    queueDatagram(targetaddr, data.data(), data.size());
+
 } // NetEngine::sendWiFiStaRequest
 
 // wysłanie danych połączenia WiFi
-void NetEngine::sendWiFiSta(QString ssid, QString pass)
+void NetEngine::sendWiFiSta(quint32 targetaddr, QString ssid, QString pass)
 {
-    static WiFiStation_dg data;
-    data.bytes  = static_cast<quint16>(sizeof(WiFiStation_dg));
-    data.header = LAN_WICS_MESSAGE;
-    data.opcode = WICS_WIFISTA;
-
-    strncpy(data.ssid, ssid.toLocal8Bit().data(), MAX_WLAN_NAME);
-    strncpy(data.pass, pass.toLocal8Bit().data(), MAX_WLAN_PASS);
+    WiFiStation sta(targetaddr, ssid, pass);
+    NetFrame<WiFiStation_dg> data(WICS_WIFISTA);
+    memcpy(data.text(&WiFiStation_dg::ssid), sta.ssid, MAX_WLAN_NAME + 1);
+    memcpy(data.text(&WiFiStation_dg::pass), sta.pass, MAX_WLAN_PASS + 1);
 
     mutex.lock();
-    outBuffer.insert(targetAddr, QByteArray::fromRawData(
-                     reinterpret_cast<char*>(&data), sizeof(WiFiStation_dg)));
+    session(targetaddr)->setWiFi(sta);
     mutex.unlock();
 
+    queueDatagram(targetaddr, data.data(), data.size());
+
 } // NetEngine::sendWiFiSta
 
-// wysłanie wiadomości: start aktualizacji
-void NetEngine::sendUpgradeInit(int module)
+// MTU interfejsu, przez który widoczny jest adres addr
+int NetEngine::pathMtu(quint32 addr)
 {
-    static UpgradeInit_dg data;
-    data.bytes = static_cast<quint16>(sizeof(UpgradeInit_dg));
-    data.header = LAN_WICS_MESSAGE;
-    data.opcode = WICS_UPGRADE_START;
-    data.fwsize = static_cast<quint32>(imageFile.size());
+#if QT_VERSION >= QT_VERSION_CHECK(5, 11, 0)
+    QHostAddress host(addr);
+    QList<QNetworkInterface> ifaces = QNetworkInterface::allInterfaces();
+    for (int cnt = 0; cnt < ifaces.count(); cnt++) {
+        const QNetworkInterface& iface = ifaces.at(cnt);
+        if (!(iface.flags() & QNetworkInterface::IsUp)
+            || (iface.maximumTransmissionUnit() <= 0)) {
+            continue;
+        }
+        QList<QNetworkAddressEntry> entries = iface.addressEntries();
+        for (int e = 0; e < entries.count(); e++) {
+            if ((entries.at(e).ip().protocol() == QAbstractSocket::IPv4Protocol)
+                && host.isInSubnet(entries.at(e).ip(), entries.at(e).prefixLength())) {
+                return iface.maximumTransmissionUnit();
+            }
+        }
+    }
+#else
+    Q_UNUSED(addr)
+#endif
+    return UPG_DEF_MTU;
 
-    switch (module) {
-    case UPGRADE_WLAN:
-        data.flags = UPGRADE_WLAN;
-        imageBSize = UPG_WLAN_PAGE;
-        break;
-    case UPGRADE_DCCGEN:
-        data.flags = UPGRADE_DCCGEN;
-        imageBSize = UPG_DCCG_PAGE;
-        break;
-    default:
-        qDebug("Moduł: %d", module);
-        data.flags = 0;
-        imageBSize = 256;
-        break;
-    } // switch module
+} // NetEngine::pathMtu
+
+// wysłanie wiadomości: start aktualizacji; resume: ostatni zachowany
+// blok z resumePoint(), 0: od początku; resumeSize: rozmiar bloku wpisu
+void NetEngine::sendUpgradeInit(quint32 targetaddr, int module, int resume,
+                                int resumeSize)
+{
+    NetFrame<UpgradeInitResume_dg> data(WICS_UPGRADE_START);
+    QList<NetFrame<PageHash_dg> > hashes;
 
-    imageBlock = 0;
-    imageFlags = static_cast<quint16>(module);
-    emit upgradeinit(static_cast<int>((imageFile.size() / imageBSize) + 1));
     mutex.lock();
-    outBuffer.insert(targetAddr, QByteArray::fromRawData(
-                     reinterpret_cast<char*>(&data), sizeof(UpgradeInit_dg)));
+    int bsize = imageBlockMax;
     mutex.unlock();
+    if (bsize == 0) {
+        // blok mieszczący się w jednym datagramie bez fragmentacji
+        bsize = pathMtu(targetaddr) - UPG_IP_OVERHEAD
+                - static_cast<int>(sizeof(UpgradeCrc_dg));
+    }
+
+    // punkt wznowienia z resumePoint(), wywołanej przed startem
+    int from = qMax(resume, 0);
+    if (from == 0) {
+        // nowa aktualizacja zastępuje przerwaną
+        journal.remove(targetaddr, module);
+    }
+
+    mutex.lock();
+    NetSession *s = session(targetaddr);
+    int steps = s->startUpgrade(image, module, imageWindow, imageSparse, bsize,
+                                imageChecksum);
+    if (from > 0) {
+        s->resumeFrom(from, resumeSize);
+    }
+    if (s->hashPhase()) {
+        // start wysyłany po odebraniu skrótów, updatePageHash()
+        s->hashFrames(hashes, clock.elapsed());
+    }
+    else {
+        s->initFrame(data);
+        s->initSent(clock.elapsed());
+    }
+    mutex.unlock();
+
+    emit upgradeinit(targetaddr, steps);
+    if (hashes.isEmpty()) {
+        queueDatagram(targetaddr, data.data(), data.size());
+    }
+    for (int cnt = 0; cnt < hashes.count(); cnt++) {
+        queueDatagram(targetaddr, hashes.at(cnt).data(), hashes.at(cnt).size());
+    }
 
 } // NetEngine::sendUpgradeInit
 
-// wysłanie wiadomości: dane aktualizacji
-void NetEngine::sendUpgradeData()
+// aktualizacja grupowa: start do każdej centralki targets, bloki
+// do adresu groupaddr (rozgłoszeniowy lub multicast)
+void NetEngine::sendGroupUpgrade(quint32 groupaddr, QList<quint32> targets, int module)
 {
-    if (imageData.size() == 0) {
-        // wysłanie nowego bloku
-        imageData = imageFile.read(imageBSize);
-        imageBlock++;
+    NetFrame<UpgradeInitDigest_dg> data(WICS_UPGRADE_START);
+
+    mutex.lock();
+    int bsize = imageBlockMax;
+    mutex.unlock();
+    if (bsize == 0) {
+        bsize = pathMtu(groupaddr) - UPG_IP_OVERHEAD
+                - static_cast<int>(sizeof(UpgradeCrc_dg));
+    }
 
-        static UpgradeData_dg data;
-        data.bytes  = static_cast<quint16>
-                        (imageData.size()) + sizeof(UpgradeData_dg);
-        data.header = LAN_WICS_MESSAGE;
-        data.opcode = WICS_UPGRADE_DATA;
-        data.flags  = imageFlags;
-        data.block  = static_cast<quint16>(imageBlock);
+    mutex.lock();
+    if (image.isNull() || targets.isEmpty()) {
+        mutex.unlock();
+        return;
+    }
+    // nowa aktualizacja zastępuje poprzednią grupę i sesje centralek
+    delete group;
+    group = new NetGroup(groupaddr);
+    int steps = group->startUpgrade(image, module, targets,
+                                    qMax(imageWindow, DEF_GRP_ROUND), bsize,
+                                    imageChecksum);
+    group->initFrame(data);
+    group->initSent(clock.elapsed());
+    for (int cnt = 0; cnt < targets.count(); cnt++) {
+        NetSession *s = sessions.value(targets.at(cnt), nullptr);
+        if (s != nullptr) {
+            s->stopUpgrade();
+        }
+    }
+    mutex.unlock();
 
-        imageData = imageData.prepend(QByteArray::fromRawData(
-                        reinterpret_cast<char*>(&data), sizeof(UpgradeData_dg)));
+    for (int cnt = 0; cnt < targets.count(); cnt++) {
+        journal.remove(targets.at(cnt), module);
+        emit upgradeinit(targets.at(cnt), steps);
+        queueDatagram(targets.at(cnt), data.data(), data.size());
     }
 
-    qDebug("Send block: %d, %dB", imageBlock, imageData.size());
+} // NetEngine::sendGroupUpgrade
+
+// ponowienie wysłania niepotwierdzonych bloków aktualizacji
+void NetEngine::sendUpgradeData(quint32 targetaddr)
+{
     mutex.lock();
-    outBuffer.insert(targetAddr, imageData);
+    session(targetaddr)->rewind();
     mutex.unlock();
+    netMetrics.add(CountRetrans);
+    wakeEngine();
 
 } // NetEngine::sendUpgradeData
 
-void NetEngine::sendUpgradeNewData()
+// potwierdzenie bloków aktualizacji do numeru block włącznie, postęp
+// zapisywany w dzienniku do wznowienia; fDone: ostatni blok potwierdzony
+bool NetEngine::ackBlocks(quint32 addr, quint16 block, bool& fDone)
+{
+    NetJournal::Entry entry;
+    qint64 now = clock.elapsed();
+
+    mutex.lock();
+    NetSession *s = sessions.value(addr, nullptr);
+    if (s == nullptr) {
+        mutex.unlock();
+        return false;
+    }
+    QSharedPointer<NetImage> img = s->upgradeImage();
+    int module = s->module();
+    bool fAck = s->ackBlock(block, now);
+    fDone = !s->upgradeActive();
+    entry.bsize = s->blockSize();
+    mutex.unlock();
+
+    if (!fAck || img.isNull()) {
+        return false;
+    }
+    if (fDone) {
+        journal.remove(addr, module);
+    }
+    else if ((block > 0) && img->hasDigest()) {
+        entry.sha256 = QByteArray(reinterpret_cast<const char*>(img->sha256()),
+                                  UPG_SHA256_SIZE);
+        entry.size = img->size();
+        entry.block = block;
+        journal.update(addr, module, entry);
+    }
+    return true;
+
+} // NetEngine::ackBlocks
+
+// ostatni potwierdzony blok przerwanej aktualizacji otwartego obrazu,
+// 0: brak wpisu w dzienniku lub inny obraz, -1: wpis jest, a skrót obrazu
+// jeszcze nie obliczony (bez czekania, koniec sygnalizuje imagedigest())
+int NetEngine::resumePoint(quint32 targetaddr, int module, NetJournal::Entry *entry)
+{
+    NetJournal::Entry e;
+
+    mutex.lock();
+    QSharedPointer<NetImage> img = image;
+    mutex.unlock();
+
+    if (img.isNull() || !journal.find(targetaddr, module, e)) {
+        return 0;
+    }
+    if (!img->hasDigest()) {
+        return -1;
+    }
+    if ((e.size != img->size())
+        || (memcmp(e.sha256.constData(), img->sha256(), UPG_SHA256_SIZE) != 0)) {
+        return 0;
+    }
+    if (entry != nullptr) {
+        *entry = e;
+    }
+    return e.block;
+
+} // NetEngine::resumePoint
+
+// plik dziennika aktualizacji, odczytywany od razu
+void NetEngine::setJournal(QString filename)
+{
+    journal.open(filename);
+    journalTimer->start(DEF_TOUT_JOURNAL);
+}
+
+// zaległe zmiany dziennika do pliku, zegar w wątku GUI
+void NetEngine::flushJournal()
+{
+    journal.flush();
+}
+
+// okres heartbeat centralek z otwartą sesją [ms]; 0 wyłącza
+void NetEngine::setHeartbeat(int interval)
+{
+    mutex.lock();
+    beatInterval = qMax(interval, 0);
+    mutex.unlock();
+    emit heartbeatset();
+}
+
+// stan łącza z centralką według heartbeat
+NetLink NetEngine::linkInfo(quint32 targetaddr)
+{
+    QMutexLocker locker(&mutex);
+    NetSession *s = sessions.value(targetaddr, nullptr);
+    if (s == nullptr) {
+        NetLink l;
+        l.online = false;
+        l.rtt = -1;
+        l.jitter = 0;
+        l.loss = 0;
+        return l;
+    }
+    return s->link();
+}
+
+// liczba bloków wysyłanych bez oczekiwania na potwierdzenie
+void NetEngine::setUpgradeWindow(int window)
+{
+    mutex.lock();
+    imageWindow = qMax(window, 1);
+    mutex.unlock();
+}
+
+// maks. rozmiar bloku aktualizacji; 0: według MTU interfejsu,
+// rozmiar strony modułu wyłącza negocjację
+void NetEngine::setUpgradeBlock(int bsize)
+{
+    mutex.lock();
+    imageBlockMax = qMax(bsize, 0);
+    mutex.unlock();
+}
+
+// zerowanie liczników i histogramów
+void NetEngine::resetMetrics()
+{
+    netMetrics.reset();
+}
+
+// zapis datagramów do pliku pcap; pusta nazwa kończy zapis
+void NetEngine::setCapture(QString filename)
+{
+    if (filename.isEmpty()) {
+        capture.close();
+    }
+    else {
+        capture.open(filename);
+    }
+}
+
+// CRC32C bloków aktualizacji i skróty obrazu w starcie
+void NetEngine::setUpgradeChecksum(bool checksum)
+{
+    mutex.lock();
+    imageChecksum = checksum;
+    mutex.unlock();
+}
+
+// aktualizacja tylko stron różniących się od zapisanych w centralce
+void NetEngine::setUpgradeSparse(bool sparse)
+{
+    mutex.lock();
+    imageSparse = sparse;
+    mutex.unlock();
+}
+
+// zakończenie sesji z centralką
+void NetEngine::closeSession(quint32 targetaddr)
+{
+    mutex.lock();
+    NetSession *s = sessions.take(targetaddr);
+    mutex.unlock();
+    delete s;
+}
+
+// centralka obsługująca klientów Z21 bramki
+void NetEngine::addGatewayStation(quint32 targetaddr)
 {
-    imageData.clear();
-    sendUpgradeData();
+    mutex.lock();
+    gateway.addStation(targetaddr);
+    mutex.unlock();
 }
 
+void NetEngine::removeGatewayStation(quint32 targetaddr)
+{
+    NetGateway::Packets out;
+
+    mutex.lock();
+    gateway.removeStation(targetaddr, out);
+    mutex.unlock();
+
+    // nowe flagi rozgłoszeń dla pozostałych centralek
+    for (int cnt = 0; cnt < out.count(); cnt++) {
+        queueDatagram(out.at(cnt).addr, out.at(cnt).data.constData(),
+                      out.at(cnt).data.size());
+    }
+
+} // NetEngine::removeGatewayStation
+
 // EOF netengine.cpp
@@ -15,56 +15,158 @@
 
 #include <QThread>
 #include <QMutex>
-#include <QMultiHash>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QHash>
+#include <QSharedPointer>
+#include <QScopedPointer>
+#include <QSocketNotifier>
 #include <QtNetwork/QUdpSocket>
-#include <QFile>
 
 #include "datagrams.h"
+#include "netcapture.h"
+#include "netcodec.h"
+#include "netqueue.h"
+#include "netdevice.h"
+#include "netdrive.h"
+#include "netgateway.h"
+#include "netgroup.h"
+#include "netimage.h"
+#include "netjournal.h"
+#include "netmetrics.h"
+#include "netmmsg.h"
+#include "netsession.h"
 
 class NetEngine : public QThread
 {
     Q_OBJECT
 
 private:
-    quint16 thePort;
+    quint16 thePort;            // port lokalny
+    quint16 peerPort;           // port UDP centralek
     QMutex mutex;
-    QMultiHash<quint32, QByteArray> outBuffer;
-    quint32     targetAddr;     // adres docelowy
-    QFile       imageFile;      // plik firmware
-    QByteArray  imageData;      // blok danych firmware
-    quint16     imageBSize;     // rozmiar bloku danych
-    int         imageBlock;     // numer bieżącego bloku
-    quint16     imageFlags;
+    QUdpSocket *udpSocket;      // gniazdo wątku sieciowego
+#ifdef WICS_MMSG
+    NetMmsg    *udpBatch;       // gniazdo sendmmsg/recvmmsg (Linux)
+#endif
+    NetQueue    outQueue;       // kolejka datagramów wychodzących
+    NetDrive    drives;         // polecenia jazdy, najnowsze na lokomotywę
+    std::atomic<bool> outWake;  // wątek sieciowy powiadomiony
+    QHash<quint32, NetSession*> sessions;   // sesje według adresu
+    NetGroup   *group;          // aktualizacja grupowa, nullptr: brak
+    QHash<quint32, DeviceInfo>  devices;    // znalezione według serialNum
+    QSharedPointer<NetImage> image;         // ostatnio otwarty firmware
+    QByteArray  imageData;      // bufor bloku (platformy bez sendmsg)
+    int         imageWindow;    // maks. liczba niepotwierdzonych bloków
+    bool        imageSparse;    // tylko strony różniące się skrótem
+    bool        imageChecksum;  // CRC32C bloków i skróty obrazu
+    int         imageBlockMax;  // maks. rozmiar bloku, 0: według MTU
+    NetGateway  gateway;        // bramka Z21 dla klientów centralek
+    QElapsedTimer clock;        // czas monotoniczny sesji [ms]
+    QTimer     *rtoTimer;       // ponowienia, w wątku sieciowym
+    QTimer     *journalTimer;   // zapis dziennika, w wątku GUI
+    int         beatInterval;   // okres heartbeat [ms], 0: wyłączony
+    NetMetrics  netMetrics;     // liczniki i histogramy opóźnień
+    NetCapture  capture;        // zapis datagramów do pliku pcap
+    NetJournal  journal;        // postęp aktualizacji do wznowienia
+    QHash<quint64, qint64> requestAt;   // czas żądania według adresu
+                                        // i opcode [us], wątek sieciowy
+    qint64      requestAny[LatencyMax]; // ostatnie żądanie, także
+                                        // rozgłoszeniowe [us]
+    QHash<quint32, qint64> progressAt;  // ostatni upgradestep według
+                                        // adresu [ms], wątek sieciowy
 
 protected:
     void run();
 protected:
-    void processDatagram(quint32 addr, const QByteArray& datagram);
-    void emitUpgradeStep(const UpgradeState_dg* data);
-    void emitWiFiSta(const WiFiStation_dg* data);
-    void emitDevInfo(QString addr, const DeviceInfo_dg* data);
+    void writeDatagrams();
+    void writeUpgradeData();
+    void writeDrives();
+    void retransmit();
+    void heartbeat();
+    void armRetransmit();
+    bool sendDatagram(quint32 addr, quint16 port, const void *data, int size);
+    void flushDatagrams();
+    void noteRequest(quint32 addr, const void *data, int size);
+    void noteReply(quint32 addr, quint16 opcode);
+    bool ackBlocks(quint32 addr, quint16 block, bool& fDone);
+    bool sendUpgradeBlock(quint32 addr, const void *head, int hsize,
+                          const uchar* payload, qint64 psize);
+    void processDatagram(quint32 addr, quint16 port, const QByteArray& datagram);
+    void routeZ21(quint32 addr, quint16 port, const QByteArray& datagram);
+    void queueDatagram(quint32 addr, const void *data, int size);
+    void queueDrive(quint32 addr, quint16 port, const char *data, int size);
+    void wakeEngine();
+    NetSession* session(quint32 addr);
+    bool hasSession(quint32 addr);
+    void updateDevice(quint32 addr, const NetView<DeviceInfo_dg>& data);
+    void updateWiFi(quint32 addr, const NetView<WiFiStation_dg>& data);
+    void emitUpgradeStep(quint32 addr, const NetView<UpgradeState_dg>& data);
+    void emitGroupEvents(const NetGroup::Events& events, int blocks);
+    void updateGroupNack(quint32 addr, const NetView<UpgradeNack_dg>& data);
+    void updatePageHash(quint32 addr, const NetView<PageHash_dg>& data);
+    void updateHeartbeat(quint32 addr, const NetView<NetDatagram_dg>& data);
+
+    static int pathMtu(quint32 addr);
+
+    static const NetHandler<NetEngine> handlers[];
 
 public:
     explicit NetEngine(QObject *parent = nullptr);
     ~NetEngine();
 
+    QList<DeviceInfo> deviceList();
+    const NetMetrics& metrics() const { return netMetrics; }
+    bool capturing() const { return capture.active(); }
+    int resumePoint(quint32 targetaddr, int module,
+                    NetJournal::Entry *entry = nullptr);
+    QJsonObject metricsJson() const { return netMetrics.toJson(); }
+    NetLink linkInfo(quint32 targetaddr);
+
 signals:
     void connected(const quint16 port);
-    void configinfo(quint16 opcode, QString data);
+    void configinfo(const DeviceInfo& info);
+    void configinfo(const WiFiStation& sta);
     void imageopened(QString iname, qint64 isize);
-    void upgradeinit(int steps);
-    void upgradestep(quint16 block, quint16 result);
+    void imagedigest(QString iname);
+    void upgradeinit(quint32 addr, int steps);
+    void upgradestep(quint32 addr, quint16 block, quint16 result);
+    void noanswer(quint32 addr);
+    void outqueued();
+    void heartbeatset();
+    void linkchanged(quint32 addr, bool online);
 
 public slots:
-    void openSocket(quint16 theport);
+    void openSocket(quint16 theport, quint16 peerport = 0);
     void closeSocket();
+    void findDevices(quint32 targetaddr);
     void sendDevInfoReq(quint32 targetaddr);
-    void sendWiFiStaReq();
-    void sendWiFiSta(QString ssid, QString pass);
-    void sendUpgradeInit(int module);
-    void sendUpgradeData();
-    void sendUpgradeNewData();
+    void sendWiFiStaReq(quint32 targetaddr);
+    void sendWiFiSta(quint32 targetaddr, QString ssid, QString pass);
+    void sendLocoDrive(quint32 targetaddr, quint16 loco, int speed, bool forward,
+                       int steps = 128);
+    void sendLocoFunction(quint32 targetaddr, quint16 loco, int function,
+                          int action);
+    void sendUpgradeInit(quint32 targetaddr, int module, int resume = 0,
+                         int resumeSize = 0);
+    void sendUpgradeData(quint32 targetaddr);
+    void sendGroupUpgrade(quint32 groupaddr, QList<quint32> targets, int module);
+    void setUpgradeWindow(int window);
+    void setUpgradeSparse(bool sparse);
+    void setUpgradeChecksum(bool checksum);
+    void setUpgradeBlock(int bsize);
     void openImageFile(QString filename);
+    void closeSession(quint32 targetaddr);
+    void addGatewayStation(quint32 targetaddr);
+    void removeGatewayStation(quint32 targetaddr);
+    void resetMetrics();
+    void setCapture(QString filename);
+    void setJournal(QString filename);
+    void setHeartbeat(int interval);
+
+private slots:
+    void readDatagrams();
+    void flushJournal();
 
 }; // NetEngine
 
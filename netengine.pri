@@ -0,0 +1,47 @@
+#-------------------------------------------------
+#
+# Silnik sieciowy WiCS, wspólny dla programu z GUI i wics_cli
+#
+#-------------------------------------------------
+
+QT       += network
+
+INCLUDEPATH += $$PWD
+
+SOURCES += \
+        $$PWD/netcapture.cpp \
+        $$PWD/netdevice.cpp \
+        $$PWD/netdigest.cpp \
+        $$PWD/netdrive.cpp \
+        $$PWD/netengine.cpp \
+        $$PWD/netgateway.cpp \
+        $$PWD/netgroup.cpp \
+        $$PWD/netimage.cpp \
+        $$PWD/netjournal.cpp \
+        $$PWD/netmetrics.cpp \
+        $$PWD/netmmsg.cpp \
+        $$PWD/netqueue.cpp \
+        $$PWD/netsession.cpp
+
+HEADERS += \
+        $$PWD/datagrams.h \
+        $$PWD/netcapture.h \
+        $$PWD/netcodec.h \
+        $$PWD/netdevice.h \
+        $$PWD/netdigest.h \
+        $$PWD/netdrive.h \
+        $$PWD/netengine.h \
+        $$PWD/netgateway.h \
+        $$PWD/netgroup.h \
+        $$PWD/netimage.h \
+        $$PWD/netjournal.h \
+        $$PWD/netmetrics.h \
+        $$PWD/netmmsg.h \
+        $$PWD/netqueue.h \
+        $$PWD/netsession.h
+
+# Linux: wsadowe wysyłanie i odbiór datagramów (sendmmsg/recvmmsg),
+# włączane przez: qmake CONFIG+=wics_mmsg
+linux:wics_mmsg {
+    DEFINES += WICS_MMSG
+}
@@ -0,0 +1,528 @@
+//
+// Wireless Command Station
+//
+// Copyright 2020 Robert Nagowski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// See gpl-3.0.md file for details.
+//
+
+#include "netgateway.h"
+
+#include <QSet>
+#include <QtEndian>
+
+// odpowiedź centralki na żądanie klienta
+struct Z21Reply {
+    quint8 request;
+    quint8 db0;         // 0: dowolny pierwszy bajt danych (LAN_X)
+    quint8 reply;
+};
+
+// żądania LAN, na które centralka odpowiada jednemu klientowi
+static const Z21Reply lanReplies[] = {
+    { LAN_GET_SERIAL_NUMBER,   0, LAN_GET_SERIAL_NUMBER },
+    { LAN_GET_CODE,            0, LAN_GET_CODE },
+    { LAN_GET_HWINFO,          0, LAN_GET_HWINFO },
+    { LAN_GET_LOCOMODE,        0, LAN_GET_LOCOMODE },
+    { LAN_GET_TURNOUTMODE,     0, LAN_GET_TURNOUTMODE },
+    { LAN_RMBUS_GETDATA,       0, LAN_RMBUS_DATACHANGED },
+    { LAN_SYSTEMSTATE_GETDATA, 0, LAN_SYSTEMSTATE_DATACHANGED },
+    { LAN_RAILCOM_GETDATA,     0, LAN_RAILCOM_DATACHANGED }
+};
+
+// żądania LAN_X: X-nagłówek i DB0 żądania -> X-nagłówek odpowiedzi
+static const Z21Reply xReplies[] = {
+    { LAN_X_GET_SETTING,          0x21, LAN_X_GET_VERSION },
+    { LAN_X_GET_SETTING,          0x24, LAN_X_STATUS_CHANGED },
+    { LAN_X_GET_SETTING,          0x80, LAN_X_BC_TRACK },
+    { LAN_X_GET_SETTING,          0x81, LAN_X_BC_TRACK },
+    { LAN_X_SET_STOP,             0,    LAN_X_BC_STOPPED },
+    { LAN_X_CV_READ,              0,    LAN_X_CV_RESULT },
+    { LAN_X_CV_WRITE,             0,    LAN_X_CV_RESULT },
+    { LAN_X_TURNOUT_INFO,         0,    LAN_X_TURNOUT_INFO },
+    { LAN_X_GET_LOCO_INFO,        0xF0, LAN_X_LOCO_INFO },
+    { LAN_X_GET_FIRMWARE_VERSION, 0x0A, LAN_X_FIRMWARE_VERSION }
+};
+
+// flagi klienta, dla których komunikat centralki jest rozgłaszany
+static quint32 broadcastMask(quint8 header, quint8 xheader)
+{
+    switch (header) {
+    case LAN_X_MESSAGE:
+        switch (xheader) {
+        case LAN_X_BC_TRACK:
+        case LAN_X_BC_STOPPED:
+        case LAN_X_TURNOUT_INFO:
+        case LAN_X_LOCO_INFO:
+            return Z21_BC_BASIC;
+        default:
+            return 0;
+        }
+    case LAN_RMBUS_DATACHANGED:
+        return Z21_BC_RMBUS;
+    case LAN_SYSTEMSTATE_DATACHANGED:
+        return Z21_BC_SYSTEMSTATE;
+    case LAN_RAILCOM_DATACHANGED:
+        return Z21_BC_RAILCOM | Z21_BC_RAILCOM_ALL;
+    default:
+        if ((header >= LAN_LOCONET_Z21_RX) && (header <= LAN_LOCONET_DETECTOR)) {
+            return Z21_BC_LOCONET;
+        }
+        return 0;
+    }
+} // broadcastMask
+
+// adres lokomotywy z bajtów Adr_MSB, Adr_LSB
+static quint16 locoAddress(const char *db)
+{
+    return static_cast<quint16>(((static_cast<quint8>(db[0]) & 0x3F) << 8)
+                                | static_cast<quint8>(db[1]));
+}
+
+NetGateway::NetGateway()
+{
+    stationPort = DEF_LAN_PORTNUM;
+    lastExpire = 0;
+}
+
+void NetGateway::addStation(quint32 addr)
+{
+    if (!stations.contains(addr)) {
+        stations.append(addr);
+        stationFlags.insert(addr, 0);
+    }
+}
+
+// klienci usuniętej centralki przechodzą do pozostałych
+void NetGateway::removeStation(quint32 addr, Packets& out)
+{
+    if (!stations.removeOne(addr)) {
+        return;
+    }
+    stationFlags.remove(addr);
+    QMutableHashIterator<quint64, State> s(states);
+    while (s.hasNext()) {
+        s.next();
+        if ((s.key() >> 24) == addr) {
+            s.remove();
+        }
+    }
+
+    QMutableHashIterator<quint64, Client> i(clients);
+    while (i.hasNext()) {
+        i.next();
+        if (i.value().station != addr) {
+            continue;
+        }
+        if (stations.isEmpty()) {
+            i.remove();
+        }
+        else {
+            i.value().station = assignStation();
+        }
+    }
+    for (int cnt = pending.count() - 1; cnt >= 0; cnt--) {
+        if (pending.at(cnt).station == addr) {
+            pending.removeAt(cnt);
+        }
+    }
+    for (int cnt = 0; cnt < stations.count(); cnt++) {
+        updateFlags(stations.at(cnt), out);
+    }
+
+} // NetGateway::removeStation
+
+// centralka z najmniejszą liczbą klientów
+quint32 NetGateway::assignStation() const
+{
+    QHash<quint32, int> load;
+    for (int cnt = 0; cnt < stations.count(); cnt++) {
+        load.insert(stations.at(cnt), 0);
+    }
+    QHashIterator<quint64, Client> i(clients);
+    while (i.hasNext()) {
+        i.next();
+        load[i.value().station]++;
+    }
+
+    quint32 best = stations.first();
+    for (int cnt = 1; cnt < stations.count(); cnt++) {
+        if (load.value(stations.at(cnt)) < load.value(best)) {
+            best = stations.at(cnt);
+        }
+    }
+    return best;
+
+} // NetGateway::assignStation
+
+// datagram może zawierać kilka komunikatów Z21, każdy z własną długością
+bool NetGateway::route(quint32 addr, quint16 port, const char *data, int size,
+                       qint64 now, Packets& out)
+{
+    bool fStation = isStation(addr) && (port == stationPort);
+    bool fValid = true;
+
+    while (size >= 4) {
+        int bytes = qFromLittleEndian<quint16>(data);
+        if ((bytes < 4) || (bytes > size)) {
+            fValid = false;
+            break;
+        }
+        if (fStation) {
+            fromStation(addr, data, bytes, now, out);
+        }
+        else {
+            fromClient(addr, port, data, bytes, now, out);
+        }
+        data += bytes;
+        size -= bytes;
+    } // while
+
+    if (now - lastExpire >= 1000) {
+        expire(now, out);
+    }
+    return fValid;
+
+} // NetGateway::route
+
+// komunikat klienta: obsługa w bramce lub przekazanie do centralki
+void NetGateway::fromClient(quint32 addr, quint16 port, const char *msg,
+                            int size, qint64 now, Packets& out)
+{
+    quint64 key = clientKey(addr, port);
+    quint8 header = static_cast<quint8>(qFromLittleEndian<quint16>(msg + 2));
+
+    if (header == LAN_LOGOFF) {
+        if (clients.contains(key)) {
+            quint32 station = clients.value(key).station;
+            dropClient(key);
+            updateFlags(station, out);
+        }
+        return;
+    }
+
+    if (!clients.contains(key)) {
+        Client c;
+        c.addr = addr;
+        c.port = port;
+        c.station = assignStation();
+        c.flags = 0;
+        clients.insert(key, c);
+    }
+    Client& client = clients[key];
+    client.lastSeen = now;
+
+    switch (header) {
+    case LAN_SET_BROADCASTFLAGS:
+        if (size >= 8) {
+            client.flags = qFromLittleEndian<quint32>(msg + 4);
+            updateFlags(client.station, out);
+        }
+        return;
+    case LAN_GET_BROADCASTFLAGS: {
+        char reply[8];
+        qToLittleEndian<quint16>(sizeof(reply), reply);
+        qToLittleEndian<quint16>(LAN_GET_BROADCASTFLAGS, reply + 2);
+        qToLittleEndian<quint32>(client.flags, reply + 4);
+        send(out, addr, port, QByteArray(reply, sizeof(reply)));
+        return;
+    }
+    case LAN_X_MESSAGE:
+        if (size >= 5) {
+            quint8 xheader = static_cast<quint8>(msg[4]);
+            // polecenie zmienia stan: nowy przyjdzie od centralki
+            dropState(msg, size, client.station);
+            quint8 db0 = (size >= 6) ? static_cast<quint8>(msg[5]) : 0;
+            // subskrypcja LOCO_INFO, jak w Z21: ostatnie Z21_MAX_LOCOS adresów
+            if (((xheader == LAN_X_GET_LOCO_INFO) || (xheader == LAN_X_SET_LOCO))
+                && (size >= 8)) {
+                quint16 loco = locoAddress(msg + 6);
+                if (!client.locos.contains(loco)) {
+                    if (client.locos.count() >= Z21_MAX_LOCOS) {
+                        client.locos.removeFirst();
+                    }
+                    client.locos.append(loco);
+                    updateFlags(client.station, out);
+                }
+            }
+            quint64 skey;
+            if (stateQuery(msg, size, skey, client.station)
+                && (now - states.value(skey).received < DEF_TOUT_Z21_CACHE)) {
+                send(out, addr, port, states.value(skey).data);
+                return;
+            }
+            for (size_t i = 0; i < sizeof(xReplies) / sizeof(xReplies[0]); i++) {
+                if ((xReplies[i].request == xheader)
+                    && ((xReplies[i].db0 == 0) || (xReplies[i].db0 == db0))) {
+                    addPending(key, client.station, LAN_X_MESSAGE,
+                               xReplies[i].reply, now);
+                    break;
+                }
+            }
+        }
+        break;
+    default: {
+        quint64 skey;
+        if (stateQuery(msg, size, skey, client.station)
+            && (now - states.value(skey).received < DEF_TOUT_Z21_CACHE)) {
+            send(out, addr, port, states.value(skey).data);
+            return;
+        }
+        for (size_t i = 0; i < sizeof(lanReplies) / sizeof(lanReplies[0]); i++) {
+            if (lanReplies[i].request == header) {
+                addPending(key, client.station, lanReplies[i].reply, 0, now);
+                break;
+            }
+        }
+        break;
+    }
+    } // switch header
+
+    send(out, client.station, stationPort, QByteArray(msg, size));
+
+} // NetGateway::fromClient
+
+// komunikat centralki: odpowiedź do pytającego, rozgłoszenie według flag
+void NetGateway::fromStation(quint32 addr, const char *msg, int size,
+                             qint64 now, Packets& out)
+{
+    quint8 header = static_cast<quint8>(qFromLittleEndian<quint16>(msg + 2));
+    quint8 xheader = 0;
+    if (header == LAN_X_MESSAGE) {
+        if (size < 5) {
+            return;
+        }
+        xheader = static_cast<quint8>(msg[4]);
+    }
+
+    QByteArray data(msg, size);
+    bool fChanged = updateState(addr, msg, size, data, now);
+
+    // najstarsze żądanie czekające na tę odpowiedź
+    quint64 served = 0;
+    for (int cnt = 0; cnt < pending.count(); cnt++) {
+        const Pending& p = pending.at(cnt);
+        if ((p.station == addr) && (p.header == header) && (p.xheader == xheader)) {
+            served = p.client;
+            pending.removeAt(cnt);
+            if (clients.contains(served)) {
+                const Client& c = clients.value(served);
+                send(out, c.addr, c.port, data);
+            }
+            break;
+        }
+    }
+
+    // rozgłoszenie tylko zmienionego stanu
+    quint32 mask = broadcastMask(header, xheader);
+    if ((mask == 0) || !fChanged) {
+        return;
+    }
+    quint16 loco = ((xheader == LAN_X_LOCO_INFO) && (size >= 7))
+                   ? locoAddress(msg + 5) : 0;
+
+    QHashIterator<quint64, Client> i(clients);
+    while (i.hasNext()) {
+        i.next();
+        const Client& c = i.value();
+        if ((i.key() == served) || (c.station != addr)) {
+            continue;
+        }
+        bool fSend;
+        if (xheader == LAN_X_LOCO_INFO) {
+            fSend = (c.flags & Z21_BC_ALL_LOCOS)
+                    || ((c.flags & Z21_BC_BASIC) && c.locos.contains(loco));
+        }
+        else {
+            fSend = (c.flags & mask) != 0;
+        }
+        if (fSend) {
+            send(out, c.addr, c.port, data);
+        }
+    }
+
+} // NetGateway::fromStation
+
+// zapytanie klienta o stan pamiętany przez bramkę; key: wpis states
+bool NetGateway::stateQuery(const char *msg, int size, quint64& key,
+                            quint32 station) const
+{
+    quint8 header = static_cast<quint8>(qFromLittleEndian<quint16>(msg + 2));
+
+    if ((header == LAN_SYSTEMSTATE_GETDATA) && (size == 4)) {
+        key = stateKey(station, LAN_SYSTEMSTATE_DATACHANGED, 0);
+    }
+    else if ((header == LAN_X_MESSAGE) && (size == 9)
+             && (static_cast<quint8>(msg[4]) == LAN_X_GET_LOCO_INFO)
+             && (static_cast<quint8>(msg[5]) == 0xF0)) {
+        key = stateKey(station, LAN_X_LOCO_INFO, locoAddress(msg + 6));
+    }
+    else if ((header == LAN_X_MESSAGE) && (size == 8)
+             && (static_cast<quint8>(msg[4]) == LAN_X_TURNOUT_INFO)) {
+        key = stateKey(station, LAN_X_TURNOUT_INFO,
+                       qFromBigEndian<quint16>(msg + 5));
+    }
+    else {
+        return false;
+    }
+    return states.contains(key);
+
+} // NetGateway::stateQuery
+
+// zapamiętanie stanu z komunikatu centralki; false: stan bez zmian
+bool NetGateway::updateState(quint32 station, const char *msg, int size,
+                             const QByteArray& data, qint64 now)
+{
+    quint8 header = static_cast<quint8>(qFromLittleEndian<quint16>(msg + 2));
+    quint8 xheader = (header == LAN_X_MESSAGE) ? static_cast<quint8>(msg[4]) : 0;
+    quint64 key;
+
+    if (header == LAN_SYSTEMSTATE_DATACHANGED) {
+        key = stateKey(station, header, 0);
+    }
+    else if ((xheader == LAN_X_LOCO_INFO) && (size >= 7)) {
+        key = stateKey(station, xheader, locoAddress(msg + 5));
+    }
+    else if ((xheader == LAN_X_TURNOUT_INFO) && (size >= 9)) {
+        key = stateKey(station, xheader, qFromBigEndian<quint16>(msg + 5));
+    }
+    else {
+        return true;
+    }
+
+    State& s = states[key];
+    bool fChanged = (s.data != data);
+    s.data = data;
+    s.received = now;
+    return fChanged;
+
+} // NetGateway::updateState
+
+// stan zmieniany poleceniem klienta: następne zapytanie do centralki
+void NetGateway::dropState(const char *msg, int size, quint32 station)
+{
+    quint8 xheader = static_cast<quint8>(msg[4]);
+    quint8 db0 = (size >= 6) ? static_cast<quint8>(msg[5]) : 0;
+
+    if ((xheader == LAN_X_SET_LOCO) && (size >= 8)) {
+        states.remove(stateKey(station, LAN_X_LOCO_INFO, locoAddress(msg + 6)));
+    }
+    else if ((xheader == LAN_X_SET_TURNOUT) && (size >= 8)) {
+        states.remove(stateKey(station, LAN_X_TURNOUT_INFO,
+                               qFromBigEndian<quint16>(msg + 5)));
+    }
+    else if ((xheader == LAN_X_SET_STOP)
+             || ((xheader == LAN_X_GET_SETTING) && ((db0 == 0x80) || (db0 == 0x81)))) {
+        // zatrzymanie, napięcie toru
+        states.remove(stateKey(station, LAN_SYSTEMSTATE_DATACHANGED, 0));
+    }
+
+} // NetGateway::dropState
+
+void NetGateway::addPending(quint64 key, quint32 station, quint8 header,
+                            quint8 xheader, qint64 now)
+{
+    Pending p;
+    p.client = key;
+    p.station = station;
+    p.header = header;
+    p.xheader = xheader;
+    p.sent = now;
+    pending.append(p);
+}
+
+void NetGateway::dropClient(quint64 key)
+{
+    clients.remove(key);
+    for (int cnt = pending.count() - 1; cnt >= 0; cnt--) {
+        if (pending.at(cnt).client == key) {
+            pending.removeAt(cnt);
+        }
+    }
+}
+
+// flagi bramki u centralki: suma flag jej klientów; gdy klienci
+// subskrybują więcej lokomotyw niż Z21 pamięta dla bramki, wszystkie
+void NetGateway::updateFlags(quint32 station, Packets& out)
+{
+    quint32 flags = 0;
+    QSet<quint16> locos;
+
+    QHashIterator<quint64, Client> i(clients);
+    while (i.hasNext()) {
+        i.next();
+        if (i.value().station == station) {
+            flags |= i.value().flags;
+            for (int cnt = 0; cnt < i.value().locos.count(); cnt++) {
+                locos.insert(i.value().locos.at(cnt));
+            }
+        }
+    }
+    if ((flags & Z21_BC_BASIC) && (locos.count() > Z21_MAX_LOCOS)) {
+        flags |= Z21_BC_ALL_LOCOS;
+    }
+
+    if (stationFlags.value(station) != flags) {
+        stationFlags.insert(station, flags);
+        char msg[8];
+        qToLittleEndian<quint16>(sizeof(msg), msg);
+        qToLittleEndian<quint16>(LAN_SET_BROADCASTFLAGS, msg + 2);
+        qToLittleEndian<quint32>(flags, msg + 4);
+        send(out, station, stationPort, QByteArray(msg, sizeof(msg)));
+    }
+
+} // NetGateway::updateFlags
+
+// usunięcie milczących klientów i żądań bez odpowiedzi
+void NetGateway::expire(qint64 now, Packets& out)
+{
+    QSet<quint32> changed;
+
+    lastExpire = now;
+    QMutableHashIterator<quint64, Client> i(clients);
+    while (i.hasNext()) {
+        i.next();
+        if (now - i.value().lastSeen > DEF_TOUT_CLIENT) {
+            changed.insert(i.value().station);
+            i.remove();
+        }
+    }
+    for (int cnt = pending.count() - 1; cnt >= 0; cnt--) {
+        const Pending& p = pending.at(cnt);
+        if ((now - p.sent > DEF_TOUT_DGRAM) || !clients.contains(p.client)) {
+            pending.removeAt(cnt);
+        }
+    }
+    // stan starszy niż limit nie jest używany, zostaje do porównań
+    // z rozgłoszeniami przez czas życia klienta
+    QMutableHashIterator<quint64, State> st(states);
+    while (st.hasNext()) {
+        st.next();
+        if (now - st.value().received > DEF_TOUT_CLIENT) {
+            st.remove();
+        }
+    }
+
+    QSetIterator<quint32> s(changed);
+    while (s.hasNext()) {
+        updateFlags(s.next(), out);
+    }
+
+} // NetGateway::expire
+
+// pakiety rozgłoszenia współdzielą jedną kopię komunikatu
+void NetGateway::send(Packets& out, quint32 addr, quint16 port,
+                      const QByteArray& msg)
+{
+    Packet p;
+    p.addr = addr;
+    p.port = port;
+    p.data = msg;
+    out.append(p);
+}
+
+// EOF netgateway.cpp
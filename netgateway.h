@@ -0,0 +1,117 @@
+//
+// Wireless Command Station
+//
+// Copyright 2020 Robert Nagowski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// See gpl-3.0.md file for details.
+//
+
+#ifndef NETGATEWAY_H
+#define NETGATEWAY_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QVector>
+
+#include "datagrams.h"
+
+// Bramka Z21: klienci Z21 (aplikacje sterujące, Rocrail) obsługiwani przez
+// program w imieniu centralek WiCS. Żądania klientów przekazywane są do
+// przypisanej centralki, odpowiedzi wracają do pytającego klienta, a
+// komunikaty rozgłoszeniowe trafiają do klientów według flag Z21.
+// Nowy klient dostaje centralkę o najmniejszej liczbie klientów.
+// Stan lokomotyw, zwrotnic i centralki z odpowiedzi i rozgłoszeń jest
+// pamiętany: powtórzone zapytania klientów bramka obsługuje sama, jeśli
+// stan jest młodszy niż DEF_TOUT_Z21_CACHE, a rozgłoszenia bez zmiany
+// stanu nie są przekazywane.
+// Obiekt nie jest wielowątkowy: NetEngine wywołuje go pod blokadą,
+// a wynikowe pakiety wysyła poza nią.
+class NetGateway
+{
+public:
+    struct Packet {
+        quint32    addr;
+        quint16    port;
+        QByteArray data;
+    };
+    typedef QList<Packet> Packets;
+
+private:
+    struct Client {
+        quint32 addr;
+        quint16 port;
+        quint32 station;            // centralka obsługująca klienta
+        quint32 flags;              // LAN_SET_BROADCASTFLAGS
+        qint64  lastSeen;
+        QVector<quint16> locos;     // lokomotywy z LAN_X_GET_LOCO_INFO
+    };
+    struct Pending {
+        quint64 client;
+        quint32 station;
+        quint8  header;             // oczekiwana odpowiedź
+        quint8  xheader;            // X-nagłówek dla LAN_X_MESSAGE
+        qint64  sent;
+    };
+    struct State {
+        QByteArray data;            // ostatni komunikat centralki
+        qint64  received;
+    };
+
+    quint16 stationPort;            // port UDP centralek
+    QList<quint32> stations;        // centralki obsługujące klientów
+    QHash<quint64, Client> clients; // klienci według adresu i portu
+    QList<Pending> pending;         // żądania czekające na odpowiedź
+    QHash<quint32, quint32> stationFlags;   // flagi zgłoszone centralkom
+    QHash<quint64, State> states;   // stan według centralki, typu i adresu
+    qint64 lastExpire;
+
+    static quint64 clientKey(quint32 addr, quint16 port)
+    {
+        return (static_cast<quint64>(addr) << 16) | port;
+    }
+    // typ: X-nagłówek LAN_X lub nagłówek LAN; id: adres lokomotywy, zwrotnicy
+    static quint64 stateKey(quint32 station, quint8 type, quint16 id)
+    {
+        return (static_cast<quint64>(station) << 24)
+               | (static_cast<quint64>(type) << 16) | id;
+    }
+
+    void fromClient(quint32 addr, quint16 port, const char *msg, int size,
+                    qint64 now, Packets& out);
+    void fromStation(quint32 addr, const char *msg, int size, qint64 now,
+                     Packets& out);
+    bool stateQuery(const char *msg, int size, quint64& key, quint32 station) const;
+    bool updateState(quint32 station, const char *msg, int size,
+                     const QByteArray& data, qint64 now);
+    void dropState(const char *msg, int size, quint32 station);
+    quint32 assignStation() const;
+    void addPending(quint64 key, quint32 station, quint8 header,
+                    quint8 xheader, qint64 now);
+    void dropClient(quint64 key);
+    void updateFlags(quint32 station, Packets& out);
+    void send(Packets& out, quint32 addr, quint16 port, const QByteArray& msg);
+
+public:
+    NetGateway();
+
+    bool isActive() const { return !stations.isEmpty(); }
+    bool isStation(quint32 addr) const { return stations.contains(addr); }
+    int clientCount() const { return clients.count(); }
+
+    void setStationPort(quint16 port) { stationPort = port; }
+    void addStation(quint32 addr);
+    void removeStation(quint32 addr, Packets& out);
+
+    // false: błędna długość komunikatu, dalsza część datagramu pominięta
+    bool route(quint32 addr, quint16 port, const char *data, int size,
+               qint64 now, Packets& out);
+    void expire(qint64 now, Packets& out);
+
+}; // NetGateway
+
+#endif // NETGATEWAY_H
@@ -0,0 +1,496 @@
+//
+// Wireless Command Station
+//
+// Copyright 2020 Robert Nagowski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// See gpl-3.0.md file for details.
+//
+
+#include "netgroup.h"
+#include "netdigest.h"
+
+#include <cstring>
+
+NetGroup::NetGroup(quint32 group)
+{
+    groupAddr = group;
+    imagePage = 0;
+    imageBSize = 0;
+    imageProposed = 0;
+    imageFlags = 0;
+    imageCrc = false;
+    imageBlocks = 0;
+    imageNext = 1;
+    roundSize = DEF_GRP_ROUND;
+    roundLeft = 0;
+    round = 0;
+    polling = false;
+    pollDue = false;
+    pollSentAt = 0;
+    retryCount = 0;
+    srtt = -1;
+    rttvar = 0;
+    rto = DEF_RTO_INIT;
+    deadline = 0;
+}
+
+// przygotowanie aktualizacji centralek targets, zwraca liczbę bloków
+// przy rozmiarze strony; round: nowe bloki w rundzie
+int NetGroup::startUpgrade(const QSharedPointer<NetImage>& img, int module,
+                           const QList<quint32>& targets, int round,
+                           int bsize, bool checksum)
+{
+    switch (module) {
+    case UPGRADE_WLAN:
+        imageBSize = UPG_WLAN_PAGE;
+        break;
+    case UPGRADE_DCCGEN:
+        imageBSize = UPG_DCCG_PAGE;
+        break;
+    default:
+        qDebug("Moduł: %d", module);
+        imageBSize = 256;
+        break;
+    } // switch module
+
+    imagePage = imageBSize;
+    image = img;
+    // ostatni blok jest krótszy lub pusty, jak w NetSession
+    imageBlocks = static_cast<int>(img->size() / imageBSize) + 1;
+    imageNext = 1;
+    imageFlags = static_cast<quint16>(module);
+    imageCrc = checksum;
+    roundSize = qMax(round, 1);
+    roundLeft = roundSize;
+    repair.clear();
+    polling = false;
+    pollDue = false;
+    retryCount = 0;
+    deadline = 0;
+
+    int fit = qMin(bsize, UPG_MAX_BLOCK) / imageBSize * imageBSize;
+    imageProposed = (fit > imageBSize) ? static_cast<quint16>(fit) : 0;
+
+    members.clear();
+    for (int cnt = 0; cnt < targets.count(); cnt++) {
+        Member m;
+        m.state = MemberJoin;
+        m.acked = 0;
+        m.round = 0;
+        m.bsize = 0;
+        members.insert(targets.at(cnt), m);
+    }
+    return imageBlocks;
+
+} // NetGroup::startUpgrade
+
+// start wspólny dla centralek grupy; skróty obrazu, gdy już policzone
+void NetGroup::initFrame(NetFrame<UpgradeInitDigest_dg>& data) const
+{
+    quint16 flags = static_cast<quint16>(imageFlags | UPGRADE_GROUP
+                                         | (imageCrc ? UPGRADE_CRC : 0));
+    int size = sizeof(UpgradeInit_dg);
+    if (imageProposed > 0) {
+        flags |= UPGRADE_BSIZE;
+        data.set(&UpgradeInitDigest_dg::bsize, imageProposed);
+        size = sizeof(UpgradeInitSize_dg);
+    }
+    if (image->hasDigest()) {
+        flags |= UPGRADE_DIGEST;
+        data.set(&UpgradeInitDigest_dg::crc, image->crc());
+        memcpy(data.text(&UpgradeInitDigest_dg::sha256), image->sha256(),
+               UPG_SHA256_SIZE);
+        size = sizeof(UpgradeInitDigest_dg);
+    }
+    data.set(&UpgradeInitDigest_dg::bytes, static_cast<quint16>(size));
+    data.set(&UpgradeInitDigest_dg::flags, flags);
+    data.set(&UpgradeInitDigest_dg::fwsize, static_cast<quint32>(image->size()));
+
+} // NetGroup::initFrame
+
+void NetGroup::initSent(qint64 now)
+{
+    pollSentAt = now;
+    deadline = now + rto;
+}
+
+// potwierdzenie startu przez centralkę; bsize == 0: odpowiedź bez
+// rozmiaru bloku. Rozmiar bloku grupy ustala joined() po odpowiedzi
+// wszystkich centralek; inits: centralki, do których start jest
+// wysyłany ponownie z mniejszym rozmiarem
+void NetGroup::join(quint32 addr, quint16 result, int bsize, qint64 now,
+                    QList<quint32>& inits, Events& events)
+{
+    if (!isJoining(addr)) {
+        return;
+    }
+
+    Member& m = members[addr];
+    if (bsize <= 0) {
+        // centralka bez propozycji rozmiaru pisze całymi stronami
+        bsize = imagePage;
+    }
+    if (result != RESULT_OK) {
+        m.state = MemberFailed;
+        events.append(event(addr, 0, result));
+    }
+    else if ((bsize > qMax(imageProposed, imagePage)) || (bsize % imagePage != 0)) {
+        // rozmiar spoza propozycji, jak NetSession::acceptBlockSize()
+        qDebug("Group block size: %d, proponowany %d", bsize, imageProposed);
+        m.state = MemberFailed;
+        events.append(event(addr, 0, RESULT_BSIZE));
+    }
+    else {
+        m.bsize = static_cast<quint16>(bsize);
+        if (retryCount == 0) {
+            rttSample(static_cast<int>(now - pollSentAt));
+        }
+    }
+
+    if (!answering()) {
+        joined(inits, events);
+    }
+
+} // NetGroup::join
+
+// wszystkie centralki odpowiedziały na start: najmniejszy przyjęty
+// rozmiar bloku dla całej grupy; centralki z większym dostają start
+// ponownie z propozycją tego rozmiaru, pozostałe zaczynają odbiór
+void NetGroup::joined(QList<quint32>& inits, Events& events)
+{
+    int size = 0;
+    QMutableHashIterator<quint32, Member> i(members);
+    while (i.hasNext()) {
+        i.next();
+        if (i.value().state == MemberJoin) {
+            size = (size == 0) ? i.value().bsize : qMin(size, static_cast<int>(i.value().bsize));
+        }
+    }
+    if (size == 0) {
+        return;
+    }
+
+    i.toFront();
+    while (i.hasNext()) {
+        i.next();
+        Member& m = i.value();
+        if ((m.state == MemberJoin) && (m.bsize > size)) {
+            m.bsize = 0;
+            inits.append(i.key());
+        }
+    }
+    retryCount = 0;
+    if (!inits.isEmpty()) {
+        imageProposed = static_cast<quint16>((size > imagePage) ? size : 0);
+        return;
+    }
+
+    // rozmiar ustalony dla całej grupy, pierwsza runda bloków
+    imageBSize = static_cast<quint16>(size);
+    imageBlocks = static_cast<int>(image->size() / imageBSize) + 1;
+    imageProposed = 0;
+    i.toFront();
+    while (i.hasNext()) {
+        i.next();
+        if (i.value().state == MemberJoin) {
+            i.value().state = MemberActive;
+            Event e = event(i.key(), 0, RESULT_OK);
+            e.steps = imageBlocks;
+            events.append(e);
+        }
+    }
+    deadline = 0;
+    roundLeft = roundSize;
+
+} // NetGroup::joined
+
+// następny blok rundy: najpierw brakujące, potem nowe; po ostatnim
+// pytanie do grupy, pollFrame()
+bool NetGroup::nextBlock(NetFrame<UpgradeCrc_dg>& data, const uchar*& payload,
+                         qint64& psize)
+{
+    // deadline bez pytania: runda bez bloków czeka na zapis w centralkach
+    if (image.isNull() || joining() || polling || pollDue || (deadline != 0)
+        || finished()) {
+        return false;
+    }
+
+    int block;
+    if (!repair.isEmpty()) {
+        block = repair.takeFirst();
+    }
+    else if ((roundLeft > 0) && (imageNext <= imageBlocks)) {
+        block = imageNext++;
+        roundLeft--;
+    }
+    else {
+        pollDue = true;
+        return false;
+    }
+
+    qint64 offset = static_cast<qint64>(block - 1) * imageBSize;
+    psize = qBound(Q_INT64_C(0), image->size() - offset,
+                   static_cast<qint64>(imageBSize));
+    payload = image->data() + offset;
+
+    data.set(&UpgradeCrc_dg::bytes, static_cast<quint16>(psize + headerSize()));
+    data.set(&UpgradeCrc_dg::flags, static_cast<quint16>(
+                 imageFlags | UPGRADE_GROUP | (imageCrc ? UPGRADE_CRC : 0)));
+    data.set(&UpgradeCrc_dg::block, static_cast<quint16>(block));
+    data.set(&UpgradeCrc_dg::prev, static_cast<quint16>(block - 1));
+    if (imageCrc) {
+        data.set(&UpgradeCrc_dg::crc, netCrc32c(payload, psize));
+    }
+    return true;
+
+} // NetGroup::nextBlock
+
+// blok nie został wysłany: wraca do bloków brakujących
+void NetGroup::blockFailed(int block)
+{
+    addRepair(block);
+}
+
+// pytanie o brakujące bloki; ponowienie ma ten sam numer rundy
+bool NetGroup::pollFrame(NetFrame<UpgradePoll_dg>& data, qint64 now)
+{
+    if (!pollDue) {
+        return false;
+    }
+
+    if (!polling) {
+        round++;
+        polling = true;
+        retryCount = 0;
+        pollSentAt = now;
+    }
+    pollDue = false;
+    deadline = now + rto;
+
+    data.set(&UpgradePoll_dg::flags, static_cast<quint16>(imageFlags | UPGRADE_GROUP));
+    data.set(&UpgradePoll_dg::round, round);
+    data.set(&UpgradePoll_dg::last, static_cast<quint16>(imageNext - 1));
+    return true;
+
+} // NetGroup::pollFrame
+
+// odpowiedź centralki: postęp, brakujące bloki do następnej rundy
+void NetGroup::nack(quint32 addr, const NetView<UpgradeNack_dg>& data,
+                    qint64 now, Events& events)
+{
+    if (!members.contains(addr) || (members.value(addr).state != MemberActive)
+        || !polling || (data.get(&UpgradeNack_dg::round) != round)) {
+        // spóźniona odpowiedź na wcześniejsze pytanie
+        return;
+    }
+
+    Member& m = members[addr];
+    int last = imageNext - 1;
+    quint16 result = data.get(&UpgradeNack_dg::result);
+    m.round = round;
+    m.acked = qBound(m.acked, static_cast<int>(data.get(&UpgradeNack_dg::acked)),
+                     imageBlocks);
+    if (retryCount == 0) {
+        rttSample(static_cast<int>(now - pollSentAt));
+    }
+
+    if (result != RESULT_OK) {
+        m.state = MemberFailed;
+        events.append(event(addr, m.acked, result));
+    }
+    else if (m.acked >= imageBlocks) {
+        m.state = MemberDone;
+        events.append(event(addr, imageBlocks, RESULT_OK));
+    }
+    else {
+        int count = qMin(static_cast<int>(data.get(&UpgradeNack_dg::count)),
+                         data.payloadSize() / 2);
+        const uchar *missing = data.payload();
+        for (int cnt = 0; cnt < count; cnt++) {
+            int block = qFromLittleEndian<quint16>(missing + 2 * cnt);
+            if ((block > m.acked) && (block <= last)) {
+                addRepair(block);
+            }
+        }
+        if ((count == 0) && (m.acked < last)) {
+            // centralka bez listy braków: bloki za ostatnim zapisanym
+            for (int block = m.acked + 1; block <= qMin(last, m.acked + roundSize); block++) {
+                addRepair(block);
+            }
+        }
+        events.append(event(addr, m.acked, RESULT_OK));
+    }
+
+    if (replied()) {
+        endRound(now);
+    }
+
+} // NetGroup::nack
+
+// terminy: start bez potwierdzenia lub pytanie bez odpowiedzi wszystkich;
+// inits: centralki, do których start jest wysyłany ponownie
+void NetGroup::timeout(qint64 now, QList<quint32>& inits, Events& events)
+{
+    if (image.isNull() || (deadline == 0) || (now < deadline)) {
+        return;
+    }
+
+    bool fJoin = joining();
+    if (!fJoin && !polling) {
+        // runda bez bloków do wysłania: pytanie po limicie czasu
+        deadline = 0;
+        pollDue = true;
+        return;
+    }
+
+    bool fFailed = (retryCount >= DEF_MAX_RETRANS);
+    QMutableHashIterator<quint32, Member> i(members);
+    while (i.hasNext()) {
+        i.next();
+        Member& m = i.value();
+        bool fWaiting = fJoin ? ((m.state == MemberJoin) && (m.bsize == 0))
+                              : ((m.state == MemberActive) && (m.round != round));
+        if (!fWaiting) {
+            continue;
+        }
+        if (fFailed) {
+            m.state = MemberFailed;
+            events.append(event(i.key(), m.acked, RESULT_OK, true));
+        }
+        else if (fJoin) {
+            inits.append(i.key());
+        }
+    }
+
+    retryCount++;
+    rto = qMin(rto * 2, DEF_RTO_MAX);
+    deadline = now + rto;
+    if (fJoin) {
+        if (fFailed) {
+            // pozostałe centralki zaczynają bez nieodpowiadających
+            deadline = 0;
+            joined(inits, events);
+        }
+    }
+    else if (fFailed || replied()) {
+        endRound(now);
+    }
+    else {
+        pollDue = true;
+    }
+
+} // NetGroup::timeout
+
+bool NetGroup::isJoining(quint32 addr) const
+{
+    return members.contains(addr) && (members.value(addr).state == MemberJoin);
+}
+
+// koniec aktualizacji: żadna centralka nie czeka na start ani bloki
+bool NetGroup::finished() const
+{
+    QHashIterator<quint32, Member> i(members);
+    while (i.hasNext()) {
+        i.next();
+        if ((i.value().state == MemberJoin) || (i.value().state == MemberActive)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// próbka RTT dla limitu czasu ponowień (RFC 6298), jak w NetSession
+void NetGroup::rttSample(int r)
+{
+    if (srtt < 0) {
+        srtt = r;
+        rttvar = r / 2;
+    }
+    else {
+        rttvar = (3 * rttvar + qAbs(srtt - r)) / 4;
+        srtt = (7 * srtt + r) / 8;
+    }
+    rto = qBound(DEF_RTO_MIN, srtt + qMax(10, 4 * rttvar), DEF_RTO_MAX);
+}
+
+// blok do ponownego wysłania, lista rosnąca bez powtórzeń
+void NetGroup::addRepair(int block)
+{
+    int pos = 0;
+    while ((pos < repair.count()) && (repair.at(pos) < block)) {
+        pos++;
+    }
+    if ((pos == repair.count()) || (repair.at(pos) != block)) {
+        repair.insert(pos, static_cast<quint16>(block));
+    }
+}
+
+bool NetGroup::joining() const
+{
+    QHashIterator<quint32, Member> i(members);
+    while (i.hasNext()) {
+        i.next();
+        if (i.value().state == MemberJoin) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// centralki bez potwierdzenia startu
+bool NetGroup::answering() const
+{
+    QHashIterator<quint32, Member> i(members);
+    while (i.hasNext()) {
+        i.next();
+        if ((i.value().state == MemberJoin) && (i.value().bsize == 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// wszystkie aktywne centralki odpowiedziały na bieżące pytanie
+bool NetGroup::replied() const
+{
+    QHashIterator<quint32, Member> i(members);
+    while (i.hasNext()) {
+        i.next();
+        if ((i.value().state == MemberActive) && (i.value().round != round)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// następna runda: brakujące bloki i kolejne nowe; bez bloków do
+// wysłania pytanie ponawiane po limicie czasu (zapis flash centralek)
+void NetGroup::endRound(qint64 now)
+{
+    polling = false;
+    pollDue = false;
+    retryCount = 0;
+    roundLeft = roundSize;
+    deadline = 0;
+    if (!finished() && repair.isEmpty() && (imageNext > imageBlocks)) {
+        deadline = now + rto;
+    }
+}
+
+NetGroup::Event NetGroup::event(quint32 addr, int block, quint16 result,
+                                bool noanswer) const
+{
+    Event e;
+    e.addr = addr;
+    e.block = static_cast<quint16>(block);
+    e.result = result;
+    e.noAnswer = noanswer;
+    e.steps = 0;
+    return e;
+}
+
+// EOF netgroup.cpp
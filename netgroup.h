@@ -0,0 +1,128 @@
+//
+// Wireless Command Station
+//
+// Copyright 2020 Robert Nagowski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// See gpl-3.0.md file for details.
+//
+
+#ifndef NETGROUP_H
+#define NETGROUP_H
+
+#include <QHash>
+#include <QList>
+#include <QSharedPointer>
+
+#include "datagrams.h"
+#include "netcodec.h"
+#include "netimage.h"
+
+// Aktualizacja grupowa: ten sam obraz do kilku centralek. Start idzie do
+// każdej centralki osobno (UPGRADE_GROUP), bloki tylko raz na adres grupy
+// (rozgłoszeniowy lub multicast). Po każdej rundzie nowych bloków pytanie
+// do grupy (WICS_UPGRADE_POLL); centralki odpowiadają listą brakujących
+// bloków, które następna runda wysyła ponownie razem z kolejnymi nowymi.
+// Runda kończy się po odpowiedzi wszystkich centralek lub po limicie
+// czasu, więc tempo wyznacza najwolniejsza centralka. Rozmiar bloku:
+// najmniejszy przyjęty przez centralki, ustalany po odpowiedzi wszystkich.
+// Obiekt nie jest wielowątkowy: NetEngine wywołuje go pod blokadą.
+class NetGroup
+{
+public:
+    enum MemberState {
+        MemberJoin = 0,     // start wysłany, bez rozmiaru bloku grupy
+        MemberActive,       // odbiera bloki
+        MemberDone,         // obraz kompletny i sprawdzony
+        MemberFailed        // błąd lub brak odpowiedzi
+    };
+
+    // zmiana stanu centralki do przekazania przez NetEngine
+    struct Event {
+        quint32 addr;
+        quint16 block;      // ostatni zapisany blok
+        quint16 result;
+        bool    noAnswer;   // limit ponowień wyczerpany
+        int     steps;      // liczba bloków po dołączeniu, 0: bez zmiany
+    };
+    typedef QList<Event> Events;
+
+private:
+    struct Member {
+        MemberState state;
+        int     acked;      // bloki 1..acked zapisane w centralce
+        quint16 round;      // pytanie, na które odpowiedziała
+        quint16 bsize;      // rozmiar bloku przyjęty na starcie, 0: brak
+    };
+
+    quint32     groupAddr;  // adres grupy
+    QSharedPointer<NetImage> image;
+    quint16     imagePage;      // rozmiar strony modułu
+    quint16     imageBSize;     // rozmiar bloku danych
+    quint16     imageProposed;  // proponowany rozmiar bloku, 0: strona
+    quint16     imageFlags;     // moduł
+    bool        imageCrc;       // CRC32C bloków
+    int         imageBlocks;    // liczba bloków
+    int         imageNext;      // następny nowy blok
+    int         roundSize;      // nowe bloki w rundzie
+    int         roundLeft;      // nowe bloki do końca rundy
+    QList<quint16> repair;      // bloki do ponownego wysłania, rosnąco
+    QHash<quint32, Member> members;
+    quint16     round;          // numer ostatniego pytania
+    bool        polling;        // pytanie wysłane, oczekiwanie na odpowiedzi
+    bool        pollDue;        // pytanie do wysłania
+    qint64      pollSentAt;     // pierwsze wysłanie pytania [ms]
+    int         retryCount;     // ponowienia startu lub pytania
+    // limit czasu ponowienia jak RFC 6298
+    int         srtt;           // wygładzony RTT [ms], -1: brak próbki
+    int         rttvar;         // zmienność RTT [ms]
+    int         rto;            // limit czasu z backoff [ms]
+    qint64      deadline;       // termin ponowienia [ms], 0: brak
+
+    void rttSample(int r);
+    void addRepair(int block);
+    bool joining() const;
+    bool answering() const;
+    void joined(QList<quint32>& inits, Events& events);
+    bool replied() const;
+    void endRound(qint64 now);
+    Event event(quint32 addr, int block, quint16 result, bool noanswer = false) const;
+
+public:
+    explicit NetGroup(quint32 group);
+
+    quint32 address() const { return groupAddr; }
+
+    int startUpgrade(const QSharedPointer<NetImage>& img, int module,
+                     const QList<quint32>& targets, int round, int bsize,
+                     bool checksum);
+    void initFrame(NetFrame<UpgradeInitDigest_dg>& data) const;
+    void initSent(qint64 now);
+    void join(quint32 addr, quint16 result, int bsize, qint64 now,
+              QList<quint32>& inits, Events& events);
+    bool nextBlock(NetFrame<UpgradeCrc_dg>& data, const uchar*& payload,
+                   qint64& psize);
+    void blockFailed(int block);
+    bool pollFrame(NetFrame<UpgradePoll_dg>& data, qint64 now);
+    void nack(quint32 addr, const NetView<UpgradeNack_dg>& data, qint64 now,
+              Events& events);
+    void timeout(qint64 now, QList<quint32>& inits, Events& events);
+
+    qint64 retransmitAt() const { return deadline; }
+    bool isMember(quint32 addr) const { return members.contains(addr); }
+    bool isJoining(quint32 addr) const;
+    bool finished() const;
+    QSharedPointer<NetImage> upgradeImage() const { return image; }
+    int blocks() const { return imageBlocks; }
+    int headerSize() const
+    {
+        return static_cast<int>(imageCrc ? sizeof(UpgradeCrc_dg)
+                                         : sizeof(UpgradeData_dg));
+    }
+
+}; // NetGroup
+
+#endif // NETGROUP_H
@@ -0,0 +1,75 @@
+//
+// Wireless Command Station
+//
+// Copyright 2020 Robert Nagowski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// See gpl-3.0.md file for details.
+//
+
+#include "netimage.h"
+
+#include <QCryptographicHash>
+#include <cstring>
+
+NetImage::NetImage(const QString& filename, std::function<void()> done)
+        : imageFile(filename),
+          digestDone(done)
+{
+    imageMap = nullptr;
+    imageSize = 0;
+    imageCrc = 0;
+    memset(imageSha, 0, sizeof(imageSha));
+    digestReady.store(false, std::memory_order_relaxed);
+    digestStop.store(false, std::memory_order_relaxed);
+
+    if (imageFile.open(QIODevice::ReadOnly)) {
+        // bloki wysyłane wprost z mapowania
+        imageMap = imageFile.map(0, imageFile.size());
+        if (imageMap != nullptr) {
+            imageSize = imageFile.size();
+            digestThread = std::thread(&NetImage::computeDigest, this);
+        }
+    }
+
+} // NetImage::NetImage
+
+NetImage::~NetImage()
+{
+    if (digestThread.joinable()) {
+        digestStop.store(true, std::memory_order_relaxed);
+        digestThread.join();
+    }
+    if (imageMap != nullptr) {
+        imageFile.unmap(imageMap);
+    }
+}
+
+// skróty obrazu w wątku digestThread, przerywane przez destruktor
+void NetImage::computeDigest()
+{
+    QCryptographicHash sha(QCryptographicHash::Sha256);
+    quint32 crc = 0;
+
+    for (qint64 offset = 0; offset < imageSize; offset += NET_DIGEST_CHUNK) {
+        if (digestStop.load(std::memory_order_relaxed)) {
+            return;
+        }
+        qint64 len = qMin(imageSize - offset, static_cast<qint64>(NET_DIGEST_CHUNK));
+        crc = netCrc32c(imageMap + offset, len, crc);
+        sha.addData(reinterpret_cast<const char*>(imageMap + offset),
+                    static_cast<int>(len));
+    }
+    imageCrc = crc;
+    memcpy(imageSha, sha.result().constData(), UPG_SHA256_SIZE);
+    digestReady.store(true, std::memory_order_release);
+    if (digestDone) {
+        digestDone();
+    }
+
+} // NetImage::computeDigest
+
+// EOF netimage.cpp
@@ -0,0 +1,64 @@
+//
+// Wireless Command Station
+//
+// Copyright 2020 Robert Nagowski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// See gpl-3.0.md file for details.
+//
+
+#ifndef NETIMAGE_H
+#define NETIMAGE_H
+
+#include <QFile>
+#include <QString>
+#include <atomic>
+#include <functional>
+#include <thread>
+
+#include "datagrams.h"
+#include "netdigest.h"
+
+#define NET_DIGEST_CHUNK    65536   // część obrazu liczona bez przerwy
+
+// Plik firmware zmapowany w pamięci, współdzielony przez sesje.
+// CRC32C i SHA-256 obrazu liczone w osobnym wątku od otwarcia pliku;
+// do czasu ich obliczenia aktualizacja startuje bez skrótu.
+class NetImage
+{
+    Q_DISABLE_COPY(NetImage)
+
+private:
+    QFile   imageFile;
+    uchar  *imageMap;
+    qint64  imageSize;
+    quint32 imageCrc;           // CRC32C całego obrazu
+    uchar   imageSha[UPG_SHA256_SIZE];
+    std::atomic<bool> digestReady;
+    std::atomic<bool> digestStop;
+    std::thread digestThread;
+    std::function<void()> digestDone;   // po obliczeniu skrótów, w digestThread
+
+    void computeDigest();
+
+public:
+    explicit NetImage(const QString& filename,
+                      std::function<void()> done = std::function<void()>());
+    ~NetImage();
+
+    bool isOpen() const { return imageMap != nullptr; }
+    QString fileName() const { return imageFile.fileName(); }
+    qint64 size() const { return imageSize; }
+    const uchar* data() const { return imageMap; }
+
+    bool hasDigest() const { return digestReady.load(std::memory_order_acquire); }
+    // wynik ważny po hasDigest() == true
+    quint32 crc() const { return imageCrc; }
+    const uchar* sha256() const { return imageSha; }
+
+}; // NetImage
+
+#endif // NETIMAGE_H
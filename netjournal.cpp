@@ -0,0 +1,158 @@
+//
+// Wireless Command Station
+//
+// Copyright 2020 Robert Nagowski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// See gpl-3.0.md file for details.
+//
+
+#include "netjournal.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHostAddress>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include "datagrams.h"
+
+NetJournal::NetJournal()
+{
+    fDirty = false;
+}
+
+// dziennik wspólny dla programu z GUI i wics_cli
+QString NetJournal::defaultFile()
+{
+    return QDir(QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation))
+               .filePath("wics/upgrade-journal.json");
+}
+
+QString NetJournal::key(quint32 addr, int module)
+{
+    return QString("%1/%2").arg(QHostAddress(addr).toString()).arg(module);
+}
+
+// odczyt dziennika z pliku, kolejne zmiany zapisywane do niego
+void NetJournal::open(const QString& filename)
+{
+    QMutexLocker locker(&mutex);
+    fileName = filename;
+    entries.clear();
+    fDirty = false;
+
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+    QJsonArray list = QJsonDocument::fromJson(file.readAll()).object()
+                          .value("upgrades").toArray();
+    for (int cnt = 0; cnt < list.count(); cnt++) {
+        QJsonObject obj = list.at(cnt).toObject();
+        Entry entry;
+        entry.sha256 = QByteArray::fromHex(obj.value("sha256").toString().toLatin1());
+        entry.size = static_cast<qint64>(obj.value("size").toDouble());
+        entry.bsize = obj.value("bsize").toInt();
+        entry.block = obj.value("block").toInt();
+        if ((entry.sha256.size() == UPG_SHA256_SIZE) && (entry.bsize > 0)
+            && (entry.block > 0)) {
+            entries.insert(obj.value("station").toString(), entry);
+        }
+    }
+
+} // NetJournal::open
+
+// postęp aktualizacji po potwierdzeniu bloku, bez zapisu pliku
+void NetJournal::update(quint32 addr, int module, const Entry& entry)
+{
+    QMutexLocker locker(&mutex);
+    entries.insert(key(addr, module), entry);
+    fDirty = true;
+}
+
+// aktualizacja zakończona lub rozpoczęta od nowa, bez zapisu pliku
+void NetJournal::remove(quint32 addr, int module)
+{
+    QMutexLocker locker(&mutex);
+    if (entries.remove(key(addr, module)) > 0) {
+        fDirty = true;
+    }
+}
+
+bool NetJournal::find(quint32 addr, int module, Entry& entry)
+{
+    QMutexLocker locker(&mutex);
+    QHash<QString, Entry>::const_iterator it = entries.constFind(key(addr, module));
+    if (it == entries.constEnd()) {
+        return false;
+    }
+    entry = it.value();
+    return true;
+}
+
+// zapis zaległych zmian; plik zapisywany poza blokadą wpisów, więc
+// update() i remove() z wątku sieciowego nie czekają na dysk
+void NetJournal::flush()
+{
+    QMutexLocker writer(&fileMutex);
+
+    mutex.lock();
+    if (!fDirty || fileName.isEmpty()) {
+        mutex.unlock();
+        return;
+    }
+    QString name = fileName;
+    QByteArray json = encode();
+    fDirty = false;
+    mutex.unlock();
+
+    if (!write(name, json)) {
+        qDebug("Journal: błąd zapisu %s", name.toLocal8Bit().data());
+        mutex.lock();
+        fDirty = true;
+        mutex.unlock();
+    }
+
+} // NetJournal::flush
+
+// cały dziennik jako JSON; wymaga blokady mutex
+QByteArray NetJournal::encode() const
+{
+    QJsonArray list;
+    QHashIterator<QString, Entry> i(entries);
+    while (i.hasNext()) {
+        i.next();
+        QJsonObject obj;
+        obj.insert("station", i.key());
+        obj.insert("sha256", QString::fromLatin1(i.value().sha256.toHex()));
+        obj.insert("size", static_cast<double>(i.value().size));
+        obj.insert("bsize", i.value().bsize);
+        obj.insert("block", i.value().block);
+        list.append(obj);
+    }
+    QJsonObject root;
+    root.insert("upgrades", list);
+    root.insert("timestamp", QDateTime::currentDateTimeUtc().toString(Qt::ISODate));
+    return QJsonDocument(root).toJson();
+
+} // NetJournal::encode
+
+// QSaveFile: przerwany zapis nie niszczy poprzedniego dziennika
+bool NetJournal::write(const QString& filename, const QByteArray& json)
+{
+    QDir().mkpath(QFileInfo(filename).absolutePath());
+    QSaveFile file(filename);
+    return file.open(QIODevice::WriteOnly) && (file.write(json) >= 0)
+           && file.commit();
+}
+
+// EOF netjournal.cpp
@@ -0,0 +1,63 @@
+//
+// Wireless Command Station
+//
+// Copyright 2020 Robert Nagowski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// See gpl-3.0.md file for details.
+//
+
+#ifndef NETJOURNAL_H
+#define NETJOURNAL_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QtGlobal>
+
+// Dziennik przerwanych aktualizacji: ostatni potwierdzony blok według
+// adresu centralki i modułu, z SHA-256 obrazu i rozmiarem bloku.
+// update() i remove() zmieniają tylko wpisy w pamięci; plik JSON zapisuje
+// flush(), wywoływany zegarem NetEngine w wątku GUI. Własna blokada,
+// wywołania z wątku GUI i sieciowego.
+class NetJournal
+{
+    Q_DISABLE_COPY(NetJournal)
+
+public:
+    struct Entry {
+        QByteArray sha256;      // skrót obrazu
+        qint64  size;           // rozmiar obrazu
+        int     bsize;          // rozmiar bloku
+        int     block;          // ostatni potwierdzony blok
+    };
+
+private:
+    QMutex  mutex;
+    QMutex  fileMutex;          // kolejne zapisy pliku, poza mutex
+    QString fileName;           // pusta: dziennik tylko w pamięci
+    QHash<QString, Entry> entries;
+    bool    fDirty;             // zmiany niezapisane w pliku
+
+    static QString key(quint32 addr, int module);
+    QByteArray encode() const;
+    static bool write(const QString& filename, const QByteArray& json);
+
+public:
+    NetJournal();
+
+    static QString defaultFile();
+
+    void open(const QString& filename);
+    void update(quint32 addr, int module, const Entry& entry);
+    void remove(quint32 addr, int module);
+    bool find(quint32 addr, int module, Entry& entry);
+    void flush();
+
+}; // NetJournal
+
+#endif // NETJOURNAL_H
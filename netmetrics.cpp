@@ -0,0 +1,198 @@
+//
+// Wireless Command Station
+//
+// Copyright 2020 Robert Nagowski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// See gpl-3.0.md file for details.
+//
+
+#include "netmetrics.h"
+
+#include <QJsonArray>
+
+// nazwy w JSON, w kolejności NetCounter i NetLatency
+static const char *counterName[CountMax] = {
+    "sent", "received", "send_errors", "queue_full", "bad_header",
+    "bad_length", "bad_opcode", "retransmits", "ack_duplicate", "no_answer",
+    "coalesced"
+};
+static const char *latencyName[LatencyMax] = {
+    "devinfo", "wifista", "upgrade_start", "upgrade_data", "pagehash",
+    "heartbeat"
+};
+
+NetHistogram::NetHistogram()
+{
+    reset();
+}
+
+void NetHistogram::reset()
+{
+    for (int i = 0; i < NET_HIST_SIZE; i++) {
+        bucket[i].store(0, std::memory_order_relaxed);
+    }
+    total.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    highest.store(0, std::memory_order_relaxed);
+}
+
+// przedział wartości us
+int NetHistogram::index(qint64 us)
+{
+    if (us < NET_HIST_SUB) {
+        return static_cast<int>(qMax(us, Q_INT64_C(0)));
+    }
+    // shift: liczba bitów poniżej NET_HIST_SUB najstarszych wartości
+    int shift = 0;
+    while ((us >> shift) >= 2 * NET_HIST_SUB) {
+        shift++;
+    }
+    if (shift > NET_HIST_SHIFT - 1) {
+        return NET_HIST_SIZE - 1;
+    }
+    return NET_HIST_SUB * (shift + 1)
+           + static_cast<int>(us >> shift) - NET_HIST_SUB;
+}
+
+// największa wartość przedziału index
+qint64 NetHistogram::upper(int index)
+{
+    if (index < NET_HIST_SUB) {
+        return index;
+    }
+    int shift = index / NET_HIST_SUB - 1;
+    qint64 sub = index % NET_HIST_SUB;
+    return ((NET_HIST_SUB + sub + 1) << shift) - 1;
+}
+
+void NetHistogram::record(qint64 us)
+{
+    us = qMax(us, Q_INT64_C(0));
+    bucket[index(us)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(static_cast<quint64>(us), std::memory_order_relaxed);
+    quint64 high = highest.load(std::memory_order_relaxed);
+    while ((static_cast<quint64>(us) > high)
+           && !highest.compare_exchange_weak(high, static_cast<quint64>(us),
+                                             std::memory_order_relaxed)) {
+    }
+}
+
+// wartość, poniżej której jest p procent próbek [us], -1: brak próbek
+qint64 NetHistogram::percentile(double p) const
+{
+    quint64 n = count();
+    if (n == 0) {
+        return -1;
+    }
+    quint64 rank = static_cast<quint64>(p / 100.0 * n + 0.5);
+    rank = qBound(Q_UINT64_C(1), rank, n);
+
+    quint64 seen = 0;
+    for (int i = 0; i < NET_HIST_SIZE; i++) {
+        seen += bucket[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            return qMin(upper(i),
+                        static_cast<qint64>(highest.load(std::memory_order_relaxed)));
+        }
+    }
+    return static_cast<qint64>(highest.load(std::memory_order_relaxed));
+
+} // NetHistogram::percentile
+
+QJsonObject NetHistogram::toJson() const
+{
+    QJsonObject obj;
+    quint64 n = count();
+    obj.insert("count", static_cast<double>(n));
+    if (n == 0) {
+        return obj;
+    }
+    obj.insert("mean_us", static_cast<double>(sum.load(std::memory_order_relaxed)) / n);
+    obj.insert("p50_us", static_cast<double>(percentile(50)));
+    obj.insert("p90_us", static_cast<double>(percentile(90)));
+    obj.insert("p99_us", static_cast<double>(percentile(99)));
+    obj.insert("max_us", static_cast<double>(highest.load(std::memory_order_relaxed)));
+
+    // niepuste przedziały: [górna granica, liczba]
+    QJsonArray buckets;
+    for (int i = 0; i < NET_HIST_SIZE; i++) {
+        quint32 cnt = bucket[i].load(std::memory_order_relaxed);
+        if (cnt > 0) {
+            buckets.append(QJsonArray() << static_cast<double>(upper(i))
+                                        << static_cast<double>(cnt));
+        }
+    }
+    obj.insert("buckets", buckets);
+    return obj;
+
+} // NetHistogram::toJson
+
+NetMetrics::NetMetrics()
+{
+    for (int i = 0; i < CountMax; i++) {
+        counter[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void NetMetrics::reset()
+{
+    for (int i = 0; i < CountMax; i++) {
+        counter[i].store(0, std::memory_order_relaxed);
+    }
+    for (int i = 0; i < LatencyMax; i++) {
+        latency[i].reset();
+    }
+}
+
+QJsonObject NetMetrics::toJson() const
+{
+    QJsonObject counters;
+    for (int i = 0; i < CountMax; i++) {
+        counters.insert(counterName[i],
+                        static_cast<double>(value(static_cast<NetCounter>(i))));
+    }
+    QJsonObject latencies;
+    for (int i = 0; i < LatencyMax; i++) {
+        latencies.insert(latencyName[i], latency[i].toJson());
+    }
+
+    QJsonObject obj;
+    obj.insert("counters", counters);
+    obj.insert("latency", latencies);
+    return obj;
+}
+
+// skrót liczników dla paska stanu
+QString NetMetrics::summary() const
+{
+    return QString("TX %1  RX %2  błędy %3  ponowienia %4")
+            .arg(value(CountSent)).arg(value(CountReceived))
+            .arg(value(CountSendError) + value(CountQueueFull)
+                 + value(CountBadHeader) + value(CountBadLength)
+                 + value(CountBadOpcode))
+            .arg(value(CountRetrans));
+}
+
+// mediana i p99 opóźnień [ms], jeden wiersz na opcode z próbkami
+QString NetMetrics::latencySummary() const
+{
+    QString text;
+    for (int i = 0; i < LatencyMax; i++) {
+        if (latency[i].count() == 0) {
+            continue;
+        }
+        text += QString("%1: p50 %2 ms, p99 %3 ms, n=%4\n")
+                .arg(latencyName[i])
+                .arg(latency[i].percentile(50) / 1000.0, 0, 'f', 1)
+                .arg(latency[i].percentile(99) / 1000.0, 0, 'f', 1)
+                .arg(latency[i].count());
+    }
+    return text.trimmed();
+}
+
+// EOF netmetrics.cpp
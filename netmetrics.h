@@ -0,0 +1,109 @@
+//
+// Wireless Command Station
+//
+// Copyright 2020 Robert Nagowski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// See gpl-3.0.md file for details.
+//
+
+#ifndef NETMETRICS_H
+#define NETMETRICS_H
+
+#include <QJsonObject>
+#include <QString>
+#include <QtGlobal>
+#include <atomic>
+
+#define NET_HIST_SUB        16      // przedziałów na potęgę dwójki (~6%)
+#define NET_HIST_SHIFT      24      // zakres do 2^28 us (268 s)
+#define NET_HIST_SIZE       (NET_HIST_SUB * (NET_HIST_SHIFT + 1))
+
+// liczniki silnika sieciowego
+enum NetCounter {
+    CountSent = 0,      // wysłane datagramy
+    CountReceived,      // odebrane datagramy
+    CountSendError,     // błędy wysyłania
+    CountQueueFull,     // odrzucone przy pełnej kolejce
+    CountBadHeader,     // nieznany header lub datagram za krótki
+    CountBadLength,     // pole bytes niezgodne z rozmiarem
+    CountBadOpcode,     // nieobsługiwany opcode
+    CountRetrans,       // ponowienia: start, okno bloków, skróty stron
+    CountAckDuplicate,  // potwierdzenia powtórzone lub spoza okna
+    CountNoAnswer,      // aktualizacje przerwane brakiem odpowiedzi
+    CountCoalesced,     // polecenia jazdy zastąpione nowszymi
+    CountMax
+};
+
+// opóźnienie żądanie -> odpowiedź według opcode
+enum NetLatency {
+    LatencyDevInfo = 0, // WICS_DEVINFO_GET -> WICS_DEVINFO
+    LatencyWiFi,        // WICS_WIFISTA_GET -> WICS_WIFISTA
+    LatencyUpgradeStart,// WICS_UPGRADE_START -> WICS_UPGRADE, blok 0
+    LatencyUpgradeData, // WICS_UPGRADE_DATA -> WICS_UPGRADE
+    LatencyPageHash,    // WICS_PAGEHASH_GET -> WICS_PAGEHASH
+    LatencyHeartbeat,   // WICS_HEARTBEAT_GET -> WICS_HEARTBEAT
+    LatencyMax
+};
+
+// Histogram log-liniowy (jak HdrHistogram): wartości do NET_HIST_SUB
+// dokładnie, dalej NET_HIST_SUB przedziałów w każdej potędze dwójki.
+// Zapis bez blokad z wątku sieciowego, odczyt z dowolnego wątku.
+class NetHistogram
+{
+    Q_DISABLE_COPY(NetHistogram)
+
+private:
+    std::atomic<quint32> bucket[NET_HIST_SIZE];
+    std::atomic<quint64> total;     // liczba próbek
+    std::atomic<quint64> sum;       // suma próbek [us]
+    std::atomic<quint64> highest;   // największa próbka [us]
+
+public:
+    NetHistogram();
+
+    void record(qint64 us);
+    void reset();
+    quint64 count() const { return total.load(std::memory_order_relaxed); }
+    qint64 percentile(double p) const;
+    QJsonObject toJson() const;
+
+    static int index(qint64 us);
+    static qint64 upper(int index);
+
+}; // NetHistogram
+
+// Liczniki i histogramy opóźnień silnika sieciowego
+class NetMetrics
+{
+    Q_DISABLE_COPY(NetMetrics)
+
+private:
+    std::atomic<quint64> counter[CountMax];
+    NetHistogram latency[LatencyMax];
+
+public:
+    NetMetrics();
+
+    void add(NetCounter c, quint64 n = 1)
+    {
+        counter[c].fetch_add(n, std::memory_order_relaxed);
+    }
+    quint64 value(NetCounter c) const
+    {
+        return counter[c].load(std::memory_order_relaxed);
+    }
+    void record(NetLatency l, qint64 us) { latency[l].record(us); }
+    const NetHistogram& histogram(NetLatency l) const { return latency[l]; }
+
+    void reset();
+    QJsonObject toJson() const;
+    QString summary() const;
+    QString latencySummary() const;
+
+}; // NetMetrics
+
+#endif // NETMETRICS_H
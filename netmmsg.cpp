@@ -0,0 +1,162 @@
+//
+// Wireless Command Station
+//
+// Copyright 2020 Robert Nagowski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// See gpl-3.0.md file for details.
+//
+
+#include "netmmsg.h"
+
+#ifdef WICS_MMSG
+
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+
+NetMmsg::NetMmsg()
+{
+    udpFd = -1;
+    txCount = 0;
+    rxCount = 0;
+
+    memset(txMsg, 0, sizeof(txMsg));
+    memset(rxMsg, 0, sizeof(rxMsg));
+    for (int i = 0; i < NET_MMSG_BATCH; i++) {
+        txMsg[i].msg_hdr.msg_name = &txAddr[i];
+        txMsg[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        txMsg[i].msg_hdr.msg_iov = txIov[i];
+        txIov[i][0].iov_base = txHead[i];
+
+        rxIov[i].iov_base = rxData[i];
+        rxIov[i].iov_len = NET_MMSG_RXSIZE;
+        rxMsg[i].msg_hdr.msg_iov = &rxIov[i];
+        rxMsg[i].msg_hdr.msg_iovlen = 1;
+    }
+
+} // NetMmsg::NetMmsg
+
+NetMmsg::~NetMmsg()
+{
+    if (udpFd != -1) {
+        ::close(udpFd);
+    }
+}
+
+// otwarcie gniazda nieblokującego na wszystkich interfejsach
+bool NetMmsg::bind(quint16 port)
+{
+    udpFd = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (udpFd == -1) {
+        return false;
+    }
+
+    int opt = 1;
+    ::setsockopt(udpFd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    ::setsockopt(udpFd, SOL_SOCKET, SO_BROADCAST, &opt, sizeof(opt));
+
+    struct sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_port = htons(port);
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (::bind(udpFd, reinterpret_cast<struct sockaddr*>(&local),
+               sizeof(local)) == -1) {
+        ::close(udpFd);
+        udpFd = -1;
+        return false;
+    }
+
+    return true;
+
+} // NetMmsg::bind
+
+// dopisanie datagramu do paczki, pełna paczka wysyłana od razu
+bool NetMmsg::add(quint32 addr, quint16 port, const void *head, int hsize,
+                  const void *payload, int psize)
+{
+    if ((hsize > NET_MMSG_HEAD) || ((txCount == NET_MMSG_BATCH) && (flush() < 0))) {
+        return false;
+    }
+
+    int i = txCount++;
+    memset(&txAddr[i], 0, sizeof(struct sockaddr_in));
+    txAddr[i].sin_family = AF_INET;
+    txAddr[i].sin_port = htons(port);
+    txAddr[i].sin_addr.s_addr = htonl(addr);
+
+    memcpy(txHead[i], head, static_cast<size_t>(hsize));
+    txIov[i][0].iov_len = static_cast<size_t>(hsize);
+    txIov[i][1].iov_base = const_cast<void*>(payload);
+    txIov[i][1].iov_len = static_cast<size_t>(psize);
+    txMsg[i].msg_hdr.msg_iovlen = (psize > 0) ? 2 : 1;
+
+    return true;
+
+} // NetMmsg::add
+
+// wysłanie paczki; datagramy, których nie przyjęło gniazdo, są tracone
+int NetMmsg::flush()
+{
+    int sent = 0;
+
+    while (sent < txCount) {
+        int res = ::sendmmsg(udpFd, &txMsg[sent],
+                             static_cast<unsigned int>(txCount - sent), 0);
+        if (res == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN) {
+                // błąd pierwszego datagramu, pozostałe próbujemy dalej
+                sent++;
+                continue;
+            }
+            break;
+        }
+        sent += res;
+    } // while
+
+    int count = txCount;
+    txCount = 0;
+    return (sent == count) ? sent : -1;
+
+} // NetMmsg::flush
+
+// odbiór do NET_MMSG_BATCH datagramów bez czekania
+int NetMmsg::receive()
+{
+    for (int i = 0; i < NET_MMSG_BATCH; i++) {
+        rxMsg[i].msg_hdr.msg_name = &rxAddr[i];
+        rxMsg[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        rxMsg[i].msg_hdr.msg_flags = 0;
+    }
+
+    int res;
+    do {
+        res = ::recvmmsg(udpFd, rxMsg, NET_MMSG_BATCH, MSG_DONTWAIT, nullptr);
+    } while ((res == -1) && (errno == EINTR));
+
+    rxCount = (res > 0) ? res : 0;
+    return rxCount;
+
+} // NetMmsg::receive
+
+quint32 NetMmsg::sender(int i) const
+{
+    return ntohl(rxAddr[i].sin_addr.s_addr);
+}
+
+quint16 NetMmsg::senderPort(int i) const
+{
+    return ntohs(rxAddr[i].sin_port);
+}
+
+#endif // WICS_MMSG
+
+// EOF netmmsg.cpp
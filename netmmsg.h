@@ -0,0 +1,72 @@
+//
+// Wireless Command Station
+//
+// Copyright 2020 Robert Nagowski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// See gpl-3.0.md file for details.
+//
+
+#ifndef NETMMSG_H
+#define NETMMSG_H
+
+#include <QtGlobal>
+
+#ifdef WICS_MMSG
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define NET_MMSG_BATCH      32      // datagramów na jedno wywołanie
+#define NET_MMSG_HEAD       128     // maks. kopiowana część datagramu
+#define NET_MMSG_RXSIZE     2048    // bufor odbiorczy datagramu
+
+// Gniazdo UDP obsługiwane wsadowo przez sendmmsg/recvmmsg (Linux).
+// Wszystkie bufory przydzielone raz, przy tworzeniu obiektu.
+class NetMmsg
+{
+    Q_DISABLE_COPY(NetMmsg)
+
+private:
+    int udpFd;
+    // wysyłanie
+    int txCount;
+    struct mmsghdr     txMsg[NET_MMSG_BATCH];
+    struct iovec       txIov[NET_MMSG_BATCH][2];
+    struct sockaddr_in txAddr[NET_MMSG_BATCH];
+    char               txHead[NET_MMSG_BATCH][NET_MMSG_HEAD];
+    // odbiór
+    int rxCount;
+    struct mmsghdr     rxMsg[NET_MMSG_BATCH];
+    struct iovec       rxIov[NET_MMSG_BATCH];
+    struct sockaddr_in rxAddr[NET_MMSG_BATCH];
+    char               rxData[NET_MMSG_BATCH][NET_MMSG_RXSIZE];
+
+public:
+    NetMmsg();
+    ~NetMmsg();
+
+    bool bind(quint16 port);
+    int socketDescriptor() const { return udpFd; }
+
+    // head kopiowany, payload musi istnieć do wywołania flush()
+    bool add(quint32 addr, quint16 port, const void *head, int hsize,
+             const void *payload = nullptr, int psize = 0);
+    int pending() const { return txCount; }
+    int flush();
+
+    int receive();
+    const char* data(int i) const { return rxData[i]; }
+    int size(int i) const { return static_cast<int>(rxMsg[i].msg_len); }
+    bool truncated(int i) const { return (rxMsg[i].msg_hdr.msg_flags & MSG_TRUNC) != 0; }
+    quint32 sender(int i) const;
+    quint16 senderPort(int i) const;
+
+}; // NetMmsg
+
+#endif // WICS_MMSG
+
+#endif // NETMMSG_H
@@ -0,0 +1,81 @@
+//
+// Wireless Command Station
+//
+// Copyright 2020 Robert Nagowski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// See gpl-3.0.md file for details.
+//
+
+#include "netqueue.h"
+
+#include <cstring>
+
+NetQueue::NetQueue()
+{
+    for (quint64 i = 0; i < NETQ_SLOTS; i++) {
+        ring[i].seq.store(i, std::memory_order_relaxed);
+    }
+    enqPos.store(0, std::memory_order_relaxed);
+    deqPos = 0;
+}
+
+bool NetQueue::push(quint32 addr, const void *data, int size)
+{
+    if ((size < 0) || (size > NETQ_SLOT_SIZE)) {
+        return false;
+    }
+
+    // rezerwacja miejsca
+    Slot *slot;
+    quint64 pos = enqPos.load(std::memory_order_relaxed);
+    for (;;) {
+        slot = &ring[pos & (NETQ_SLOTS - 1)];
+        qint64 dif = static_cast<qint64>(slot->seq.load(std::memory_order_acquire))
+                     - static_cast<qint64>(pos);
+        if (dif == 0) {
+            if (enqPos.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+                break;
+            }
+        }
+        else if (dif < 0) {
+            // kolejka pełna
+            return false;
+        }
+        else {
+            pos = enqPos.load(std::memory_order_relaxed);
+        }
+    } // for
+
+    // wypełnienie i publikacja
+    slot->addr = addr;
+    slot->size = static_cast<quint16>(size);
+    memcpy(slot->data, data, static_cast<size_t>(size));
+    slot->seq.store(pos + 1, std::memory_order_release);
+    return true;
+
+} // NetQueue::push
+
+// najstarszy datagram lub nullptr gdy kolejka pusta
+const NetQueue::Slot* NetQueue::front() const
+{
+    const Slot *slot = &ring[deqPos & (NETQ_SLOTS - 1)];
+    if (slot->seq.load(std::memory_order_acquire) != deqPos + 1) {
+        return nullptr;
+    }
+    return slot;
+}
+
+// zwolnienie miejsca zwróconego przez front()
+void NetQueue::pop()
+{
+    Slot *slot = &ring[deqPos & (NETQ_SLOTS - 1)];
+    slot->seq.store(deqPos + NETQ_SLOTS, std::memory_order_release);
+    deqPos++;
+}
+
+// EOF netqueue.cpp
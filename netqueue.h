@@ -0,0 +1,53 @@
+//
+// Wireless Command Station
+//
+// Copyright 2020 Robert Nagowski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// See gpl-3.0.md file for details.
+//
+
+#ifndef NETQUEUE_H
+#define NETQUEUE_H
+
+#include <QtGlobal>
+#include <atomic>
+
+#define NETQ_SLOT_SIZE      128     // maks. rozmiar datagramu w kolejce
+#define NETQ_SLOTS          256     // liczba miejsc, potęga 2
+
+// Kolejka datagramów wychodzących: wielu producentów, jeden konsument.
+// Stałe miejsca w pierścieniu, bez blokad i alokacji; zachowuje
+// kolejność wstawiania (algorytm D. Vyukova).
+class NetQueue
+{
+public:
+    struct Slot {
+        std::atomic<quint64> seq;
+        quint32 addr;
+        quint16 size;
+        char    data[NETQ_SLOT_SIZE];
+    };
+
+private:
+    Slot ring[NETQ_SLOTS];
+    std::atomic<quint64> enqPos;    // producenci
+    char    pad[64];                // rozdzielenie linii cache
+    quint64 deqPos;                 // konsument
+
+public:
+    NetQueue();
+
+    // producenci, dowolny wątek; false gdy kolejka pełna
+    bool push(quint32 addr, const void *data, int size);
+
+    // konsument, wątek sieciowy
+    const Slot* front() const;
+    void pop();
+
+}; // NetQueue
+
+#endif // NETQUEUE_H
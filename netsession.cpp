@@ -0,0 +1,576 @@
+//
+// Wireless Command Station
+//
+// Copyright 2020 Robert Nagowski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// See gpl-3.0.md file for details.
+//
+
+#include "netsession.h"
+
+#include <algorithm>
+
+NetSession::NetSession(quint32 addr)
+{
+    theAddr = addr;
+    wifi.addr = addr;
+    imageBSize = 0;
+    imagePage = 0;
+    imageProposed = 0;
+    imageFlags = 0;
+    imageBlocks = 0;
+    imageLast = 0;
+    imageBase = 0;
+    imageNext = 0;
+    imageSparse = false;
+    imageCrc = false;
+    imageResume = 0;
+    imageResumeSize = 0;
+    hashPending = 0;
+    imageWindow = 1;
+    retryCount = 0;
+    imageResent = -1;
+    initSentAt = 0;
+    srtt = -1;
+    rttvar = 0;
+    rto = DEF_RTO_INIT;
+    deadline = 0;
+    heardAt = 0;
+    trafficAt = 0;
+    beatSentAt = 0;
+    beatSeq = 0;
+    linkRtt = -1;
+    linkJitter = 0;
+    linkLoss = 0;
+    linkOnline = true;
+}
+
+// przygotowanie aktualizacji, zwraca liczbę bloków; sparse: najpierw
+// skróty stron centralki, wysyłane tylko zmienione bloki i ostatni;
+// bsize: maks. rozmiar danych bloku (MTU), centralce proponowana
+// największa wielokrotność strony modułu; checksum: CRC32C w każdym
+// bloku i skróty obrazu w starcie, gdy są już obliczone
+int NetSession::startUpgrade(const QSharedPointer<NetImage>& img,
+                             int module, int window, bool sparse, int bsize,
+                             bool checksum)
+{
+    switch (module) {
+    case UPGRADE_WLAN:
+        imageBSize = UPG_WLAN_PAGE;
+        break;
+    case UPGRADE_DCCGEN:
+        imageBSize = UPG_DCCG_PAGE;
+        break;
+    default:
+        qDebug("Moduł: %d", module);
+        imageBSize = 256;
+        break;
+    } // switch module
+    imagePage = imageBSize;
+
+    image = img;
+    // ostatni blok jest krótszy lub pusty i kończy transmisję
+    imageBlocks = static_cast<int>(imageSize() / imageBSize) + 1;
+    imageLast = imageBlocks;
+    imageBase = 0;
+    imageNext = 1;
+    imageWindow = qMax(window, 1);
+    imageFlags = static_cast<quint16>(module);
+    retryCount = 0;
+    imageResent = -1;
+    sentAt.fill(0, imageWindow);
+    deadline = 0;
+    imageList.clear();
+    imageCrc = checksum;
+    imageResume = 0;
+
+    // pełne strony 1..imageBlocks-1 porównywane skrótami
+    imageSparse = sparse && (imageBlocks > 1);
+    hashPending = 0;
+    if (imageSparse) {
+        pageHash.fill(0, imageBlocks - 1);
+        hashPending = (imageBlocks - 2) / UPG_HASH_COUNT + 1;
+        hashDone.fill(false, hashPending);
+    }
+    // skróty dotyczą stron, więc w trybie sparse blok równy stronie
+    int fit = qMin(bsize, UPG_MAX_BLOCK) / imageBSize * imageBSize;
+    imageProposed = 0;
+    if (!imageSparse && (fit > imageBSize)) {
+        imageProposed = static_cast<quint16>(fit);
+    }
+
+    return imageBlocks;
+
+} // NetSession::startUpgrade
+
+// wznowienie przerwanej aktualizacji po bloku block (z dziennika), bez
+// skrótów stron; centralka potwierdza, ile bloków zachowała
+void NetSession::resumeFrom(int block, int bsize)
+{
+    if (image.isNull() || !image->hasDigest() || (block <= 0)
+        || (block >= imageBlocks) || (bsize < imageBSize)) {
+        return;
+    }
+    imageSparse = false;
+    hashPending = 0;
+    imageList.clear();
+    imageLast = imageBlocks;
+    imageResume = block;
+    imageResumeSize = bsize;
+    imageProposed = static_cast<quint16>((bsize > imageBSize) ? bsize : 0);
+
+} // NetSession::resumeFrom
+
+// żądania brakujących paczek skrótów stron
+void NetSession::hashFrames(QList<NetFrame<PageHash_dg> >& frames, qint64 now)
+{
+    for (int cnt = 0; cnt < hashDone.count(); cnt++) {
+        if (hashDone.at(cnt)) {
+            continue;
+        }
+        int first = cnt * UPG_HASH_COUNT + 1;
+        NetFrame<PageHash_dg> data(WICS_PAGEHASH_GET);
+        data.set(&PageHash_dg::flags, imageFlags);
+        data.set(&PageHash_dg::first, static_cast<quint16>(first));
+        data.set(&PageHash_dg::count,
+                 static_cast<quint16>(qMin(UPG_HASH_COUNT, imageBlocks - first)));
+        frames.append(data);
+    }
+    deadline = now + rto;
+
+} // NetSession::hashFrames
+
+// skróty stron od centralki; true: komplet, lista bloków gotowa
+bool NetSession::updateHash(const NetView<PageHash_dg>& data)
+{
+    int first = data.get(&PageHash_dg::first);
+    int count = data.get(&PageHash_dg::count);
+    int chunk = (first - 1) / UPG_HASH_COUNT;
+
+    if ((hashPending == 0) || (first < 1) || ((first - 1) % UPG_HASH_COUNT != 0)
+        || (chunk >= hashDone.count()) || hashDone.at(chunk)
+        || ((data.get(&PageHash_dg::flags) & UPGRADE_MODULE_MASK) != imageFlags)
+        || (count != qMin(UPG_HASH_COUNT, imageBlocks - first))
+        || (data.payloadSize() < count * static_cast<int>(sizeof(quint32)))) {
+        qDebug("Page hash: %d+%d odrzucone", first, count);
+        return false;
+    }
+
+    const uchar *hash = data.payload();
+    for (int cnt = 0; cnt < count; cnt++) {
+        pageHash[first - 1 + cnt] = qFromLittleEndian<quint32>(hash + cnt * 4);
+    }
+    hashDone[chunk] = true;
+    retryCount = 0;
+    if (--hashPending > 0) {
+        return false;
+    }
+
+    buildList();
+    return true;
+
+} // NetSession::updateHash
+
+// lista bloków: start, strony o innym skrócie niż w centralce, ostatni
+void NetSession::buildList()
+{
+    const uchar *data = image->data();
+
+    imageList.clear();
+    imageList.append(0);
+    for (int block = 1; block < imageBlocks; block++) {
+        qint64 offset = static_cast<qint64>(block - 1) * imageBSize;
+        if (netPageHash(data + offset, imageBSize) != pageHash.at(block - 1)) {
+            imageList.append(static_cast<quint16>(block));
+        }
+    }
+    imageList.append(static_cast<quint16>(imageBlocks));
+    imageLast = imageList.count() - 1;
+    qDebug("Sparse upgrade: %d/%d bloków", imageLast, imageBlocks);
+
+} // NetSession::buildList
+
+// numer bloku na pozycji pos
+int NetSession::blockAt(int pos) const
+{
+    return imageList.isEmpty() ? pos : imageList.at(pos);
+}
+
+// pozycja bloku w liście wysyłanych, -1: blok nie jest wysyłany
+int NetSession::position(quint16 block) const
+{
+    if (imageList.isEmpty()) {
+        return (block <= imageBlocks) ? block : -1;
+    }
+    QVector<quint16>::const_iterator it =
+            std::lower_bound(imageList.constBegin(), imageList.constEnd(), block);
+    if ((it == imageList.constEnd()) || (*it != block)) {
+        return -1;
+    }
+    return static_cast<int>(it - imageList.constBegin());
+}
+
+// start aktualizacji; bez propozycji rozmiaru bloku i skrótów obrazu
+// w krótszej postaci UpgradeInit_dg, zrozumiałej dla starszych centralek
+void NetSession::initFrame(NetFrame<UpgradeInitResume_dg>& data) const
+{
+    quint16 flags = 0;
+
+    switch (imageFlags) {
+    case UPGRADE_WLAN:
+    case UPGRADE_DCCGEN:
+        flags = static_cast<quint16>(imageFlags | (imageSparse ? UPGRADE_SPARSE : 0)
+                                     | (imageCrc ? UPGRADE_CRC : 0));
+        break;
+    default:
+        break;
+    } // switch imageFlags
+    int size = sizeof(UpgradeInit_dg);
+    if ((flags != 0) && (imageProposed > 0)) {
+        flags |= UPGRADE_BSIZE;
+        data.set(&UpgradeInitResume_dg::bsize, imageProposed);
+        size = sizeof(UpgradeInitSize_dg);
+    }
+    if ((flags != 0) && (imageCrc || (imageResume > 0)) && image->hasDigest()) {
+        // skróty liczone w tle od otwarcia pliku, bez czekania na nie
+        flags |= UPGRADE_DIGEST;
+        data.set(&UpgradeInitResume_dg::crc, image->crc());
+        memcpy(data.text(&UpgradeInitResume_dg::sha256), image->sha256(),
+               UPG_SHA256_SIZE);
+        size = sizeof(UpgradeInitDigest_dg);
+    }
+    if ((flags & UPGRADE_DIGEST) && (imageResume > 0)) {
+        // centralka porównuje skrót i rozmiar bloku z przerwaną aktualizacją
+        flags |= UPGRADE_RESUME;
+        data.set(&UpgradeInitResume_dg::bsize,
+                 static_cast<quint16>(imageResumeSize));
+        data.set(&UpgradeInitResume_dg::resume, static_cast<quint16>(imageResume));
+        size = sizeof(UpgradeInitResume_dg);
+    }
+    data.set(&UpgradeInitResume_dg::bytes, static_cast<quint16>(size));
+    data.set(&UpgradeInitResume_dg::flags, flags);
+    data.set(&UpgradeInitResume_dg::fwsize, static_cast<quint32>(imageSize()));
+
+} // NetSession::initFrame
+
+// rozmiar bloku z potwierdzenia startu, jak NetGroup::join(); zwraca
+// nową liczbę bloków, 0: bez zmian, -1: rozmiar ponad propozycję lub
+// niebędący wielokrotnością strony
+int NetSession::acceptBlockSize(int bsize)
+{
+    if (image.isNull() || (imageBase != 0) || (hashPending > 0)) {
+        return 0;
+    }
+    if (bsize <= 0) {
+        // centralka bez propozycji rozmiaru pisze całymi stronami
+        bsize = imagePage;
+    }
+    if (bsize == imageBSize) {
+        return 0;
+    }
+    if ((bsize > qMax(imageProposed, imagePage)) || (bsize % imagePage != 0)) {
+        qDebug("Block size: %d, proponowany %d", bsize, imageProposed);
+        return -1;
+    }
+
+    imageBSize = static_cast<quint16>(bsize);
+    imageBlocks = static_cast<int>(imageSize() / imageBSize) + 1;
+    imageLast = imageBlocks;
+    imageProposed = 0;
+    return imageBlocks;
+
+} // NetSession::acceptBlockSize
+
+// wynik wznowienia z potwierdzenia startu; zwraca blok, po którym
+// wysyłanie jest kontynuowane, 0: aktualizacja od początku
+int NetSession::acceptResume(int block)
+{
+    if (!resuming()) {
+        return 0;
+    }
+    if ((block <= 0) || (block > imageResume) || (imageBSize != imageResumeSize)) {
+        qDebug("Resume: %d, proponowany %d", block, imageResume);
+        imageResume = 0;
+        return 0;
+    }
+    imageResume = block;
+    // bloki do block włącznie jak wysłane: ackBlock() przyjmie ten blok
+    imageNext = block + 1;
+    return block;
+
+} // NetSession::acceptResume
+
+// start aktualizacji wysłany, oczekiwanie na blok 0
+void NetSession::initSent(qint64 now)
+{
+    initSentAt = now;
+    deadline = now + rto;
+}
+
+// następny blok mieszczący się w oknie
+bool NetSession::nextBlock(NetFrame<UpgradeCrc_dg>& data,
+                           const uchar*& payload, qint64& psize, qint64 now)
+{
+    // imageBase == 0: start aktualizacji nie został jeszcze potwierdzony
+    if (image.isNull() || (imageBase == 0) || (imageNext > imageLast)
+        || (imageNext >= imageBase + imageWindow)) {
+        return false;
+    }
+
+    int block = blockAt(imageNext);
+    qint64 offset = static_cast<qint64>(block - 1) * imageBSize;
+    psize = qBound(Q_INT64_C(0), image->size() - offset,
+                   static_cast<qint64>(imageBSize));
+    payload = image->data() + offset;
+
+    // pole prev wysyłane w trybie sparse lub z CRC, headerSize()
+    data.set(&UpgradeCrc_dg::bytes,
+             static_cast<quint16>(psize + headerSize()));
+    data.set(&UpgradeCrc_dg::flags, static_cast<quint16>(
+                 imageFlags | (imageSparse ? UPGRADE_SPARSE : 0)
+                 | (imageCrc ? UPGRADE_CRC : 0)));
+    data.set(&UpgradeCrc_dg::block, static_cast<quint16>(block));
+    data.set(&UpgradeCrc_dg::prev,
+             static_cast<quint16>(blockAt(imageNext - 1)));
+    if (imageCrc) {
+        data.set(&UpgradeCrc_dg::crc, netCrc32c(payload, psize));
+    }
+    if (imageNext == imageBase) {
+        // pierwszy niepotwierdzony blok uruchamia odliczanie
+        deadline = now + rto;
+    }
+    sentAt[imageNext % imageWindow] = now;
+    imageNext++;
+
+    return true;
+
+} // NetSession::nextBlock
+
+// blok nie został wysłany, zostanie pobrany ponownie
+void NetSession::blockFailed(int block)
+{
+    int pos = position(static_cast<quint16>(block));
+    if (pos > 0) {
+        imageNext = qMin(imageNext, pos);
+    }
+}
+
+// próbka RTT z pierwszego potwierdzenia bloku wysłanego jeden raz
+// (algorytm Karna); block 0 potwierdza start aktualizacji. Zwraca
+// próbkę [ms], -1: bez próbki, -2: potwierdzenie powtórzone lub spoza okna
+int NetSession::sampleAck(quint16 block, qint64 now)
+{
+    qint64 sent;
+    int r = -1;
+    int pos = position(block);
+    if (hashPending > 0) {
+        return -2;
+    }
+    if ((block == 0) && (imageBase == 0)) {
+        sent = initSentAt;
+    }
+    else if ((pos >= imageBase) && (pos < imageNext)) {
+        sent = sentAt.value(pos % imageWindow);
+    }
+    else {
+        return -2;
+    }
+
+    if ((pos > imageResent) && (sent > 0)) {
+        r = static_cast<int>(now - sent);
+        rttSample(r);
+    }
+    // centralka odpowiada: termin liczony od odbioru, nie od ackBlock()
+    if (deadline > 0) {
+        deadline = now + rto;
+    }
+    return r;
+
+} // NetSession::sampleAck
+
+// próbka RTT dla limitu czasu ponowień (RFC 6298)
+void NetSession::rttSample(int r)
+{
+    if (srtt < 0) {
+        srtt = r;
+        rttvar = r / 2;
+    }
+    else {
+        rttvar = (3 * rttvar + qAbs(srtt - r)) / 4;
+        srtt = (7 * srtt + r) / 8;
+    }
+    rto = qBound(DEF_RTO_MIN, srtt + qMax(10, 4 * rttvar), DEF_RTO_MAX);
+}
+
+// potwierdzenie bloków do numeru block włącznie
+bool NetSession::ackBlock(quint16 block, qint64 now)
+{
+    int pos = position(block);
+    // tylko bloki już wysłane; przed potwierdzeniem startu blok 0 albo
+    // ostatni blok zachowany w centralce (acceptResume()), późne
+    // potwierdzenie z przerwanej aktualizacji nie pomija bloków
+    bool fSent = (imageBase == 0) ? (pos == imageNext - 1)
+                                  : ((pos >= imageBase) && (pos < imageNext));
+    if ((hashPending == 0) && fSent && (pos <= imageLast)) {
+        // potwierdzenie zbiorcze: wszystkie bloki do block odebrane
+        imageBase = pos + 1;
+        imageNext = qMax(imageNext, imageBase);
+        retryCount = 0;
+        // postęp: odliczanie od nowa dla pozostałych bloków
+        deadline = (imageNext > imageBase) ? now + rto : 0;
+        if (imageBase > imageLast) {
+            // ostatni blok potwierdzony, zwolnienie pliku
+            image.clear();
+            deadline = 0;
+        }
+        return true;
+    }
+
+    // duplikat lub potwierdzenie niewysłanego bloku, CountAckDuplicate
+    // w NetEngine::emitUpgradeStep() z sampleAck()
+    return false;
+
+} // NetSession::ackBlock
+
+// ponowienie wysłania niepotwierdzonych bloków
+void NetSession::rewind()
+{
+    if (imageBase > 0) {
+        qDebug("Resend blocks: %d-%d", blockAt(imageBase),
+               blockAt(qMax(imageNext - 1, imageBase)));
+        imageResent = qMax(imageResent, imageNext - 1);
+        imageNext = imageBase;
+        retryCount++;
+    }
+}
+
+// przekroczony termin potwierdzenia: podwojenie RTO i ponowienie
+int NetSession::timeout(qint64 now)
+{
+    if (image.isNull() || (deadline == 0) || (now < deadline)) {
+        return TimeoutNone;
+    }
+    if (hashPending > 0) {
+        if (retryCount < DEF_MAX_RETRANS) {
+            rto = qMin(rto * 2, DEF_RTO_MAX);
+            deadline = now + rto;
+            retryCount++;
+            return TimeoutHash;
+        }
+        // centralka bez skrótów stron: pełna aktualizacja
+        qDebug("Page hash: brak odpowiedzi, pełna aktualizacja");
+        hashPending = 0;
+        imageSparse = false;
+        imageList.clear();
+        imageLast = imageBlocks;
+        retryCount = 0;
+        initSentAt = now;
+        deadline = now + rto;
+        return TimeoutInit;
+    }
+    if (retryCount >= DEF_MAX_RETRANS) {
+        stopUpgrade();
+        return TimeoutFailed;
+    }
+
+    rto = qMin(rto * 2, DEF_RTO_MAX);
+    deadline = now + rto;
+    if (imageBase == 0) {
+        imageResent = qMax(imageResent, 0);
+        initSentAt = now;
+        retryCount++;
+        return TimeoutInit;
+    }
+    rewind();
+    return TimeoutData;
+
+} // NetSession::timeout
+
+void NetSession::stopUpgrade()
+{
+    image.clear();
+    imageBase = 0;
+    imageBlocks = 0;
+    imageLast = 0;
+    imageList.clear();
+    hashPending = 0;
+    imageResume = 0;
+    deadline = 0;
+}
+
+// heartbeat co interval; bez wysyłania, gdy centralka odpowiadała
+// w tym okresie (np. potwierdzenia aktualizacji). Heartbeat bez
+// odpowiedzi do następnego okresu liczy się jako utracony.
+bool NetSession::heartbeat(NetFrame<NetDatagram_dg>& data, qint64 now, int interval)
+{
+    if (beatSentAt > 0) {
+        linkLoss += (1000 - linkLoss) / 8;
+        beatSentAt = 0;
+    }
+    if (heardAt == 0) {
+        // nic jeszcze nie odebrano: stan offline liczony od pierwszego heartbeat
+        heardAt = now - interval;
+    }
+    if ((trafficAt > 0) && (now - trafficAt < interval)) {
+        return false;
+    }
+
+    beatSeq++;
+    beatSentAt = now;
+    data.set(&NetDatagram_dg::param, beatSeq);
+    return true;
+
+} // NetSession::heartbeat
+
+// odpowiedź na heartbeat; zwraca RTT [ms], -1: odpowiedź spóźniona
+// lub powtórzona
+int NetSession::heartbeatReply(quint16 seq, qint64 now)
+{
+    heardAt = now;
+    if ((beatSentAt == 0) || (seq != beatSeq)) {
+        return -1;
+    }
+
+    int r = static_cast<int>(now - beatSentAt);
+    beatSentAt = 0;
+    linkLoss -= linkLoss / 8;
+    if (linkRtt >= 0) {
+        // J += (|D| - J) / 16, w jednostkach 1/16 ms bez utraty precyzji
+        linkJitter += qAbs(r - linkRtt) - (linkJitter + 8) / 16;
+    }
+    linkRtt = r;
+    if (image.isNull()) {
+        // estymator RTO gotowy przed następną aktualizacją; w czasie
+        // aktualizacji próbki z potwierdzeń bloków (zapis flash)
+        rttSample(r);
+    }
+    return r;
+
+} // NetSession::heartbeatReply
+
+// zmiana stanu łącza: 1: centralka znów odpowiada, -1: offline, 0: bez zmian
+int NetSession::linkCheck(qint64 now, int interval)
+{
+    bool fOnline = (heardAt > 0) && (now - heardAt < DEF_HEARTBEAT_LOST * interval);
+    if (fOnline == linkOnline) {
+        return 0;
+    }
+    linkOnline = fOnline;
+    return fOnline ? 1 : -1;
+}
+
+NetLink NetSession::link() const
+{
+    NetLink l;
+    l.online = linkOnline;
+    l.rtt = linkRtt;
+    l.jitter = linkJitter / 16;
+    l.loss = linkLoss;
+    return l;
+}
+
+// EOF netsession.cpp
@@ -0,0 +1,152 @@
+//
+// Wireless Command Station
+//
+// Copyright 2020 Robert Nagowski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// See gpl-3.0.md file for details.
+//
+
+#ifndef NETSESSION_H
+#define NETSESSION_H
+
+#include <QList>
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+
+#include "datagrams.h"
+#include "netcodec.h"
+#include "netdevice.h"
+#include "netimage.h"
+
+// jakość łącza z centralką według heartbeat
+struct NetLink {
+    bool    online;
+    int     rtt;                // [ms], -1: brak próbki
+    int     jitter;             // [ms]
+    int     loss;               // [‰]
+};
+
+// Stan komunikacji z jedną centralką, identyfikowaną adresem
+class NetSession
+{
+private:
+    quint32     theAddr;        // adres centralki
+    WiFiStation wifi;           // ostatnio odczytana konfiguracja WiFi
+    QSharedPointer<NetImage> image;     // aktualizowany firmware
+    quint16     imageBSize;     // rozmiar bloku danych
+    quint16     imagePage;      // rozmiar strony modułu
+    quint16     imageProposed;  // proponowany rozmiar bloku, 0: strona
+    quint16     imageFlags;
+    int         imageBlocks;    // liczba bloków
+    int         imageLast;      // pozycja ostatniego bloku
+    int         imageBase;      // pozycja pierwszego niepotwierdzonego bloku
+    int         imageNext;      // pozycja następnego bloku do wysłania
+    bool        imageSparse;    // tylko bloki różniące się od centralki
+    bool        imageCrc;       // CRC32C bloków i skróty obrazu
+    int         imageResume;    // wznowienie po tym bloku, 0: od początku
+    int         imageResumeSize;    // rozmiar bloku przerwanej aktualizacji
+    QVector<quint16> imageList; // bloki do wysłania według pozycji,
+                                // pusta: wszystkie bloki (pozycja == blok)
+    QVector<quint32> pageHash;  // skróty stron 1..imageBlocks-1 centralki
+    QVector<bool> hashDone;     // odebrane paczki skrótów
+    int         hashPending;    // liczba brakujących paczek skrótów
+    int         imageWindow;    // maks. liczba niepotwierdzonych bloków
+    int         retryCount;     // ponowienia od ostatniego postępu
+    int         imageResent;    // najwyższa pozycja wysłana ponownie
+    QVector<qint64> sentAt;     // czas wysłania bloków okna [ms]
+    qint64      initSentAt;     // czas wysłania startu aktualizacji [ms]
+    // limit czasu ponowienia jak RFC 6298
+    int         srtt;           // wygładzony RTT [ms], -1: brak próbki
+    int         rttvar;         // zmienność RTT [ms]
+    int         rto;            // limit czasu z backoff [ms]
+    qint64      deadline;       // termin ponowienia [ms], 0: brak
+    // stan łącza: heartbeat bezczynnej centralki
+    qint64      heardAt;        // ostatni datagram od centralki [ms]
+    qint64      trafficAt;      // ostatni datagram poza heartbeat [ms]
+    qint64      beatSentAt;     // heartbeat bez odpowiedzi [ms], 0: brak
+    quint16     beatSeq;        // numer ostatniego heartbeat
+    int         linkRtt;        // ostatni RTT heartbeat [ms], -1: brak
+    int         linkJitter;     // rozrzut RTT jak RFC 3550 [1/16 ms]
+    int         linkLoss;       // utrata heartbeat, średnia wykładnicza [‰]
+    bool        linkOnline;
+
+    void rttSample(int r);
+
+    int blockAt(int pos) const;
+    int position(quint16 block) const;
+    void buildList();
+
+public:
+    explicit NetSession(quint32 addr);
+
+    quint32 address() const { return theAddr; }
+
+    void setWiFi(const WiFiStation& sta) { wifi = sta; }
+    const WiFiStation& wiFi() const { return wifi; }
+
+    int startUpgrade(const QSharedPointer<NetImage>& img, int module,
+                     int window, bool sparse = false, int bsize = 0,
+                     bool checksum = false);
+    void hashFrames(QList<NetFrame<PageHash_dg> >& frames, qint64 now);
+    bool updateHash(const NetView<PageHash_dg>& data);
+    void resumeFrom(int block, int bsize);
+    void initFrame(NetFrame<UpgradeInitResume_dg>& data) const;
+    void initSent(qint64 now);
+    int acceptBlockSize(int bsize);
+    int acceptResume(int block);
+    bool nextBlock(NetFrame<UpgradeCrc_dg>& data, const uchar*& payload,
+                   qint64& psize, qint64 now);
+    void blockFailed(int block);
+    int sampleAck(quint16 block, qint64 now);
+    bool ackBlock(quint16 block, qint64 now);
+    void rewind();
+    int timeout(qint64 now);
+    void stopUpgrade();
+
+    void heard(qint64 now) { heardAt = trafficAt = now; }
+    bool heartbeat(NetFrame<NetDatagram_dg>& data, qint64 now, int interval);
+    int heartbeatReply(quint16 seq, qint64 now);
+    int linkCheck(qint64 now, int interval);
+    NetLink link() const;
+
+    qint64 retransmitAt() const { return deadline; }
+    int rtoTime() const { return rto; }
+    int rttTime() const { return srtt; }
+
+    bool upgradeActive() const { return !image.isNull(); }
+    QSharedPointer<NetImage> upgradeImage() const { return image; }
+    qint64 imageSize() const { return image.isNull() ? 0 : image->size(); }
+    int blocks() const { return imageBlocks; }
+    int blockSize() const { return imageBSize; }
+    int sendBlocks() const { return imageLast; }
+    bool hashPhase() const { return hashPending > 0; }
+    bool sparse() const { return imageSparse; }
+    bool resuming() const { return (imageResume > 0) && (imageBase == 0); }
+    int module() const { return imageFlags; }
+    int headerSize() const
+    {
+        if (imageCrc) {
+            return static_cast<int>(sizeof(UpgradeCrc_dg));
+        }
+        return static_cast<int>(imageSparse ? sizeof(UpgradeSparse_dg)
+                                            : sizeof(UpgradeData_dg));
+    }
+    int retries() const { return retryCount; }
+
+}; // NetSession
+
+// wynik NetSession::timeout()
+enum NetTimeout {
+    TimeoutNone = 0,
+    TimeoutHash,        // ponowienie brakujących skrótów stron
+    TimeoutInit,        // ponowienie startu aktualizacji
+    TimeoutData,        // ponowienie bloków okna
+    TimeoutFailed       // limit ponowień wyczerpany
+};
+
+#endif // NETSESSION_H
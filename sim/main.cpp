@@ -0,0 +1,125 @@
+//
+// Wireless Command Station
+//
+// Copyright 2020 Robert Nagowski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// See gpl-3.0.md file for details.
+//
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QHostAddress>
+#include <QList>
+#include <QTextStream>
+
+#include "simstation.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("wics_sim");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Symulator centralek WiCS");
+    parser.addHelpOption();
+    QCommandLineOption optCount(QStringList() << "n" << "count",
+        "Liczba centralek na kolejnych adresach.", "n", "1");
+    QCommandLineOption optAddr(QStringList() << "a" << "address",
+        "Adres pierwszej centralki.", "addr", "127.0.0.2");
+    QCommandLineOption optPort(QStringList() << "p" << "port",
+        "Port UDP centralek.", "port", QString::number(DEF_LAN_PORTNUM));
+    QCommandLineOption optSerial("serial",
+        "Numer seryjny pierwszej centralki (hex).", "hex", "51000001");
+    QCommandLineOption optLoss("loss", "Utrata datagramów [%].", "pct", "0");
+    QCommandLineOption optRtt("rtt", "Opóźnienie odpowiedzi [ms].", "ms", "0");
+    QCommandLineOption optJitter("jitter", "Rozrzut opóźnienia [ms].", "ms", "0");
+    QCommandLineOption optReorder("reorder", "Zmiana kolejności odpowiedzi [%].",
+                                  "pct", "0");
+    QCommandLineOption optFlash("flash", "Zapis strony firmware [ms].", "ms", "0");
+    QCommandLineOption optBlock("max-block",
+        "Maks. rozmiar bloku aktualizacji, 0: tylko strona.", "bytes",
+        QString::number(SIM_MAX_BLOCK));
+    QCommandLineOption optOut(QStringList() << "o" << "out",
+        "Katalog odebranych obrazów.", "dir", ".");
+    QCommandLineOption optBroadcast("broadcast",
+        "Odbiór żądań rozgłoszeniowych i aktualizacji grupowej na porcie centralek.");
+    parser.addOption(optCount);
+    parser.addOption(optAddr);
+    parser.addOption(optPort);
+    parser.addOption(optSerial);
+    parser.addOption(optLoss);
+    parser.addOption(optRtt);
+    parser.addOption(optJitter);
+    parser.addOption(optReorder);
+    parser.addOption(optFlash);
+    parser.addOption(optBlock);
+    parser.addOption(optOut);
+    parser.addOption(optBroadcast);
+    parser.process(a);
+
+    SimConfig cfg;
+    cfg.loss    = qBound(0, parser.value(optLoss).toInt(), 100);
+    cfg.rtt     = qMax(0, parser.value(optRtt).toInt());
+    cfg.jitter  = qMax(0, parser.value(optJitter).toInt());
+    cfg.reorder = qBound(0, parser.value(optReorder).toInt(), 100);
+    cfg.flash   = qMax(0, parser.value(optFlash).toInt());
+    cfg.maxBlock = qBound(0, parser.value(optBlock).toInt(), 0xFFFF);
+    cfg.outDir  = parser.value(optOut);
+
+    int     count  = qMax(1, parser.value(optCount).toInt());
+    quint32 addr   = QHostAddress(parser.value(optAddr)).toIPv4Address();
+    quint16 port   = static_cast<quint16>(parser.value(optPort).toUInt());
+    quint32 serial = parser.value(optSerial).toUInt(nullptr, 16);
+
+    QList<SimStation*> stations;
+    for (int cnt = 0; cnt < count; cnt++) {
+        SimStation *s = new SimStation(addr + static_cast<quint32>(cnt), port,
+                                       serial + static_cast<quint32>(cnt), cfg, &a);
+        if (!s->open()) {
+            QTextStream(stderr) << "Nie można otworzyć "
+                                << QHostAddress(s->address()).toString()
+                                << ":" << port << "\n";
+            return 1;
+        }
+        stations.append(s);
+    }
+
+    // żądania rozgłoszeniowe: gniazdo na wszystkich adresach przekazuje
+    // datagram każdej centralce, odpowiedzi idą z gniazd centralek
+    QUdpSocket hub;
+    if (parser.isSet(optBroadcast)) {
+        if (!hub.bind(QHostAddress::AnyIPv4, port,
+                      QUdpSocket::ShareAddress | QUdpSocket::ReuseAddressHint)) {
+            QTextStream(stderr) << "Nie można otworzyć portu " << port << "\n";
+            return 1;
+        }
+        QObject::connect(&hub, &QUdpSocket::readyRead, [&hub, &stations]() {
+            QByteArray datagram;
+            while (hub.hasPendingDatagrams()) {
+                quint16      senderPort;
+                QHostAddress senderAddr;
+                datagram.resize(static_cast<int>(hub.pendingDatagramSize()));
+                if (-1 == hub.readDatagram(datagram.data(), datagram.size(),
+                                           &senderAddr, &senderPort)) {
+                    continue;
+                }
+                for (int cnt = 0; cnt < stations.count(); cnt++) {
+                    stations.at(cnt)->processDatagram(senderAddr.toIPv4Address(),
+                                                      senderPort, datagram);
+                }
+            }
+        });
+    }
+
+    QTextStream(stdout) << "wics_sim: " << count << " centralek od "
+                        << QHostAddress(addr).toString() << ":" << port << "\n";
+
+    return a.exec();
+
+} // main
+
+// EOF main.cpp
@@ -0,0 +1,533 @@
+//
+// Wireless Command Station
+//
+// Copyright 2020 Robert Nagowski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// See gpl-3.0.md file for details.
+//
+
+#include "simstation.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QHostAddress>
+#include <QTimer>
+
+// datagramy odbierane przez centralkę
+const NetHandler<SimStation> SimStation::handlers[] = {
+    netHandler<SimStation, WICS_DEVINFO_GET,   &SimStation::devInfoReq>(),
+    netHandler<SimStation, WICS_WIFISTA_GET,   &SimStation::wiFiStaReq>(),
+    netHandler<SimStation, WICS_WIFISTA,       &SimStation::wiFiSta>(),
+    netHandler<SimStation, WICS_UPGRADE_START, &SimStation::upgradeStart>(),
+    netHandler<SimStation, WICS_UPGRADE_DATA,  &SimStation::upgradeData>(),
+    netHandler<SimStation, WICS_PAGEHASH_GET,  &SimStation::pageHashReq>(),
+    netHandler<SimStation, WICS_HEARTBEAT_GET, &SimStation::heartbeatReq>(),
+    netHandler<SimStation, WICS_UPGRADE_POLL,  &SimStation::pollReq>()
+};
+
+SimStation::SimStation(quint32 addr, quint16 port, quint32 serial,
+                       const SimConfig& config, QObject *parent)
+          : QObject(parent),
+            rnd(serial)
+{
+    theAddr = addr;
+    thePort = port;
+    serialNum = serial;
+    cfg = config;
+    memset(ssid, 0, sizeof(ssid));
+    memset(pass, 0, sizeof(pass));
+    strncpy(ssid, "wics-sim", MAX_WLAN_NAME);
+    module = 0;
+    pageSize = 0;
+    blockSize = 0;
+    imageSize = 0;
+    imageNext = 0;
+    imageAcked = 0;
+    imageSparse = false;
+    imageCrc = false;
+    imageDigest = false;
+    imageGroup = false;
+    imageBlocks = 0;
+    groupResult = RESULT_OK;
+    digestCrc = 0;
+    flashBusy = 0;
+    peerPort = 0;
+}
+
+// gniazdo współdzielone z gniazdem rozgłoszeń (main.cpp)
+bool SimStation::open()
+{
+    if (!udpSocket.bind(QHostAddress(theAddr), thePort,
+                        QUdpSocket::ShareAddress | QUdpSocket::ReuseAddressHint)) {
+        return false;
+    }
+    connect(&udpSocket, SIGNAL(readyRead()), this, SLOT(readDatagrams()));
+    return true;
+}
+
+void SimStation::readDatagrams()
+{
+    QByteArray datagram;
+
+    while (udpSocket.hasPendingDatagrams()) {
+        quint16      senderPort;
+        QHostAddress senderAddr;
+        datagram.resize(static_cast<int>(udpSocket.pendingDatagramSize()));
+        if (-1 != udpSocket.readDatagram(datagram.data(), datagram.size(),
+                                         &senderAddr, &senderPort)) {
+            processDatagram(senderAddr.toIPv4Address(), senderPort, datagram);
+        }
+    }
+
+} // SimStation::readDatagrams
+
+void SimStation::processDatagram(quint32 addr, quint16 port,
+                                 const QByteArray& datagram)
+{
+    if (lost()) {
+        return;
+    }
+    peerPort = port;
+    if (netDispatch(handlers, *this, addr, datagram.constData(),
+                    datagram.size()) != DecodeOk) {
+        qDebug("%s: nieznany datagram %s",
+               QHostAddress(theAddr).toString().toLatin1().data(),
+               datagram.toHex().data());
+    }
+}
+
+bool SimStation::lost()
+{
+    return (cfg.loss > 0) && (static_cast<int>(rnd() % 100) < cfg.loss);
+}
+
+// wysłanie odpowiedzi po opóźnieniu; busy: czas zajęcia centralki [ms]
+void SimStation::reply(quint32 addr, const void *data, int size, int busy)
+{
+    if (lost()) {
+        return;
+    }
+
+    int delay = busy + cfg.rtt;
+    if (cfg.jitter > 0) {
+        delay += static_cast<int>(rnd() % static_cast<unsigned>(2 * cfg.jitter + 1))
+                 - cfg.jitter;
+    }
+    if ((cfg.reorder > 0) && (static_cast<int>(rnd() % 100) < cfg.reorder)) {
+        // następne odpowiedzi wyprzedzą tę
+        delay += cfg.rtt + cfg.jitter + 1;
+    }
+
+    QByteArray dg(static_cast<const char*>(data), size);
+    quint16 port = peerPort;
+    if (delay <= 0) {
+        udpSocket.writeDatagram(dg, QHostAddress(addr), port);
+        return;
+    }
+    QTimer::singleShot(delay, this, [this, dg, addr, port]() {
+        udpSocket.writeDatagram(dg, QHostAddress(addr), port);
+    });
+
+} // SimStation::reply
+
+void SimStation::replyState(quint32 addr, quint16 block, quint16 result, int busy)
+{
+    NetFrame<UpgradeState_dg> data(WICS_UPGRADE);
+    data.set(&UpgradeState_dg::block, block);
+    data.set(&UpgradeState_dg::result, result);
+    reply(addr, data.data(), data.size(), busy);
+}
+
+void SimStation::devInfoReq(quint32 addr, const NetView<NetDatagram_dg>& data)
+{
+    Q_UNUSED(data)
+    NetFrame<DeviceInfo_dg> info(WICS_DEVINFO);
+    info.set(&DeviceInfo_dg::hardware, HW_NGS_WICS);
+    info.set(&DeviceInfo_dg::hwVersion, 100);
+    info.set(&DeviceInfo_dg::swVersion, 0x01000000);
+    info.set(&DeviceInfo_dg::fwVersion, 0x01000000);
+    info.set(&DeviceInfo_dg::serialNum, serialNum);
+    reply(addr, info.data(), info.size());
+}
+
+void SimStation::wiFiStaReq(quint32 addr, const NetView<NetDatagram_dg>& data)
+{
+    Q_UNUSED(data)
+    NetFrame<WiFiStation_dg> sta(WICS_WIFISTA);
+    memcpy(sta.text(&WiFiStation_dg::ssid), ssid, MAX_WLAN_NAME + 1);
+    memcpy(sta.text(&WiFiStation_dg::pass), pass, MAX_WLAN_PASS + 1);
+    reply(addr, sta.data(), sta.size());
+}
+
+// heartbeat: numer kolejny odsyłany bez zmian
+void SimStation::heartbeatReq(quint32 addr, const NetView<NetDatagram_dg>& data)
+{
+    NetFrame<NetDatagram_dg> beat(WICS_HEARTBEAT);
+    beat.set(&NetDatagram_dg::param, data.get(&NetDatagram_dg::param));
+    reply(addr, beat.data(), beat.size());
+}
+
+void SimStation::wiFiSta(quint32 addr, const NetView<WiFiStation_dg>& data)
+{
+    Q_UNUSED(addr)
+    memcpy(ssid, data.text(&WiFiStation_dg::ssid), MAX_WLAN_NAME);
+    memcpy(pass, data.text(&WiFiStation_dg::pass), MAX_WLAN_PASS);
+    ssid[MAX_WLAN_NAME] = 0;
+    pass[MAX_WLAN_PASS] = 0;
+}
+
+// start aktualizacji: potwierdzenie blokiem 0, z rozmiarem bloku
+// (wielokrotność strony), gdy program go zaproponował; UPGRADE_RESUME
+// kontynuuje przerwaną aktualizację tego samego obrazu
+void SimStation::upgradeStart(quint32 addr, const NetView<UpgradeInit_dg>& data)
+{
+    // przerwana aktualizacja: bloki 1..imageAcked w imageData
+    int keptModule = (imageNext > 0) ? module : 0;
+    int keptBlocks = imageAcked;
+    int keptSize = blockSize;
+    quint32 keptImage = imageSize;
+    QByteArray keptSha = imageDigest ? digestSha : QByteArray();
+
+    module = data.get(&UpgradeInit_dg::flags) & UPGRADE_MODULE_MASK;
+    switch (module) {
+    case UPGRADE_WLAN:
+        pageSize = UPG_WLAN_PAGE;
+        break;
+    case UPGRADE_DCCGEN:
+        pageSize = UPG_DCCG_PAGE;
+        break;
+    default:
+        replyState(addr, 0, SIM_RESULT_ERROR);
+        return;
+    } // switch module
+
+    quint16 flags = data.get(&UpgradeInit_dg::flags);
+    imageSize = data.get(&UpgradeInit_dg::fwsize);
+    imageNext = 1;
+    imageAcked = 0;
+    imageSparse = (flags & UPGRADE_SPARSE) != 0;
+    imageCrc = (flags & UPGRADE_CRC) != 0;
+    imageGroup = (flags & UPGRADE_GROUP) != 0;
+    groupResult = RESULT_OK;
+    imageDigest = (flags & UPGRADE_DIGEST)
+                  && (data.bytes() >= static_cast<int>(sizeof(UpgradeInitDigest_dg)));
+    if (imageDigest) {
+        NetView<UpgradeInitDigest_dg> init = data.as<UpgradeInitDigest_dg>();
+        digestCrc = init.get(&UpgradeInitDigest_dg::crc);
+        digestSha = QByteArray(init.text(&UpgradeInitDigest_dg::sha256),
+                               UPG_SHA256_SIZE);
+    }
+    blockSize = pageSize;
+    bool fSize = (flags & UPGRADE_BSIZE) && (cfg.maxBlock > 0)
+                 && (data.bytes() >= static_cast<int>(sizeof(UpgradeInitSize_dg)));
+    if (fSize) {
+        int bsize = qMin(static_cast<int>(data.as<UpgradeInitSize_dg>()
+                                          .get(&UpgradeInitSize_dg::bsize)),
+                         cfg.maxBlock);
+        blockSize = qMax(bsize / pageSize, 1) * pageSize;
+    }
+    if ((flags & UPGRADE_RESUME) && imageDigest
+        && (data.bytes() >= static_cast<int>(sizeof(UpgradeInitResume_dg)))) {
+        NetView<UpgradeInitResume_dg> init = data.as<UpgradeInitResume_dg>();
+        int resume = 0;
+        if ((keptModule == module) && (keptBlocks > 0) && (keptSha == digestSha)
+            && (keptImage == imageSize) && (keptSize == blockSize)
+            && (init.get(&UpgradeInitResume_dg::bsize) == blockSize)) {
+            // imageData bez zmian, dalej od następnego bloku
+            resume = qMin(keptBlocks, static_cast<int>(init.get(&UpgradeInitResume_dg::resume)));
+            imageAcked = resume;
+            imageNext = resume + 1;
+        }
+        else {
+            imageData.clear();
+        }
+        NetFrame<UpgradeStateResume_dg> state(WICS_UPGRADE);
+        state.set(&UpgradeStateResume_dg::block, 0);
+        state.set(&UpgradeStateResume_dg::result, RESULT_OK);
+        state.set(&UpgradeStateResume_dg::bsize, static_cast<quint16>(blockSize));
+        state.set(&UpgradeStateResume_dg::resume, static_cast<quint16>(resume));
+        reply(addr, state.data(), state.size());
+        return;
+    }
+    if (imageGroup) {
+        // bloki grupy zapisywane w dowolnej kolejności
+        imageBlocks = static_cast<int>(imageSize) / blockSize + 1;
+        received = QByteArray(imageBlocks + 1, 0);
+        imageData = QByteArray(static_cast<int>(imageSize), 0);
+    }
+    else if (imageSparse) {
+        // pominięte bloki pozostają jak w pamięci flash
+        imageData = flashImage(module);
+    }
+    else {
+        imageData.clear();
+    }
+    imageData.reserve(static_cast<int>(imageSize));
+    if (fSize) {
+        NetFrame<UpgradeStateSize_dg> state(WICS_UPGRADE);
+        state.set(&UpgradeStateSize_dg::block, 0);
+        state.set(&UpgradeStateSize_dg::result, RESULT_OK);
+        state.set(&UpgradeStateSize_dg::bsize, static_cast<quint16>(blockSize));
+        reply(addr, state.data(), state.size());
+        return;
+    }
+    replyState(addr, 0, RESULT_OK);
+
+} // SimStation::upgradeStart
+
+// blok danych: przyjmowany tylko w kolejności (w trybie sparse po bloku
+// prev), inne potwierdzają ostatni zapisany blok (także po zakończeniu);
+// blok z błędnym CRC32C jest pomijany jak utracony. Bloki grupy tylko
+// w trybie grupowym, bez potwierdzeń
+void SimStation::upgradeData(quint32 addr, const NetView<UpgradeData_dg>& data)
+{
+    int block = data.get(&UpgradeData_dg::block);
+    int prev = block - 1;
+    int hsize = static_cast<int>(sizeof(UpgradeData_dg));
+
+    if (((data.get(&UpgradeData_dg::flags) & UPGRADE_GROUP) != 0) != imageGroup) {
+        return;
+    }
+
+    if (imageCrc) {
+        if (data.bytes() < static_cast<int>(sizeof(UpgradeCrc_dg))) {
+            return;
+        }
+        prev = data.as<UpgradeCrc_dg>().get(&UpgradeCrc_dg::prev);
+        hsize = static_cast<int>(sizeof(UpgradeCrc_dg));
+    }
+    else if (imageSparse && (data.bytes() >= static_cast<int>(sizeof(UpgradeSparse_dg)))) {
+        prev = data.as<UpgradeSparse_dg>().get(&UpgradeSparse_dg::prev);
+        hsize = static_cast<int>(sizeof(UpgradeSparse_dg));
+    }
+    int psize = data.bytes() - hsize;
+    const char *payload = reinterpret_cast<const char*>(data.payload())
+                          + (hsize - static_cast<int>(sizeof(UpgradeData_dg)));
+    if (imageCrc && (netCrc32c(payload, psize)
+                     != data.as<UpgradeCrc_dg>().get(&UpgradeCrc_dg::crc))) {
+        qDebug("Blok %d: błędne CRC32C", block);
+        return;
+    }
+    if (imageGroup) {
+        groupData(block, payload, psize);
+        return;
+    }
+
+    if ((imageNext == 0) || (prev != imageAcked) || (block <= imageAcked)) {
+        if (imageAcked > 0) {
+            replyState(addr, static_cast<quint16>(imageAcked), RESULT_OK);
+        }
+        return;
+    }
+    int offset = (block - 1) * blockSize;
+    if ((psize > blockSize)
+        || (static_cast<quint32>(offset + psize) > imageSize)) {
+        imageNext = 0;
+        imageAcked = 0;
+        replyState(addr, static_cast<quint16>(block), SIM_RESULT_ERROR);
+        return;
+    }
+
+    // zapis stron: centralka zajęta przez cfg.flash na każdą stronę
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    flashBusy = qMax(flashBusy, now)
+                + cfg.flash * qMax((psize + pageSize - 1) / pageSize, 1);
+    if (imageData.size() < offset + psize) {
+        imageData.resize(offset + psize);
+    }
+    memcpy(imageData.data() + offset, payload, static_cast<size_t>(psize));
+    imageAcked = block;
+    imageNext = block + 1;
+
+    if (psize < blockSize) {
+        // krótszy blok kończy aktualizację
+        bool fOk = (static_cast<quint32>(offset + psize) == imageSize)
+                   && imageComplete();
+        if (!fOk) {
+            imageAcked = 0;
+        }
+        imageNext = 0;
+        replyState(addr, static_cast<quint16>(block),
+                   fOk ? RESULT_OK : SIM_RESULT_ERROR,
+                   static_cast<int>(flashBusy - now));
+        return;
+    }
+    replyState(addr, static_cast<quint16>(block), RESULT_OK,
+               static_cast<int>(flashBusy - now));
+
+} // SimStation::upgradeData
+
+// blok aktualizacji grupowej; błąd zgłaszany w odpowiedzi na pytanie
+void SimStation::groupData(int block, const char *payload, int psize)
+{
+    if ((imageNext == 0) || (block < 1) || (block > imageBlocks)
+        || received.at(block)) {
+        return;
+    }
+    qint64 offset = static_cast<qint64>(block - 1) * blockSize;
+    if (psize != qMin(static_cast<qint64>(blockSize), imageSize - offset)) {
+        imageNext = 0;
+        imageAcked = 0;
+        groupResult = SIM_RESULT_ERROR;
+        return;
+    }
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    flashBusy = qMax(flashBusy, now)
+                + cfg.flash * qMax((psize + pageSize - 1) / pageSize, 1);
+    memcpy(imageData.data() + offset, payload, static_cast<size_t>(psize));
+    received[block] = 1;
+    while ((imageAcked < imageBlocks) && received.at(imageAcked + 1)) {
+        imageAcked++;
+    }
+
+    if (imageAcked == imageBlocks) {
+        imageNext = 0;
+        if (!imageComplete()) {
+            imageAcked = 0;
+            groupResult = SIM_RESULT_ERROR;
+        }
+    }
+
+} // SimStation::groupData
+
+// pytanie aktualizacji grupowej: zapisane bloki i brakujące do last,
+// po zapisie odebranych stron
+void SimStation::pollReq(quint32 addr, const NetView<UpgradePoll_dg>& data)
+{
+    if (!imageGroup) {
+        // centralka spoza grupy
+        return;
+    }
+
+    int last = qMin(static_cast<int>(data.get(&UpgradePoll_dg::last)), imageBlocks);
+    QList<quint16> missing;
+    for (int block = imageAcked + 1; (block <= last)
+         && (missing.count() < UPG_NACK_COUNT); block++) {
+        if (!received.at(block)) {
+            missing.append(static_cast<quint16>(block));
+        }
+    }
+
+    int size = static_cast<int>(sizeof(UpgradeNack_dg)) + missing.count() * 2;
+    QByteArray dg(size, 0);
+    NetFrame<UpgradeNack_dg> head(WICS_UPGRADE_NACK, size);
+    head.set(&UpgradeNack_dg::round, data.get(&UpgradePoll_dg::round));
+    head.set(&UpgradeNack_dg::result, groupResult);
+    head.set(&UpgradeNack_dg::acked, static_cast<quint16>(imageAcked));
+    head.set(&UpgradeNack_dg::count, static_cast<quint16>(missing.count()));
+    memcpy(dg.data(), head.data(), sizeof(UpgradeNack_dg));
+    for (int cnt = 0; cnt < missing.count(); cnt++) {
+        qToLittleEndian<quint16>(missing.at(cnt),
+                                 dg.data() + sizeof(UpgradeNack_dg) + cnt * 2);
+    }
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    reply(addr, dg.constData(), dg.size(),
+          static_cast<int>(qMax(Q_INT64_C(0), flashBusy - now)));
+
+} // SimStation::pollReq
+
+// skróty stron pamięci flash, strony poza obrazem liczone z tego, co jest
+void SimStation::pageHashReq(quint32 addr, const NetView<PageHash_dg>& data)
+{
+    int mod = data.get(&PageHash_dg::flags) & UPGRADE_MODULE_MASK;
+    int first = data.get(&PageHash_dg::first);
+    int count = qMin(static_cast<int>(data.get(&PageHash_dg::count)),
+                     UPG_HASH_COUNT);
+    int psize = (mod == UPGRADE_WLAN) ? UPG_WLAN_PAGE : UPG_DCCG_PAGE;
+
+    if ((first < 1) || ((mod != UPGRADE_WLAN) && (mod != UPGRADE_DCCGEN))) {
+        return;
+    }
+
+    const QByteArray& image = flashImage(mod);
+    const uchar *pages = reinterpret_cast<const uchar*>(image.constData());
+    int size = static_cast<int>(sizeof(PageHash_dg)) + count * 4;
+    QByteArray dg(size, 0);
+    NetFrame<PageHash_dg> head(WICS_PAGEHASH, size);
+    head.set(&PageHash_dg::flags, static_cast<quint16>(mod));
+    head.set(&PageHash_dg::first, static_cast<quint16>(first));
+    head.set(&PageHash_dg::count, static_cast<quint16>(count));
+    memcpy(dg.data(), head.data(), sizeof(PageHash_dg));
+    for (int cnt = 0; cnt < count; cnt++) {
+        qint64 offset = static_cast<qint64>(first - 1 + cnt) * psize;
+        qint64 len = qBound(Q_INT64_C(0), image.size() - offset,
+                            static_cast<qint64>(psize));
+        qToLittleEndian<quint32>(netPageHash(pages + (len > 0 ? offset : 0), len),
+                                 dg.data() + sizeof(PageHash_dg) + cnt * 4);
+    }
+    reply(addr, dg.constData(), dg.size());
+
+} // SimStation::pageHashReq
+
+QString SimStation::imageName(int mod) const
+{
+    return QDir(cfg.outDir).filePath(QString("%1-%2.bin")
+                   .arg(QHostAddress(theAddr).toString())
+                   .arg(mod == UPGRADE_WLAN ? "wlan" : "dcc"));
+}
+
+// pamięć flash modułu: ostatnio zapisany obraz, także z poprzedniego
+// uruchomienia symulatora
+const QByteArray& SimStation::flashImage(int mod)
+{
+    if (!flash.contains(mod)) {
+        QFile file(imageName(mod));
+        QByteArray data;
+        if (file.open(QIODevice::ReadOnly)) {
+            data = file.readAll();
+            file.close();
+        }
+        flash.insert(mod, data);
+    }
+    return flash[mod];
+}
+
+// obraz odebrany w całości: sprawdzenie skrótów ze startu i zapis
+// w pamięci flash
+bool SimStation::imageComplete()
+{
+    if (imageDigest) {
+        // obraz złożony z nowych bloków i stron pamięci flash
+        QByteArray sha = QCryptographicHash::hash(
+                    imageData.left(static_cast<int>(imageSize)),
+                    QCryptographicHash::Sha256);
+        if ((netCrc32c(imageData.constData(), imageSize) != digestCrc)
+            || (sha != digestSha)) {
+            qDebug("Obraz: skrót niezgodny ze startem aktualizacji");
+            return false;
+        }
+    }
+    imageData.truncate(static_cast<int>(imageSize));
+    flash.insert(module, imageData);
+    saveImage();
+    return true;
+
+} // SimStation::imageComplete
+
+void SimStation::saveImage()
+{
+    QString name = imageName(module);
+    QFile file(name);
+    if (file.open(QIODevice::WriteOnly)) {
+        file.write(imageData);
+        file.close();
+        qDebug("%s: zapisano %dB do %s",
+               QHostAddress(theAddr).toString().toLatin1().data(),
+               imageData.size(), name.toLocal8Bit().data());
+    }
+    else {
+        qDebug("%s: błąd zapisu %s",
+               QHostAddress(theAddr).toString().toLatin1().data(),
+               name.toLocal8Bit().data());
+    }
+
+} // SimStation::saveImage
+
+// EOF simstation.cpp
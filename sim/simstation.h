@@ -0,0 +1,114 @@
+//
+// Wireless Command Station
+//
+// Copyright 2020 Robert Nagowski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// See gpl-3.0.md file for details.
+//
+
+#ifndef SIMSTATION_H
+#define SIMSTATION_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <QtNetwork/QUdpSocket>
+
+#include <random>
+
+#include "datagrams.h"
+#include "netcodec.h"
+#include "netdigest.h"
+
+#define SIM_RESULT_ERROR    1       // odpowiedź UpgradeState_dg: błąd
+#define SIM_MAX_BLOCK       4096    // blok przyjmowany przez centralkę (sektor flash)
+
+// Warunki sieci i urządzenia symulowanej centralki
+struct SimConfig {
+    int     loss;           // utrata datagramu w każdą stronę [%]
+    int     rtt;            // opóźnienie odpowiedzi [ms]
+    int     jitter;         // rozrzut opóźnienia +/- [ms]
+    int     reorder;        // odpowiedź wyprzedzana przez następne [%]
+    int     flash;          // zapis strony firmware [ms]
+    int     maxBlock;       // maks. rozmiar bloku, 0: bez negocjacji
+    QString outDir;         // katalog odebranych obrazów
+};
+
+// Symulowana centralka WiCS: odpowiada na DEVINFO, WIFISTA, UPGRADE,
+// PAGEHASH i UPGRADE_POLL jak ESP-8266, z gniazda na własnym adresie
+// lokalnym.
+// Firmware zapisany w katalogu cfg.outDir jest jej pamięcią flash.
+class SimStation : public QObject
+{
+    Q_OBJECT
+
+private:
+    QUdpSocket  udpSocket;
+    quint32     theAddr;
+    quint16     thePort;
+    quint32     serialNum;
+    SimConfig   cfg;
+    std::mt19937 rnd;
+    char        ssid[MAX_WLAN_NAME+1];
+    char        pass[MAX_WLAN_PASS+1];
+    // aktualizacja
+    int         module;
+    int         pageSize;       // strona pamięci flash modułu
+    int         blockSize;      // rozmiar bloku aktualizacji
+    quint32     imageSize;
+    int         imageNext;      // oczekiwany numer bloku, 0: brak aktualizacji
+    int         imageAcked;     // ostatni zapisany blok
+    bool        imageSparse;    // UPGRADE_SPARSE: bloki z polem prev
+    bool        imageCrc;       // UPGRADE_CRC: bloki z CRC32C danych
+    bool        imageDigest;    // UPGRADE_DIGEST: skróty obrazu ze startu
+    bool        imageGroup;     // UPGRADE_GROUP: bloki w dowolnej kolejności,
+                                // braki w odpowiedzi na WICS_UPGRADE_POLL
+    int         imageBlocks;    // liczba bloków aktualizacji grupowej
+    QByteArray  received;       // odebrane bloki aktualizacji grupowej
+    quint16     groupResult;    // wynik aktualizacji grupowej
+    quint32     digestCrc;
+    QByteArray  digestSha;
+    QByteArray  imageData;
+    QHash<int, QByteArray> flash;   // zapisany firmware według modułu
+    qint64      flashBusy;      // koniec zapisu ostatniej strony [ms]
+    quint16     peerPort;       // port nadawcy bieżącego datagramu
+
+    static const NetHandler<SimStation> handlers[];
+
+    bool lost();
+    void reply(quint32 addr, const void *data, int size, int busy = 0);
+    void replyState(quint32 addr, quint16 block, quint16 result, int busy = 0);
+    QString imageName(int mod) const;
+    const QByteArray& flashImage(int mod);
+    bool imageComplete();
+    void saveImage();
+    void groupData(int block, const char *payload, int psize);
+
+    void devInfoReq(quint32 addr, const NetView<NetDatagram_dg>& data);
+    void wiFiStaReq(quint32 addr, const NetView<NetDatagram_dg>& data);
+    void wiFiSta(quint32 addr, const NetView<WiFiStation_dg>& data);
+    void heartbeatReq(quint32 addr, const NetView<NetDatagram_dg>& data);
+    void upgradeStart(quint32 addr, const NetView<UpgradeInit_dg>& data);
+    void upgradeData(quint32 addr, const NetView<UpgradeData_dg>& data);
+    void pageHashReq(quint32 addr, const NetView<PageHash_dg>& data);
+    void pollReq(quint32 addr, const NetView<UpgradePoll_dg>& data);
+
+public:
+    SimStation(quint32 addr, quint16 port, quint32 serial,
+               const SimConfig& config, QObject *parent = nullptr);
+
+    bool open();
+    quint32 address() const { return theAddr; }
+    void processDatagram(quint32 addr, quint16 port, const QByteArray& datagram);
+
+private slots:
+    void readDatagrams();
+
+}; // SimStation
+
+#endif // SIMSTATION_H
@@ -0,0 +1,26 @@
+#-------------------------------------------------
+#
+# wics_sim: symulator centralek WiCS na adresach lokalnych
+#
+#-------------------------------------------------
+
+QT       -= gui
+QT       += network
+
+TARGET = wics_sim
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+INCLUDEPATH += ..
+
+SOURCES += \
+        main.cpp \
+        simstation.cpp \
+        ../netdigest.cpp
+
+HEADERS += \
+        simstation.h \
+        ../datagrams.h \
+        ../netcodec.h \
+        ../netdigest.h
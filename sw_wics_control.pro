@@ -27,13 +27,12 @@ CONFIG += c++11
 
 SOURCES += \
         main.cpp \
-        mainwindow.cpp \
-        netengine.cpp
+        mainwindow.cpp
 
 HEADERS += \
-        datagrams.h \
-        mainwindow.h \
-        netengine.h
+        mainwindow.h
+
+include(netengine.pri)
 
 FORMS += \
         mainwindow.ui